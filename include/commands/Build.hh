@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filesystem>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -12,19 +13,82 @@
 class Build : public Command
 {
 public:
-  Build(bool force, bool release_mode);
+  Build(bool force, bool release_mode, bool watch);
   virtual int execute() override;
 
 private:
   bool generateCMakeLists(const std::vector<File> &sources,
+                          const std::vector<std::string> &cflags,
                           const std::vector<std::string> &libs);
 
   std::vector<File> scanSources(const std::filesystem::path &root) const;
-  std::vector<std::string>
-  detectLibraries(const std::vector<File> &sources) const;
+  void detectLibraries(const std::vector<File> &sources,
+                       std::vector<std::string> &cflags,
+                       std::vector<std::string> &libs) const;
+
+  /**
+   * @brief Scan the sources, generate the CMakeLists.txt if needed and
+   * configure the build directory
+   *
+   * @param root The root of the project
+   * @param sources Filled with the sources of the project
+   * @param cflags Filled with the compiling flags of the included libraries
+   * @param libs Filled with the linked libraries
+   */
+  void configure(const std::filesystem::path &root, std::vector<File> &sources,
+                 std::vector<std::string> &cflags,
+                 std::vector<std::string> &libs);
+
+  /**
+   * @brief Build and report on it, then build again whenever a file of the
+   * project changes, until interrupted
+   *
+   * @return Exit code
+   */
+  int runWatch();
+
+  /**
+   * @brief Read the local files each file of the project includes, following
+   * the included headers
+   *
+   * @param files The files to be read, their entries being replaced
+   */
+  void updateGraph(const std::vector<std::filesystem::path> &files);
+
+  /**
+   * @brief Check if a file of the project includes another one, directly or
+   * through other headers
+   */
+  bool dependsOn(const std::filesystem::path &file,
+                 const std::filesystem::path &dependency) const;
+
+  /**
+   * @brief Read the compiling command of each source from the
+   * compile_commands.json of the build directory
+   */
+  void loadCompileCommands();
+
+  /**
+   * @brief Compile sources with their commands from the build directory, the
+   * highest priority first
+   *
+   * @param sources The sources to be compiled, by priority
+   * @return Whether or not all of them compiled
+   */
+  bool compileSources(
+      const std::vector<std::pair<long long, std::filesystem::path>> &sources)
+      const;
 
   bool force_;
   bool release_mode_;
+  bool watch_;
   Registry &registry_;
   Settings &settings_;
+
+  // Local files included by each file of the project (watch mode)
+  std::map<std::filesystem::path, std::vector<std::filesystem::path>> graph_;
+
+  // Source -> directory and command compiling it (watch mode)
+  std::map<std::filesystem::path, std::pair<std::string, std::string>>
+      commands_;
 };
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+#include <commands/Command.hh>
+
+class Compare : public Command
+{
+public:
+  /**
+   * @brief Tell whether two benchmarks of zc run --bench differ
+   * significantly, or which functions take more or less of two profiles of
+   * zc run --profile
+   *
+   * @param baseline The reference benchmark (.json) or profile (.folded)
+   * @param candidate The benchmark or profile compared to it
+   */
+  Compare(const std::string &baseline, const std::string &candidate);
+
+  /**
+   * @brief Execute command
+   *
+   * @return Exit code
+   */
+  virtual int execute() override;
+
+private:
+  std::string baseline_;
+  std::string candidate_;
+};
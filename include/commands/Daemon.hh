@@ -0,0 +1,32 @@
+#pragma once
+
+#include <commands/Command.hh>
+#include <objects/DaemonServer.hh>
+
+class Daemon : public Command
+{
+public:
+  /**
+   * @brief Start, stop or query the ZC daemon
+   *
+   * @param detach Whether to run the daemon in the background
+   * @param stop Whether to stop the running daemon
+   * @param status Whether to tell if a daemon is running
+   * @param handler Runs the commands sent to the daemon
+   */
+  Daemon(bool detach, bool stop, bool status, DaemonServer::Handler handler);
+
+  /**
+   * @brief Execute command
+   *
+   * @return Exit code
+   */
+  virtual int execute() override;
+
+private:
+  bool detach_;
+  bool stop_;
+  bool status_;
+
+  DaemonServer::Handler handler_;
+};
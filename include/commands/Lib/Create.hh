@@ -17,9 +17,13 @@ public:
    * @param files The files used to create the new library
    * @param force Whether to force creating the library even if it already
    * exists
+   * @param isa_levels ISA levels to compile the sources for, the best one
+   * being picked at load time (e.g. x86-64-v3)
+   * @param dependencies The packages the library links against
    */
   Create(const std::string &package_name, const std::vector<std::string> &files,
-         bool force);
+         bool force, const std::vector<std::string> &isa_levels,
+         const std::vector<std::string> &dependencies);
 
   /**
    * @brief Execute the command
@@ -29,8 +33,18 @@ public:
   virtual int execute() override;
 
 private:
+  /**
+   * @brief Install the library packed in a bundle
+   *
+   * @param bundles The bundles given as files (only one is allowed)
+   * @return Exit code
+   */
+  int installBundle(const std::vector<File> &bundles) const;
+
   bool force_;
   Registry &registry_;
   std::string package_name_;
   std::vector<File> files_;
+  std::vector<std::string> isa_levels_;
+  std::vector<std::string> dependencies_;
 };
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <commands/Command.hh>
+#include <objects/Registry.hh>
+
+class Gc : public Command
+{
+public:
+  /**
+   * @brief Reclaim the header blobs not used by any library anymore
+   */
+  Gc();
+
+  /**
+   * @brief Execute command
+   *
+   * @return Exit code
+   */
+  virtual int execute() override;
+
+private:
+  Registry &registry_;
+};
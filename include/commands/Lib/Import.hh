@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <commands/Command.hh>
+#include <objects/Registry.hh>
+
+class Import : public Command
+{
+public:
+  /**
+   * @brief Import system libraries described by pkg-config files
+   *
+   * @param modules The pkg-config modules to be imported
+   * @param all Whether to import every module known by pkg-config
+   */
+  Import(const std::vector<std::string> &modules, bool all);
+
+  /**
+   * @brief Execute command
+   *
+   * @return Exit code
+   */
+  virtual int execute() override;
+
+private:
+  std::vector<std::string> modules_;
+  bool all_;
+
+  Registry &registry_;
+};
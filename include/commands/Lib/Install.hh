@@ -1,19 +1,26 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <commands/Command.hh>
-#include <objects/Registry.hh>
+#include <objects/Postman.hh>
 
 class Install : public Command
 {
 public:
   /**
-   * @brief Install a library from server (not implemented)
+   * @brief Install libraries from a package store or from bundles
    *
-   * @param target The name of the package to be installed
+   * @param targets The names of the packages to be installed, or paths to
+   * .zcpkg bundles
+   * @param server The store to install from (the package_server setting if
+   * empty)
+   * @param static_libs Whether or not the static libraries of bundles are
+   * installed
    */
-  Install(const std::string &target);
+  Install(const std::vector<std::string> &targets, const std::string &server,
+          bool static_libs);
 
   /**
    * @brief Execute command
@@ -23,7 +30,8 @@ public:
   virtual int execute() override;
 
 private:
-  const std::string target_;
+  const std::vector<std::string> targets_;
+  bool static_libs_;
 
-  Registry &registry_;
+  Postman &postman_;
 };
@@ -8,8 +8,13 @@ class List : public Command
 public:
   /**
    * @brief Display installed libraries
+   *
+   * @param display_std Whether to display the standard libraries instead
+   * @param page The page to display, starting from 1 (0 for all libraries)
+   * @param per_page The number of libraries per page
+   * @param max_width The maximum width of a cell (0 for no limit)
    */
-  List(bool display_std);
+  List(bool display_std, size_t page, size_t per_page, size_t max_width);
 
   /**
    * @brief Execute command
@@ -20,5 +25,8 @@ public:
 
 private:
   const bool display_std_ = false;
+  size_t page_;
+  size_t per_page_;
+  size_t max_width_;
   const Registry &registry_;
 };
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <commands/Command.hh>
+#include <objects/Registry.hh>
+
+class Pack : public Command
+{
+public:
+  /**
+   * @brief Pack installed libraries into .zcpkg bundles
+   *
+   * @param targets The names of the packages to be packed
+   * @param output_dir The directory of the bundles (the current directory if
+   * empty)
+   */
+  Pack(const std::vector<std::string> &targets, const std::string &output_dir);
+
+  /**
+   * @brief Execute command
+   *
+   * @return Exit code
+   */
+  virtual int execute() override;
+
+private:
+  const std::vector<std::string> targets_;
+  std::string output_dir_;
+
+  Registry &registry_;
+};
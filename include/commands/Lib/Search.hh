@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <commands/Command.hh>
+#include <objects/Registry.hh>
+#include <objects/SearchIndex.hh>
+
+class Search : public Command
+{
+public:
+  /**
+   * @brief Search the installed libraries by name, author, header or function
+   *
+   * @param query The words to look for
+   * @param limit The maximum number of results (0 for all of them)
+   * @param rebuild Whether to rebuild the search index first
+   */
+  Search(const std::vector<std::string> &query, size_t limit, bool rebuild);
+
+  /**
+   * @brief Execute command
+   *
+   * @return Exit code
+   */
+  virtual int execute() override;
+
+private:
+  std::string query_;
+  size_t limit_;
+  bool rebuild_;
+
+  Registry &registry_;
+  SearchIndex &index_;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+#include <commands/Command.hh>
+
+class Serve : public Command
+{
+public:
+  /**
+   * @brief Serve a local package store over a Unix socket
+   *
+   * @param store The directory of the store
+   * @param socket_path The path of the socket to listen on
+   */
+  Serve(const std::string &store, const std::string &socket_path);
+
+  /**
+   * @brief Execute command (never returns unless an error occurs)
+   *
+   * @return Exit code
+   */
+  virtual int execute() override;
+
+private:
+  const std::string store_;
+  const std::string socket_path_;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <commands/Command.hh>
+#include <objects/Postman.hh>
+#include <objects/Registry.hh>
+
+class Upload : public Command
+{
+public:
+  /**
+   * @brief Upload installed libraries to a package store
+   *
+   * @param targets The names of the packages to be uploaded
+   * @param server The store to upload to (the package_server setting if
+   * empty)
+   */
+  Upload(const std::vector<std::string> &targets, const std::string &server);
+
+  /**
+   * @brief Execute command
+   *
+   * @return Exit code
+   */
+  virtual int execute() override;
+
+private:
+  const std::vector<std::string> targets_;
+
+  Registry &registry_;
+  Postman &postman_;
+};
@@ -2,10 +2,16 @@
 
 #include "objects/Registry.hh"
 #include "objects/Settings.hh"
+#include <filesystem>
+#include <functional>
+#include <map>
 #include <objects/File.hh>
+#include <objects/NoiseControl.hh>
 #include <string>
 #include <vector>
 
+#include <sys/types.h>
+
 #include <commands/Command.hh>
 
 enum Mode
@@ -16,23 +22,79 @@ enum Mode
   ASSEMBLE
 };
 
+/**
+ * @brief The options of zc run, as given on the command line
+ */
+struct RunOptions
+{
+  // The files to be compiled (and executed)
+  std::vector<std::string> files_;
+
+  // The arguments to be passed to the program once executed
+  std::vector<std::string> args_;
+
+  // Keep the executable once executed
+  bool keep_ = false;
+
+  // Force compilation as C++
+  bool plus_ = false;
+
+  // Preprocess only, compile only, or compile and assemble only
+  bool preprocess_ = false;
+  bool compile_ = false;
+  bool assemble_ = false;
+
+  // Run the program through the JIT, without building an executable
+  bool jit_ = false;
+
+  // Build and run the program again whenever a file changes
+  bool watch_ = false;
+
+  // The number of timed runs of the program, 0 to run it once, and of the
+  // runs before them
+  size_t bench_ = 0;
+  size_t warmup_ = 3;
+
+  // The file of the benchmark results, empty for <program>.bench.json
+  std::string bench_output_;
+
+  // The CPUs the program is pinned to, empty not to pin it
+  std::vector<unsigned> cpus_;
+
+  // Run the program without ASLR and with a normalized environment
+  bool low_noise_ = false;
+
+  // Raise the scheduling priority of the program
+  bool priority_ = false;
+
+  // Report the resources used by the program
+  bool time_ = false;
+
+  // The address space allowed to the program in MiB, and its CPU time in
+  // seconds, 0 for no limit
+  size_t max_memory_ = 0;
+  size_t max_cpu_ = 0;
+
+  // Report the performance counters of the program
+  bool counters_ = false;
+
+  // Sample the stacks of the program and write its flame graph
+  bool profile_ = false;
+
+  // Record the heap allocations of the program
+  bool heap_ = false;
+};
+
 class Run : public Command
 {
 public:
   /**
    * @brief Compile given files and execute program if the output is executable
    *
-   * @param files The files to be compiled (and execute)
-   * @param args The arguments to be passed to the program once executed
-   * @param keep Whether to keep the executable once executed or not
-   * @param plus Whether to force compilation as C++
-   * @param preprocess Preprocess only
-   * @param compile Preprocess and compile only
-   * @param assemble Preprocess, compile and assemble only
+   * @param options The files, the arguments of the program and the options of
+   * the command
    */
-  Run(const std::vector<std::string> &files,
-      const std::vector<std::string> &args, bool keep, bool plus,
-      bool preprocess, bool compile, bool assemble);
+  Run(const RunOptions &options);
 
   /**
    * @brief Execute command
@@ -62,11 +124,145 @@ private:
   bool isCppAndCheckExtensions(std::string &badFile) const;
 
   /**
-   * @brief build the compiling command
+   * @brief Get the arguments compiling the sources: the compiler, the
+   * standard and the compiling flags
+   *
+   * @param cflags The compiling flags of the included libraries
+   */
+  std::vector<std::string>
+  getCompileArgs(const std::vector<std::string> &cflags) const;
+
+  /**
+   * @brief Precompile the headers the units include first, and make the
+   * compiling arguments use them
+   *
+   * The header is only used when every C and C++ unit starts with the same
+   * block of system inclusions, which it then stands for exactly.
+   *
+   * @param args The compiling arguments, starting with the compiler
+   * @param units The units compiled with the arguments
+   * @param in_process Whether the files are compiled in-process
+   */
+  void addPrecompiledHeader(std::vector<std::string> &args,
+                            const std::vector<File> &units,
+                            bool in_process) const;
+
+  /**
+   * @brief Get the directories of the libraries, the variant matching the
+   * optimization level first
+   */
+  std::vector<std::filesystem::path> getLibDirs() const;
+
+  /**
+   * @brief Compile the files to LLVM IR and run them through the JIT
+   *
+   * @return Exit code
+   */
+  int runJit() const;
+
+  /**
+   * @brief build the arguments of the compiling command, starting with the
+   * compiler
    *
    * @param output_name The name of the output of the command
    */
-  std::string buildCommand(const std::string &output_name) const;
+  std::vector<std::string> buildArgs(const std::string &output_name) const;
+
+  /**
+   * @brief Run a compiling command, in-process if it is enabled
+   *
+   * @param args The arguments of the command, starting with the compiler
+   * @return Whether or not the command succeeded
+   */
+  bool runCompiler(const std::vector<std::string> &args) const;
+
+  /**
+   * @brief Run the compiled program with the arguments as its argv, without
+   * a shell, and report the resources it used if asked
+   *
+   * @param path The executable, or the name of the program if fd is given
+   * @param fd A file descriptor of the executable, -1 to execute path
+   * @return The exit code of the program, 128 + the signal if it was killed
+   */
+  int runProgram(const std::string &path, int fd) const;
+
+  /**
+   * @brief Start the compiled program with the arguments as its argv,
+   * without waiting for it
+   *
+   * @param path The executable, or the name of the program if fd is given
+   * @param fd A file descriptor of the executable, -1 to execute path
+   * @param quiet Whether to discard the output of the program
+   * @param on_start Called with the process once it is created, before it
+   * executes the program. May be empty
+   * @return The process of the program
+   */
+  pid_t startProgram(const std::string &path, int fd, bool quiet,
+                     const std::function<void(pid_t)> &on_start) const;
+
+  /**
+   * @brief Build the program once, then run it several times and report
+   * statistics of its timings
+   *
+   * @return Exit code
+   */
+  int runBench() const;
+
+  /**
+   * @brief Build the program with frame pointers, run it with the sampler
+   * preloaded, and write its profile
+   *
+   * @return Exit code
+   */
+  int runProfile() const;
+
+  /**
+   * @brief Build the program with frame pointers, run it with the allocator
+   * hooks preloaded, and write its heap profile
+   *
+   * @return Exit code
+   */
+  int runHeap() const;
+
+  /**
+   * @brief Run the compiled program once, its output being discarded, and
+   * measure it
+   *
+   * @param path The name of the program
+   * @param fd A file descriptor of the executable
+   * @param wall Filled with the wall-clock time, in seconds
+   * @param user Filled with the user CPU time, in seconds
+   * @param sys Filled with the system CPU time, in seconds
+   * @return The exit code of the program, 128 + the signal if it was killed
+   */
+  int timeProgram(const std::string &path, int fd, double &wall, double &user,
+                  double &sys) const;
+
+  /**
+   * @brief Build and run the program, then build and run it again whenever
+   * one of its files changes, until interrupted
+   *
+   * @return Exit code
+   */
+  int runWatch() const;
+
+  /**
+   * @brief Compile the translation units which changed into objects and link
+   * the program
+   *
+   * @param work_dir The directory holding the objects between builds
+   * @param changed The files which changed since the previous build
+   * @param deps The local files read by each translation unit, updated with
+   * the units compiled
+   * @param last_args The compiling arguments of the previous build, updated
+   * @param exe_fd The memory file the program is linked into
+   * @return Whether or not the program could be built
+   */
+  bool buildWatched(const std::filesystem::path &work_dir,
+                    const std::vector<std::filesystem::path> &changed,
+                    std::map<std::string, std::vector<std::filesystem::path>>
+                        &deps,
+                    std::vector<std::string> &last_args, int exe_fd) const;
 
   /**
    * @brief Check that all files exist
@@ -77,14 +273,40 @@ private:
   bool filesExist(std::string &badFile) const;
 
   /**
-   * @brief Get library inclusions from file
+   * @brief Get the flags of the libraries included by the files
+   *
+   * @param cflags Filled with the compiling flags
+   * @param ldflags Filled with the linking flags, in linking order
    */
-  std::vector<std::string> getInclusions() const;
+  void getInclusions(std::vector<std::string> &cflags,
+                     std::vector<std::string> &ldflags) const;
 
   bool keep_ = false;
 
   bool plus_ = false;
 
+  bool jit_ = false;
+
+  bool watch_ = false;
+
+  size_t bench_ = 0;
+
+  size_t warmup_ = 0;
+
+  std::string bench_output_;
+
+  bool time_ = false;
+
+  size_t max_memory_ = 0;
+
+  size_t max_cpu_ = 0;
+
+  bool counters_ = false;
+
+  bool profile_ = false;
+
+  bool heap_ = false;
+
   Mode mode_ = FULL;
 
   Settings &settings_;
@@ -94,4 +316,6 @@ private:
   std::vector<File> files_;
 
   std::vector<std::string> args_;
+
+  NoiseControl noise_;
 };
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * @brief Incremental SHA-256, used to address packages content
+ */
+class Sha256
+{
+public:
+  Sha256();
+
+  /**
+   * @brief Feed data to the hash
+   *
+   * @param data The data to be hashed
+   * @param size The size of the data
+   */
+  void update(const void *data, size_t size);
+
+  /**
+   * @brief Finish the hash
+   *
+   * @return The digest as a lowercase hexadecimal string
+   */
+  std::string hex();
+
+private:
+  void transform(const uint8_t *block);
+
+  uint32_t state_[8];
+  uint8_t buffer_[64];
+  uint64_t length_ = 0;
+  size_t buffered_ = 0;
+};
+
+/**
+ * @brief Hash a buffer with SHA-256
+ *
+ * @return The digest as a lowercase hexadecimal string
+ */
+std::string sha256(const std::string &data);
+
+/**
+ * @brief Hash the content of a file with SHA-256
+ *
+ * @return The digest as a lowercase hexadecimal string (empty if the file
+ * couldn't be read)
+ */
+std::string sha256File(const std::filesystem::path &path);
+
+/**
+ * @brief Check that a string looks like a SHA-256 hexadecimal digest
+ */
+bool isSha256(const std::string &hash);
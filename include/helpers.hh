@@ -6,6 +6,12 @@
 
 #define ROOT_DIR ".zc"
 
+// Clang binary of the linked LLVM, next to which its builtin headers and
+// clang-scan-deps are installed
+#ifndef ZC_CLANG_PATH
+#define ZC_CLANG_PATH "clang"
+#endif
+
 std::string escape_shell_arg(const std::string &arg);
 
 std::vector<std::string> split(const std::string &s, char delimiter);
@@ -24,6 +30,15 @@ std::filesystem::path getZCRootDir();
 std::string join(const std::vector<std::string> &v,
                  const std::string &separator);
 
+/**
+ * @brief Run a shell command and capture its standard output
+ *
+ * @param cmd The command to be run
+ * @param output Filled with the standard output of the command
+ * @return Whether or not the command exited successfully
+ */
+bool captureOutput(const std::string &cmd, std::string &output);
+
 /**
  * @brief Convert string to uppercase
  *
@@ -38,3 +53,95 @@ std::string upper(const std::string &s);
  * @throws ZCError if no .zc directory is found in the hierarchy.
  */
 std::filesystem::path getProjectRoot();
+
+/**
+ * @brief Identify a compiler by the path, size and modification time of its
+ * binary, so that what it built is dropped when it is upgraded
+ *
+ * @param compiler The compiler, searched in the PATH if it has no directory
+ */
+std::string compilerId(const std::string &compiler);
+
+/**
+ * @brief Read the files listed by a Makefile dependency file
+ *
+ * @param deps The dependency file (written by -MD)
+ */
+std::vector<std::string> readDependencies(const std::filesystem::path &deps);
+
+/**
+ * @brief Find a library shipped with ZC to be preloaded into programs, next
+ * to the zc binary (build tree) or in its installation directory
+ *
+ * @param name The file name of the library
+ * @throws ZCError if the library isn't found
+ */
+std::filesystem::path getPreloadLibrary(const std::string &name);
+
+/**
+ * @brief Add flags to a list, each flag with its separate operand (e.g.
+ * "-framework Foo", "-Xlinker --as-needed") being added or skipped as a
+ * whole
+ *
+ * @param flags The list the flags are added to
+ * @param added The flags to be added
+ * @param keep_last Whether a flag already in the list moves to the end (the
+ * order static linking needs), else it stays at its first position
+ */
+void mergeFlags(std::vector<std::string> &flags,
+                const std::vector<std::string> &added, bool keep_last);
+
+/**
+ * @brief Build the shell command running a program, its arguments being
+ * escaped
+ *
+ * @param args The program followed by its arguments
+ */
+std::string buildCommand(const std::vector<std::string> &args);
+
+/**
+ * @brief Run a program through the shell
+ *
+ * @param args The program followed by its arguments
+ * @param quiet Whether its output is discarded
+ * @return Whether or not it exited successfully
+ */
+bool runCommand(const std::vector<std::string> &args, bool quiet = false);
+
+/**
+ * @brief Identify the compiler building cached files: the linked LLVM when
+ * compiling in-process, else the compiler binary (see compilerId)
+ *
+ * @param compiler The compiler
+ * @param in_process Whether the files are compiled in-process
+ */
+std::string toolchainId(const std::string &compiler, bool in_process);
+
+/**
+ * @brief Get the path a file is written at before being renamed into place,
+ * unique to the process and thread
+ *
+ * @param path The final path of the file
+ */
+std::filesystem::path tempPath(const std::filesystem::path &path);
+
+/**
+ * @brief Rename a file written aside into place, removing it if that fails
+ *
+ * @param tmp The file written aside (see tempPath)
+ * @param path The final path of the file
+ * @return Whether or not it was renamed
+ */
+bool moveIntoPlace(const std::filesystem::path &tmp,
+                   const std::filesystem::path &path);
+
+/**
+ * @brief Write a file atomically: readers see the old or the new content,
+ * never a partial one
+ *
+ * @param path The file to be written, its directory being created
+ * @param data The new content
+ * @return Whether or not it was written
+ */
+bool writeAtomically(const std::filesystem::path &path,
+                     const std::string &data);
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <zcio.hh>
+
+/**
+ * @brief Statistics of the timings of a benchmark, in seconds
+ */
+struct Summary
+{
+  double min_ = 0;
+  double median_ = 0;
+  double mean_ = 0;
+  double stddev_ = 0;
+  double p90_ = 0;
+  double p99_ = 0;
+
+  // 95% confidence interval of the mean
+  double ci_low_ = 0;
+  double ci_high_ = 0;
+
+  // Runs beyond 1.5 interquartile range from the quartiles (Tukey's fences)
+  size_t outliers_ = 0;
+};
+
+void to_json(nlohmann::json &j, const Summary &s);
+
+/**
+ * @brief Timings of the runs of a program: wall-clock, user and system time
+ */
+class Benchmark
+{
+public:
+  /**
+   * @brief Create a benchmark without any run
+   *
+   * @param program The name of the program
+   * @param warmup The number of runs done before the timed ones
+   */
+  Benchmark(const std::string &program, size_t warmup);
+
+  /**
+   * @brief Add the timings of a run, in seconds
+   */
+  void addRun(double wall, double user, double sys);
+
+  /**
+   * @brief Compute the statistics of a set of timings
+   *
+   * @param samples The timings, at least one
+   */
+  static Summary summarize(const std::vector<double> &samples);
+
+  /**
+   * @brief Create a Table of the statistics of each time, ready to be
+   * displayed
+   */
+  Table table() const;
+
+  /**
+   * @brief Get the number of runs which are outliers for one of the times
+   */
+  size_t getOutliers() const;
+
+  /**
+   * @brief Write the timings and their statistics as JSON
+   *
+   * @param file The file to be written
+   */
+  void save(const std::filesystem::path &file) const;
+
+  /**
+   * @brief Read the timings written by save
+   *
+   * @param file The file to be read
+   */
+  static Benchmark load(const std::filesystem::path &file);
+
+  /**
+   * @brief Compare the mean times of two benchmarks with Welch's t-test
+   *
+   * @param baseline The reference benchmark
+   * @param candidate The benchmark compared to it
+   * @param p_value Filled with the two-sided p-value of each time
+   * @return The Table of the comparison, ready to be displayed
+   */
+  static Table compare(const Benchmark &baseline, const Benchmark &candidate,
+                       std::map<std::string, double> &p_value);
+
+  /**
+   * @brief Get the timings of one of the times ("wall", "user" or "sys")
+   */
+  const std::vector<double> &getSamples(const std::string &time) const;
+
+private:
+  std::string program_;
+
+  size_t warmup_;
+
+  // Time name -> timings of each run
+  std::map<std::string, std::vector<double>> samples_;
+};
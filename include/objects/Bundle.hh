@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <objects/Registry.hh>
+
+#define BUNDLE_EXT ".zcpkg"
+#define BUNDLE_MAGIC "ZCPKG\x00\x00\x01"
+#define BUNDLE_VERSION 1
+#define BUNDLE_MANIFEST "package.json"
+
+/**
+ * @brief Kinds of members, so that a subset of a bundle can be extracted
+ * without looking at the names
+ */
+enum MemberKind : uint32_t
+{
+  MEMBER_MANIFEST,
+  MEMBER_HEADER,
+  MEMBER_STATIC_LIB,
+  MEMBER_SHARED_LIB,
+  MEMBER_OTHER
+};
+
+/**
+ * @brief On-disk header of a bundle (little-endian)
+ */
+struct BundleHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t count;       // Number of members
+  uint64_t names_size;  // Size of the names table, after the entries
+  uint64_t data_offset; // Start of the compressed members
+};
+
+/**
+ * @brief On-disk table of contents entry of a member (little-endian)
+ */
+struct BundleEntry
+{
+  uint64_t offset; // Relative to data_offset
+  uint64_t compressed_size;
+  uint64_t size;
+  uint32_t name_offset; // In the names table
+  uint32_t name_size;
+  uint32_t mode;
+  uint32_t kind; // MemberKind
+  char hash[64]; // SHA-256 of the uncompressed content
+};
+
+/**
+ * @brief A single-file package: a table of contents followed by individually
+ * deflated members, so any member can be extracted without reading the
+ * others
+ *
+ * Members are sorted by path and carry no timestamp or owner, so packing the
+ * same package twice gives the same bytes
+ */
+class Bundle
+{
+public:
+  /**
+   * @brief Open a bundle, mapping it in memory
+   *
+   * @param path The path of the bundle
+   */
+  Bundle(const std::filesystem::path &path);
+  ~Bundle();
+
+  Bundle(const Bundle &) = delete;
+  Bundle &operator=(const Bundle &) = delete;
+
+  /**
+   * @brief Pack an installed package into a bundle, compressing its members
+   * in parallel
+   *
+   * @param package The package to be packed
+   * @param output The path of the bundle to be created
+   */
+  static void pack(const Package &package,
+                   const std::filesystem::path &output);
+
+  /**
+   * @brief Get the package stored in the bundle, whose binaries are relative
+   * to the ZC root directory
+   */
+  Package getPackage() const;
+
+  /**
+   * @brief Extract the members of the package into a staging directory laid
+   * out like the ZC root directory
+   *
+   * @param staging The staging directory
+   * @param static_libs Whether or not the static libraries are extracted
+   * @return The package, without the binaries which were skipped
+   */
+  Package extract(const std::filesystem::path &staging,
+                  bool static_libs) const;
+
+  /**
+   * @brief Install the package of the bundle in the registry
+   *
+   * @param static_libs Whether or not the static libraries are installed
+   * @return The name of the installed package
+   */
+  std::string install(bool static_libs) const;
+
+private:
+  /**
+   * @brief Decompress a member
+   *
+   * @param entry The entry of the member
+   * @param data Filled with the content of the member
+   * @return Whether or not the member is valid
+   */
+  bool read(const BundleEntry &entry, std::string &data) const;
+
+  std::string name(const BundleEntry &entry) const;
+
+  std::filesystem::path path_;
+
+  const unsigned char *map_ = nullptr;
+  size_t size_ = 0;
+
+  const BundleHeader *header_ = nullptr;
+  const BundleEntry *entries_ = nullptr;
+  const char *names_ = nullptr;
+};
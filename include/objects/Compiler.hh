@@ -0,0 +1,108 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
+namespace clang
+{
+class DiagnosticsEngine;
+class FileManager;
+namespace driver
+{
+class Compilation;
+class Driver;
+} // namespace driver
+} // namespace clang
+
+namespace llvm
+{
+class LLVMContext;
+class Module;
+} // namespace llvm
+
+/**
+ * @brief Clang driver running in the ZC process
+ *
+ * The compilation jobs of a command run through a CompilerInstance instead of
+ * a new clang process, and share the files already read by the previous ones.
+ * Intermediate objects stay in memory and are handed to the linker as memory
+ * files, so they never touch the disk. Other jobs (linker, external
+ * assembler) are still spawned.
+ */
+class Compiler
+{
+public:
+  /**
+   * @brief Get an instance
+   *
+   * @return A Compiler instance
+   */
+  static Compiler &getInstance();
+
+  ~Compiler();
+
+  Compiler(const Compiler &) = delete;
+  Compiler &operator=(const Compiler &) = delete;
+
+  /**
+   * @brief Run a clang command
+   *
+   * @param args The arguments of the command, starting with the compiler
+   * (e.g. clang++ selects the C++ driver)
+   * @return Whether or not the command succeeded
+   */
+  bool run(const std::vector<std::string> &args);
+
+  /**
+   * @brief Compile a source file to LLVM IR, optimized as the flags ask
+   *
+   * @param args The arguments of the command, starting with the compiler and
+   * holding a single source file
+   * @param context The context owning the module
+   * @param dependencies Filled with the source file and the headers it
+   * includes, except the system headers
+   * @return The module, nullptr if the compilation failed
+   */
+  std::unique_ptr<llvm::Module>
+  emitModule(const std::vector<std::string> &args, llvm::LLVMContext &context,
+             std::vector<std::string> &dependencies);
+
+  /**
+   * @brief Forget the files read by the previous compilations, when some of
+   * them may have changed since
+   */
+  void forgetFiles();
+
+private:
+  Compiler();
+
+  /**
+   * @brief Let the driver turn a clang command into jobs
+   *
+   * The compilation refers to the driver, which is replaced by the next call.
+   *
+   * @param args The arguments of the command, starting with the compiler
+   * @return The compilation, nullptr if the command is invalid
+   */
+  std::unique_ptr<clang::driver::Compilation>
+  buildCompilation(const std::vector<std::string> &args);
+
+  /**
+   * @brief Run a compilation job
+   *
+   * @param args The arguments of the job, starting with -cc1
+   * @param object Filled with the output instead of writing the output file,
+   * if not null
+   * @return Whether or not the job succeeded
+   */
+  bool compile(const std::vector<const char *> &args, std::string *object);
+
+  // Files read by the previous compilations
+  llvm::IntrusiveRefCntPtr<clang::FileManager> files_;
+
+  std::unique_ptr<clang::DiagnosticsEngine> diags_;
+  std::unique_ptr<clang::driver::Driver> driver_;
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <helpers.hh>
+
+#define DAEMON_SOCKET "daemon.sock"
+
+/**
+ * @brief Resident ZC process keeping the settings, the registry, the search
+ * index and the inclusions of the source files loaded, so that commands don't
+ * read them again
+ *
+ * Each command is run by a fork of the daemon, with the standard streams,
+ * working directory and environment of the client, so a command behaves
+ * exactly as if it was run in-process.
+ */
+class DaemonServer
+{
+public:
+  /**
+   * @brief Run a command with the given arguments, returning its exit code
+   */
+  using Handler = std::function<int(int argc, char *argv[])>;
+
+  /**
+   * @brief Create the socket of the daemon
+   *
+   * @param handler Runs the commands
+   */
+  DaemonServer(Handler handler);
+  ~DaemonServer();
+
+  DaemonServer(const DaemonServer &) = delete;
+  DaemonServer &operator=(const DaemonServer &) = delete;
+
+  /**
+   * @brief Move the daemon to a background process, detached from the
+   * terminal
+   *
+   * @return The process ID of the daemon in the calling process, 0 in the
+   * daemon
+   */
+  pid_t detach();
+
+  /**
+   * @brief Serve commands until the daemon is stopped
+   */
+  void serve();
+
+  /**
+   * @brief Send a command to the daemon if one is running
+   *
+   * The command runs in-process instead when no daemon is running, when
+   * ZC_NO_DAEMON is set, or when the daemon runs another build of zc.
+   *
+   * @param argc The number of arguments
+   * @param argv The arguments of the command
+   * @param exit_code Filled with the exit code of the command
+   * @return Whether or not the daemon ran the command
+   */
+  static bool forward(int argc, char *argv[], int &exit_code);
+
+  /**
+   * @brief Get the process ID of the running daemon
+   *
+   * @return The process ID, 0 if no daemon is running
+   */
+  static int32_t getPid();
+
+  /**
+   * @brief Stop the running daemon
+   *
+   * @return Whether or not a daemon was stopped
+   */
+  static bool stop();
+
+  static std::filesystem::path getSocketPath();
+
+private:
+  /**
+   * @brief Load every configuration file whose modification time changed
+   */
+  void refresh();
+
+  /**
+   * @brief A connection whose request didn't arrive entirely yet
+   */
+  struct Pending
+  {
+    std::string data_;
+    std::vector<int> fds_;
+    // The connection is closed if the request is still incomplete by then
+    std::chrono::steady_clock::time_point deadline_;
+  };
+
+  /**
+   * @brief Read what arrived of a request, and handle it once complete
+   *
+   * @param client The connection of the client
+   * @return false if the daemon was asked to stop
+   */
+  bool receive(int client);
+
+  /**
+   * @brief Close a connection whose request didn't arrive entirely
+   */
+  void drop(int client);
+
+  /**
+   * @brief Handle a request, forking a process to run commands
+   *
+   * @param client The connection of the client
+   * @param body The request, as JSON
+   * @param fds The file descriptors attached to the request
+   * @return false if the daemon was asked to stop
+   */
+  bool handle(int client, const std::string &body,
+              const std::vector<int> &fds);
+
+  /**
+   * @brief Run a request in the forked process (never returns)
+   */
+  [[noreturn]] void runChild(int client, const std::vector<std::string> &args,
+                             const std::string &cwd,
+                             const std::vector<std::string> &env,
+                             const std::vector<int> &fds);
+
+  /**
+   * @brief Reply to the clients whose command exited
+   */
+  void reap();
+
+  Handler handler_;
+  int server_ = -1;
+  int signals_ = -1;
+
+  // Identity of the zc binary, so clients of another build run in-process
+  std::string build_;
+
+  // Modification times of the loaded configuration files
+  std::map<std::string, int64_t> mtimes_;
+
+  // Running commands: process ID -> connection of the client
+  std::map<int, int> jobs_;
+
+  // Connections whose request is being received
+  std::map<int, Pending> pending_;
+};
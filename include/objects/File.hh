@@ -13,6 +13,7 @@ enum Language
 {
   C,
   CPP,
+  CPP_MODULE,
   H,
   HPP,
   PY,
@@ -22,6 +23,7 @@ enum Language
   OBJECT,
   INSTANCE,
   ASSEMBLER,
+  BUNDLE,
   MULTI_LANGUAGES,
   OTHER
 };
@@ -90,13 +92,44 @@ public:
 
   /**
    * @brief Parse the file and extract all declarations (works for C only)
+   *
+   * Besides the declarations themselves, the "symbols" entry holds the bare
+   * names of the functions and global variables with external linkage
    */
   std::unique_ptr<Declarations> parse() const;
 
   /**
-   * @brief Get inclusions from file and return associated compiling flags
+   * @brief Get the headers the file includes with angle brackets (system and
+   * registry headers) before anything else, in order
+   *
+   * Only blank lines and comments may come between them: the block ends on
+   * the first line of code or other directive, so it is empty when a macro is
+   * defined before the inclusions.
+   */
+  std::vector<std::string> getSystemIncludes() const;
+
+  /**
+   * @brief Read the C++20 module declaration and imports of the file
+   *
+   * Partitions are named after their module (e.g. "m:part"). Imported header
+   * units are left out.
+   *
+   * @param name Filled with the name of the module the file belongs to,
+   * empty if it isn't part of a module
+   * @param imports Filled with the names of the imported modules
+   */
+  void getModuleDeclarations(std::string &name,
+                             std::vector<std::string> &imports) const;
+
+  /**
+   * @brief Get inclusions from file and the flags of the associated packages
+   *
+   * @param reg The registry of the packages
+   * @param cflags Filled with the compiling flags
+   * @param ldflags Filled with the linking flags, in linking order
    */
-  std::vector<std::string> getInclusions(const Registry &reg) const;
+  void getInclusions(const Registry &reg, std::vector<std::string> &cflags,
+                     std::vector<std::string> &ldflags) const;
 
   /**
    * @brief Get file path
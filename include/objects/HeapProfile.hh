@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <zcio.hh>
+
+// Size classes: up to 16 bytes, then each power of two up to 1 MiB, then more
+#define HEAP_SIZE_CLASSES 18
+
+/**
+ * @brief The heap allocations of a program, as aggregated by the allocator
+ * hooks preloaded into it (libzcheap.so)
+ *
+ * The hooks match each allocation with its release by address, which gives
+ * its lifetime, and follow the live heap to find its peak. The allocations
+ * are attributed to their call site, the stack of the code which called the
+ * allocator.
+ */
+class HeapProfile
+{
+public:
+  /**
+   * @brief Load the profile written by the allocator hooks. The files the
+   * program mapped must still exist, to symbolize the call sites
+   *
+   * @param directory The directory the hooks wrote in
+   */
+  static HeapProfile load(const std::filesystem::path &directory);
+
+  /**
+   * @brief Create a Table of the totals: allocations, bytes, peak live heap,
+   * lifetimes, ready to be displayed
+   */
+  Table summary() const;
+
+  /**
+   * @brief Create a Table of the allocations by size class, ready to be
+   * displayed
+   */
+  Table histogram() const;
+
+  /**
+   * @brief Create a Table of the call sites allocating the most often, ready
+   * to be displayed
+   *
+   * @param n The number of call sites
+   */
+  Table sites(size_t n) const;
+
+  /**
+   * @brief Write the totals, the size classes and every call site as JSON
+   *
+   * @param file The file to be written
+   * @param program The name of the program
+   */
+  void save(const std::filesystem::path &file,
+            const std::string &program) const;
+
+  /**
+   * @brief Get the number of allocations
+   */
+  size_t getAllocations() const;
+
+private:
+  /**
+   * @brief The allocations made by a call stack
+   */
+  struct Site
+  {
+    // The functions, the call site first
+    std::vector<std::string> frames_;
+
+    size_t allocations_ = 0;
+    uint64_t bytes_ = 0;
+    size_t frees_ = 0;
+    uint64_t lifetimes_ = 0;
+
+    // Not released when the program exited
+    size_t live_ = 0;
+    uint64_t live_bytes_ = 0;
+  };
+
+  /**
+   * @brief Get the sites, the ones allocating the most often first
+   */
+  std::vector<const Site *> sortedSites() const;
+
+  // Stack identifier of the hooks -> site
+  std::map<uint32_t, Site> sites_;
+
+  size_t allocations_ = 0;
+  size_t frees_ = 0;
+  uint64_t bytes_ = 0;
+  uint64_t largest_ = 0;
+
+  uint64_t peak_ = 0;
+  uint64_t peak_time_ = 0;
+  uint64_t duration_ = 0;
+  size_t live_ = 0;
+  uint64_t live_bytes_ = 0;
+
+  // Allocations and bytes by size class
+  std::array<size_t, HEAP_SIZE_CLASSES> class_allocations_{};
+  std::array<uint64_t, HEAP_SIZE_CLASSES> class_bytes_{};
+
+  // Released allocations by power of two of their lifetime, in nanoseconds
+  std::array<size_t, 64> lifetimes_{};
+};
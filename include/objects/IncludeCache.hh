@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <helpers.hh>
+
+#define INCLUDE_CACHE "cache/includes.json"
+
+/**
+ * @brief Cache of the inclusions found in source files, so that a file is
+ * only parsed again when it or one of the files it includes changed
+ */
+class IncludeCache
+{
+public:
+  /**
+   * @brief Get an instance
+   *
+   * @return An IncludeCache instance
+   */
+  static IncludeCache &getInstance();
+
+  /**
+   * @brief Load the cache file, dropping it if it can't be read
+   */
+  void load();
+
+  /**
+   * @brief Get the inclusions of a file, if none of the files it was made of
+   * changed since they were stored
+   *
+   * @param file The source file
+   * @param includes Filled with the inclusions
+   * @return Whether or not the inclusions were found
+   */
+  bool lookup(const std::filesystem::path &file,
+              std::vector<std::string> &includes) const;
+
+  /**
+   * @brief Store the inclusions of a file and write the cache
+   *
+   * @param file The source file
+   * @param includes The inclusions found in the file
+   * @param files The files included by the file, directly or not
+   */
+  void store(const std::filesystem::path &file,
+             const std::vector<std::string> &includes,
+             const std::vector<std::filesystem::path> &files);
+
+private:
+  struct Entry
+  {
+    std::vector<std::string> includes_;
+
+    // Modification time of the file and of everything it includes
+    std::map<std::string, int64_t> mtimes_;
+  };
+
+  IncludeCache();
+
+  std::map<std::string, Entry> entries_;
+
+  std::filesystem::path cache_path_ = getZCRootDir() / INCLUDE_CACHE;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <helpers.hh>
+
+#define JIT_CACHE "cache/jit"
+
+namespace llvm
+{
+class Module;
+namespace orc
+{
+class LLJIT;
+class ThreadSafeContext;
+} // namespace orc
+} // namespace llvm
+
+/**
+ * @brief Runs programs through the LLVM ORC JIT, without writing an executable
+ *
+ * Source files are compiled to LLVM IR in-process. The IR of each file is
+ * cached, and only compiled again when the file, one of its headers or the
+ * flags changed.
+ */
+class Jit
+{
+public:
+  /**
+   * @brief Create an empty program
+   *
+   * @param compile_args The arguments compiling the sources, starting with the
+   * compiler and without the source files
+   */
+  Jit(const std::vector<std::string> &compile_args);
+  ~Jit();
+
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  /**
+   * @brief Add a file to the program
+   *
+   * @param file A C/C++ source file or an object file
+   */
+  void addFile(const std::filesystem::path &file);
+
+  /**
+   * @brief Load the shared libraries the program is linked against
+   *
+   * @param ldflags The linking flags, only -L and -l flags are used
+   * @param lib_dirs The directories searched before the ones of the flags
+   */
+  void loadLibraries(const std::vector<std::string> &ldflags,
+                     const std::vector<std::filesystem::path> &lib_dirs);
+
+  /**
+   * @brief Run the main function of the program
+   *
+   * @param name The name of the program (argv[0])
+   * @param args The arguments given to the program
+   * @return The exit code of the program
+   */
+  int run(const std::string &name, const std::vector<std::string> &args);
+
+private:
+  /**
+   * @brief Compile a source file to LLVM IR, or load it from the cache
+   *
+   * @param file The source file
+   * @return The module of the file
+   */
+  std::unique_ptr<llvm::Module> getModule(const std::filesystem::path &file);
+
+  std::vector<std::string> compile_args_;
+
+  std::unique_ptr<llvm::orc::ThreadSafeContext> context_;
+
+  std::unique_ptr<llvm::orc::LLJIT> jit_;
+
+  std::filesystem::path cache_dir_ = getZCRootDir() / JIT_CACHE;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <helpers.hh>
+
+#define BMI_CACHE "cache/bmi"
+
+/**
+ * @brief Builds the C++20 module interface units of a program into BMIs
+ * (binary module interfaces) and objects, before the units importing them
+ *
+ * The units are scanned for the module they provide and the modules they
+ * import, then built in dependency order, the units which don't depend on
+ * each other in parallel. BMIs are cached, and only built again when their
+ * unit, one of its headers or one of the modules it imports changed. Only
+ * clang is supported.
+ */
+class ModuleBuilder
+{
+public:
+  /**
+   * @brief Create a builder
+   *
+   * @param compile_args The arguments compiling the program, starting with the
+   * compiler and without the source files
+   * @param in_process Whether the program is compiled in-process
+   */
+  ModuleBuilder(const std::vector<std::string> &compile_args, bool in_process);
+
+  /**
+   * @brief Build the BMI and the object of each module interface unit
+   *
+   * @param units The module interface units
+   * @param objects Filled with the objects of the units, in the same order,
+   * to be linked with the program
+   * @return The flags making the other units find the modules
+   */
+  std::vector<std::string>
+  build(const std::vector<std::filesystem::path> &units,
+        std::vector<std::filesystem::path> &objects) const;
+
+private:
+  struct Unit
+  {
+    std::filesystem::path source_;
+    std::string name_;
+    std::vector<std::string> imports_;
+
+    std::filesystem::path bmi_;
+    std::filesystem::path object_;
+    std::filesystem::path deps_;
+  };
+
+  /**
+   * @brief Find the module a unit provides and the modules it imports, with
+   * clang-scan-deps, or by reading the unit if it isn't installed
+   */
+  void scan(Unit &unit) const;
+
+  /**
+   * @brief Build the BMI and the object of a unit, unless they are fresh
+   *
+   * @param unit The unit
+   * @param flags The flags finding the modules already built
+   * @param imported The BMIs of the modules the unit imports
+   * @return Whether or not the unit could be built
+   */
+  bool buildUnit(const Unit &unit, const std::vector<std::string> &flags,
+                 const std::vector<std::filesystem::path> &imported) const;
+
+  /**
+   * @brief Check that the BMI of a unit is newer than all the files and
+   * modules it was built from
+   */
+  bool isFresh(const Unit &unit,
+               const std::vector<std::filesystem::path> &imported) const;
+
+  /**
+   * @brief Run a clang command, spawned or in-process
+   */
+  bool runCompiler(const std::vector<std::string> &args) const;
+
+  std::vector<std::string> compile_args_;
+
+  bool in_process_;
+
+  std::filesystem::path cache_dir_ = getZCRootDir() / BMI_CACHE;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <sched.h>
+
+/**
+ * @brief Settings of the processes measured by ZC which reduce the noise of
+ * their timings: CPU pinning, no address space randomization, a normalized
+ * environment and a raised scheduling priority
+ *
+ * The settings are applied in the child process between fork and exec, so
+ * that ZC itself keeps running normally.
+ */
+class NoiseControl
+{
+public:
+  /**
+   * @brief Create the settings of the measured processes
+   *
+   * @param cpus The CPUs the processes are pinned to, empty not to pin them
+   * @param normalize Whether to disable ASLR and normalize the environment
+   * @param priority Whether to raise the scheduling priority
+   */
+  NoiseControl(const std::vector<unsigned> &cpus, bool normalize,
+               bool priority);
+
+  /**
+   * @brief Check whether any setting is enabled
+   */
+  bool enabled() const;
+
+  /**
+   * @brief Warn about the settings which can't be applied and about the
+   * system settings adding noise (CPU governor and turbo)
+   */
+  void check() const;
+
+  /**
+   * @brief Build the environment of a process
+   *
+   * When normalizing, the variables are sorted and a padding variable makes
+   * the size of the arguments and environment a multiple of a page. With
+   * ASLR disabled, the stack of the process then starts at the same
+   * alignment whatever the shell, directory or user.
+   *
+   * @param argv The arguments of the process
+   * @return The variables, as NAME=value
+   */
+  std::vector<std::string> environment(const std::vector<std::string> &argv)
+      const;
+
+  /**
+   * @brief Apply the settings to the calling process, in the child before
+   * exec. Only makes system calls
+   */
+  void apply() const;
+
+private:
+  std::vector<unsigned> cpus_;
+
+  cpu_set_t cpu_set_;
+
+  bool normalize_;
+
+  bool priority_;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <helpers.hh>
+
+#define PCH_CACHE "cache/pch"
+
+/**
+ * @brief Precompiled headers of the system and registry headers included by
+ * programs, built once per set of headers, compiler and compiling arguments
+ */
+class PchCache
+{
+public:
+  /**
+   * @brief Get a precompiled header holding the given headers, building it if
+   * it doesn't exist or one of its headers changed
+   *
+   * @param compile_args The arguments compiling the program, starting with the
+   * compiler
+   * @param headers The headers, as spelled between the angle brackets
+   * @param is_cpp Whether or not the headers are C++
+   * @param in_process Whether the program is compiled in-process
+   * @return The precompiled header, empty if it couldn't be built
+   */
+  std::filesystem::path get(const std::vector<std::string> &compile_args,
+                            const std::vector<std::string> &headers,
+                            bool is_cpp, bool in_process) const;
+
+private:
+  /**
+   * @brief Check that a precompiled header is newer than all the files it
+   * was built from
+   *
+   * @param pch The precompiled header
+   * @param deps The dependency file written when it was built
+   */
+  bool isFresh(const std::filesystem::path &pch,
+               const std::filesystem::path &deps) const;
+
+  std::filesystem::path cache_dir_ = getZCRootDir() / PCH_CACHE;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <zcio.hh>
+
+/**
+ * @brief Hardware and software performance counters of a process, read with
+ * perf_event_open
+ *
+ * The counters are opened in groups, whose events are always counted
+ * together. When there are more groups than the CPU has counters, the kernel
+ * multiplexes them and the counts are scaled by the share of time each group
+ * was counted.
+ */
+class PerfCounters
+{
+public:
+  PerfCounters() = default;
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  /**
+   * @brief Open the counters of a process which hasn't executed its program
+   * yet. They start counting when it does, including its threads and
+   * children
+   *
+   * Hardware events which aren't available (e.g. in a container or a VM) are
+   * left out, the software events being counted anyway.
+   *
+   * @param pid The process
+   */
+  void attach(pid_t pid);
+
+  /**
+   * @brief Read the counts, once the process exited
+   */
+  void read();
+
+  /**
+   * @brief Create a Table of the counts, ready to be displayed
+   */
+  Table table() const;
+
+  /**
+   * @brief Create a Table of the metrics derived from the counts (IPC, miss
+   * rates...), ready to be displayed
+   */
+  Table metrics() const;
+
+  /**
+   * @brief Check whether the hardware events could be counted
+   */
+  bool hasHardware() const;
+
+private:
+  struct Counter
+  {
+    std::string name_;
+    uint32_t type_;
+    uint64_t config_;
+    int fd_ = -1;
+
+    // Count scaled to the whole run, and share of the run it was counted
+    double value_ = 0;
+    double measured_ = 0;
+  };
+
+  /**
+   * @brief Open the counters of a group, the first one leading it. The
+   * counters which can't be opened are removed
+   *
+   * @return Whether the leader could be opened
+   */
+  bool openGroup(std::vector<Counter> &group, pid_t pid);
+
+  /**
+   * @brief Get the scaled count of an event, -1 if it wasn't counted
+   */
+  double get(const std::string &name) const;
+
+  std::vector<std::vector<Counter>> groups_;
+
+  bool hardware_ = false;
+};
@@ -1,21 +1,81 @@
 #pragma once
 
+#include <filesystem>
 #include <string>
 #include <vector>
 
+#include <helpers.hh>
 #include <objects/File.hh>
 #include <objects/Registry.hh>
+#include <objects/Transport.hh>
 
+#define CHUNKS_CACHE "cache/chunks"
+
+/**
+ * @brief Moves packages between the registry and a package store
+ *
+ * Files are split into content-defined chunks addressed by their SHA-256, so
+ * headers and objects shared by several packages are stored and downloaded
+ * only once
+ */
 class Postman
 {
 public:
   static Postman &getInstance();
 
+  /**
+   * @brief Set the store to use: a directory or "unix:<socket path>"
+   * (the package_server setting by default)
+   */
+  void setServer(const std::string &server);
+
+  /**
+   * @brief Upload a package: its missing chunks and its manifest
+   *
+   * @param package The package to be uploaded
+   * @param headers The installed headers of the package
+   * @param binaries The installed binaries of the package
+   * @return Whether or not the upload was successful
+   */
   bool uploadPackage(const Package &package, const std::vector<File> &headers,
                      const std::vector<File> &binaries);
 
+  /**
+   * @brief Download a package and install it in the registry
+   *
+   * @param target The name of the package
+   * @return Whether or not the package was installed
+   */
   bool downloadPackage(const std::string &target);
 
+  /**
+   * @brief Download packages in parallel and install them in the registry
+   *
+   * Chunks already in the local cache are not downloaded again and partial
+   * chunks are resumed. Every chunk and file is verified against its hash.
+   *
+   * @param targets The names of the packages
+   * @return The packages which couldn't be installed
+   */
+  std::vector<std::string>
+  downloadPackages(const std::vector<std::string> &targets);
+
 private:
-  Postman() = default;
+  Postman();
+
+  /**
+   * @brief Fetch a chunk into the local cache (no-op if already cached)
+   *
+   * @param hash The SHA-256 of the chunk
+   * @param transport The store to fetch from
+   * @return Whether or not the chunk is in the cache and valid
+   */
+  bool fetchChunk(const std::string &hash, Transport &transport) const;
+
+  std::filesystem::path chunkPath(const std::string &hash) const;
+
+  std::string server_;
+
+  std::filesystem::path chunks_path_ = getZCRootDir() / CHUNKS_CACHE;
+  std::filesystem::path staging_path_ = getZCRootDir() / STAGING;
 };
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+
+#include <zcio.hh>
+
+/**
+ * @brief The stacks sampled while a program ran, as folded stacks: each
+ * stack, from the root to the leaf, with the number of samples it got
+ */
+class Profile
+{
+public:
+  /**
+   * @brief Symbolize the samples written by the sampler preloaded into a
+   * program (libzcprof.so). The files the program mapped must still exist
+   *
+   * @param samples The file written by the sampler
+   */
+  static Profile fromSamples(const std::filesystem::path &samples);
+
+  /**
+   * @brief Read folded stacks, one "frame;frame;... count" per line
+   *
+   * @param file The file to be read
+   */
+  static Profile load(const std::filesystem::path &file);
+
+  /**
+   * @brief Write the folded stacks, which other flame graph tools read too
+   *
+   * @param file The file to be written
+   */
+  void save(const std::filesystem::path &file) const;
+
+  /**
+   * @brief Write an SVG flame graph of the stacks: each function is a box as
+   * wide as its share of the samples, above its caller
+   *
+   * @param file The file to be written
+   * @param title The title of the graph
+   */
+  void saveFlameGraph(const std::filesystem::path &file,
+                      const std::string &title) const;
+
+  /**
+   * @brief Create a Table of the functions taking the most samples, by their
+   * own code (self) and with the functions they call (inclusive)
+   *
+   * @param n The number of functions
+   */
+  Table table(size_t n) const;
+
+  /**
+   * @brief Create a Table of the functions whose share of the samples changed
+   * the most between two profiles
+   *
+   * @param baseline The reference profile
+   * @param candidate The profile compared to it
+   * @param n The number of functions
+   */
+  static Table diff(const Profile &baseline, const Profile &candidate,
+                    size_t n);
+
+  /**
+   * @brief Get the number of samples
+   */
+  size_t getSamples() const;
+
+private:
+  /**
+   * @brief Add samples of a stack
+   */
+  void add(const std::string &stack, size_t count);
+
+  /**
+   * @brief Count the samples of each function, in its own code and in total
+   */
+  void getFunctions(std::map<std::string, size_t> &self,
+                    std::map<std::string, size_t> &inclusive) const;
+
+  // Frames from the root, separated by ';' -> samples
+  std::map<std::string, size_t> stacks_;
+
+  size_t total_ = 0;
+};
@@ -1,16 +1,24 @@
 #pragma once
 
+#include <cstdint>
+#include <array>
 #include <filesystem>
+#include <map>
 #include <string>
 #include <vector>
 
 #include <helpers.hh>
+#include <nlohmann/json.hpp>
 #include <objects/File.hh>
 #include <zcio.hh>
 
 #define REGISTRY "registry.json"
-#define N_ATTR_PACKAGE 6
-#define N_ATTR_STD_PACKAGE 4
+#define N_ATTR_PACKAGE 11
+#define N_ATTR_STD_PACKAGE 5
+#define STAGING "staging"
+#define BLOBS "blobs"
+#define MODULES "cache/modules"
+#define RESOLVED "cache/resolved.json"
 
 struct Package
 {
@@ -21,15 +29,35 @@ struct Package
   std::vector<std::string> headers_;
   std::vector<std::string> binaries_;
 
+  // Linking flags (e.g. -lm)
   std::string flags_;
+
+  // Compiling flags (e.g. -fopenmp)
+  std::string cflags_;
+
+  // Symbols exported by the shared library (empty if everything is exported)
+  std::vector<std::string> symbols_;
+
+  // Optimization variants installed under lib/<variant>/
+  std::vector<std::string> variants_;
+
+  // ISA levels dispatched at load time (e.g. x86-64-v3), empty if none
+  std::vector<std::string> isa_;
+
+  // Packages (or standard packages) this package links against
+  std::vector<std::string> dependencies_;
 };
 
+void to_json(nlohmann::json &j, const Package &p);
+void from_json(const nlohmann::json &j, Package &p);
+
 struct StdPackage
 {
   std::string name_;
   std::vector<std::string> headers_;
   std::vector<std::string> binaries_;
   std::string flags_;
+  std::string cflags_;
 };
 
 class Registry
@@ -53,9 +81,13 @@ public:
    * @brief Save a library based on its configuration and its files (headers /
    * object files)
    * 1. Create a subdirectory in the ZC include dir
-   * 2. Copy the header files into this directory
-   * 3. Compile the object files into a static and dynamic library
-   * 4. Put the binaries into the lib directory
+   * 2. Store the header files in the blob store and link them into this
+   * directory
+   * 3. Collect the symbols declared in the headers to build the export list
+   * 4. Compile the object files into a static and dynamic library for each
+   * optimization variant, hiding every symbol that is not part of the export
+   * list
+   * 5. Put the binaries into the lib/<variant> directories
    *
    * @param package The package configuration
    * @param force Force installation even if the library already exists
@@ -69,6 +101,33 @@ public:
                    std::vector<std::filesystem::path> &objects,
                    std::vector<std::filesystem::path> &sources, bool is_cpp);
 
+  /**
+   * @brief Install a package whose files were prepared in a staging
+   * directory, and index it (replacing any package with the same name)
+   *
+   * Files are moved into place with renames, so a package is never seen half
+   * installed
+   *
+   * @param package The package, whose binaries are relative to the ZC root
+   * directory (they are made absolute)
+   * @param staging The staging directory, laid out like the ZC root directory
+   */
+  void installPackage(Package &package, const std::filesystem::path &staging);
+
+  /**
+   * @brief Check that a binary of a downloaded or bundled package stays in
+   * the lib directory: relative, normalized and under lib/
+   */
+  static bool isValidBinary(const std::string &binary);
+
+  /**
+   * @brief Delete the header blobs which are not linked by any package anymore
+   *
+   * @param freed Filled with the number of bytes reclaimed
+   * @return The number of deleted blobs
+   */
+  size_t collectGarbage(std::uintmax_t &freed) const;
+
   /**
    * @brief Uninstall package and remove it from index
    *
@@ -79,11 +138,55 @@ public:
 
   bool pkgExists(const std::string &pkg_name) const;
 
+  /**
+   * @brief Get an installed package
+   *
+   * @param pkg_name The name of the package
+   * @return The package (throws if it is not installed)
+   */
+  const Package &getPackage(const std::string &pkg_name) const;
+
   /**
    * @brief Get all the packages of the registry
    */
   std::vector<Package> getPackages() const;
 
+  /**
+   * @brief Get packages and all their transitive dependencies, each package
+   * coming before the packages it depends on
+   *
+   * @param names The names of the packages or standard packages
+   * @return The names of the packages in linking order
+   */
+  std::vector<std::string>
+  getDependencies(const std::vector<std::string> &names) const;
+
+  /**
+   * @brief Get the compiling and linking flags of packages and of all their
+   * transitive dependencies
+   *
+   * Linking flags keep the order of getDependencies (the order static
+   * linking needs) and each flag is kept once, with its operand. Resolutions
+   * are memoized in a cache file, dropped whenever the registry is written.
+   *
+   * @param names The names of the packages or standard packages
+   * @param cflags Filled with the compiling flags
+   * @param ldflags Filled with the linking flags, in linking order
+   */
+  void getFlags(const std::vector<std::string> &names,
+                std::vector<std::string> &cflags,
+                std::vector<std::string> &ldflags) const;
+
+  /**
+   * @brief Import system libraries described by pkg-config as standard
+   * packages (replacing the ones with the same name)
+   *
+   * @param modules The pkg-config modules (e.g. openblas)
+   * @return The modules which couldn't be imported
+   */
+  std::vector<std::string>
+  importPkgConfig(const std::vector<std::string> &modules);
+
   /**
    * @brief Get all the packages of the registry
    */
@@ -99,6 +202,31 @@ public:
    */
   std::filesystem::path getLibDir() const;
 
+  /**
+   * @brief Get the binaries path of an optimization variant
+   *
+   * @param variant The name of the variant (the root binaries path if empty)
+   */
+  std::filesystem::path getLibDir(const std::string &variant) const;
+
+  /**
+   * @brief Find the library variant matching the optimization level of the
+   * given compiling flags
+   *
+   * @param flags The compiling flags of the program being built
+   * @return The name of the variant, empty if no variant is configured
+   */
+  std::string getVariant(const std::vector<std::string> &flags) const;
+
+  /**
+   * @brief Get the flags making clang import the precompiled modules of the
+   * packages instead of parsing their headers
+   *
+   * @return The flags, empty if no package was precompiled or if the
+   * precompile_libs setting is off
+   */
+  std::vector<std::string> getModuleFlags() const;
+
   /**
    * @brief Create a Table containing all the packages, ready to be displayed
    *
@@ -132,15 +260,157 @@ private:
    */
   std::vector<std::string> unindexPackage(const std::string &pkg_name);
 
+  /**
+   * @brief Install a header: store its content once in the blob store
+   * (addressed by its SHA-256) and link it to its destination
+   *
+   * The destination is a hardlink to the blob, so the link count of a blob
+   * counts its users. Where hardlinks aren't supported, it is a reflink or a
+   * copy of the blob.
+   *
+   * @param source The header to be installed
+   * @param dest The path of the installed header
+   * @param move Whether the source can be moved into the blob store instead
+   * of being copied
+   */
+  void storeHeader(const std::filesystem::path &source,
+                   const std::filesystem::path &dest, bool move) const;
+
+  /**
+   * @brief Remove an include directory and delete the blobs which were only
+   * used by its headers
+   *
+   * @param dir The include directory
+   */
+  void releaseHeaders(const std::filesystem::path &dir) const;
+
+  /**
+   * @brief Precompile the headers of a package into a Clang module, for the
+   * configured compiler, standard and flags
+   *
+   * A module map listing the headers is written, and a file including all of
+   * them is compiled to fill the module cache. The map is only kept if the
+   * module could be built, so that a package whose headers aren't modular
+   * keeps being included textually.
+   *
+   * @param package The package, its headers being installed
+   * @param is_cpp Whether or not the headers are C++
+   */
+  void precompilePackage(const Package &package, bool is_cpp) const;
+
+  /**
+   * @brief Get the module map of a package
+   */
+  std::filesystem::path getModuleMap(const std::string &pkg_name) const;
+
+  /**
+   * @brief Visit a package and its dependencies depth first, appending each
+   * package after all the packages depending on it were visited
+   *
+   * @param name The package to visit
+   * @param state 1 while the package is being visited, 2 once it is done
+   * @param order The packages in reverse linking order
+   */
+  void visitDependencies(const std::string &name,
+                         std::map<std::string, int> &state,
+                         std::vector<std::string> &order) const;
+
+  /**
+   * @brief Write the packages and the standard packages into the registry
+   * file
+   */
+  void write() const;
+
+  /**
+   * @brief Load the flags resolved by previous runs, unless the registry file
+   * was written since
+   */
+  void readResolved() const;
+
+  /**
+   * @brief Save the resolved flags, for the registry file as it was loaded
+   */
+  void writeResolved() const;
+
+  /**
+   * @brief Collect the functions and global variables declared in the given
+   * headers, which make up the public interface of a library
+   *
+   * @param headers The library's header files
+   * @return The sorted names of the declared symbols
+   */
+  std::vector<std::string>
+  collectExports(const std::vector<std::filesystem::path> &headers) const;
+
+  /**
+   * @brief Write a linker export list (a version script on ELF platforms)
+   * that only keeps the given symbols global
+   *
+   * @param path The path of the export list
+   * @param symbols The symbols to be exported
+   * @return Whether or not the file was written
+   */
+  bool writeExportMap(const std::filesystem::path &path,
+                      const std::vector<std::string> &symbols) const;
+
+  /**
+   * @brief Write a header that includes the public headers with default
+   * visibility, so that their declarations stay visible when the sources are
+   * compiled with -fvisibility=hidden
+   *
+   * @param path The path of the generated header
+   * @param headers The library's header files
+   * @return Whether or not the file was written
+   */
+  bool writeVisibilityHeader(
+      const std::filesystem::path &path,
+      const std::vector<std::filesystem::path> &headers) const;
+
   /**
    * @brief Compile source files to object files
    *
+   * When ISA levels are given, each source is compiled once per level and
+   * the functions are dispatched at load time to the best implementation for
+   * the running CPU
+   *
    * @param sources The source files to be compiled (.c, .i, .s)
    * @param objects The vector that is going to contain the compiled objects
+   * @param is_cpp Whether or not the code is C++
+   * @param flags Additional compiling flags
+   * @param isa_levels The ISA levels to compile for (e.g. x86-64-v3)
    */
   void compileObjects(const std::vector<std::filesystem::path> &sources,
-                      std::vector<std::filesystem::path> &objects,
-                      bool is_cpp) const;
+                      std::vector<std::filesystem::path> &objects, bool is_cpp,
+                      const std::vector<std::string> &flags,
+                      const std::vector<std::string> &isa_levels) const;
+
+  /**
+   * @brief Compile a single source file to an object file
+   *
+   * @param source The source file
+   * @param object The object file to be created
+   * @param is_cpp Whether or not the code is C++
+   * @param flags Additional compiling flags
+   */
+  void compileObject(const std::filesystem::path &source,
+                     const std::filesystem::path &object, bool is_cpp,
+                     const std::vector<std::string> &flags) const;
+
+  /**
+   * @brief Compile the sources once per ISA level, suffix the global symbols
+   * of each copy with its level and create the object holding the ifunc
+   * resolvers
+   *
+   * @param sources The source files to be compiled
+   * @param objects The vector that is going to contain the compiled objects
+   * @param is_cpp Whether or not the code is C++
+   * @param flags Additional compiling flags
+   * @param isa_levels The ISA levels to compile for
+   */
+  void compileIsaObjects(const std::vector<std::filesystem::path> &sources,
+                         std::vector<std::filesystem::path> &objects,
+                         bool is_cpp, const std::vector<std::string> &flags,
+                         const std::vector<std::string> &isa_levels) const;
 
   /**
    * @brief Create a static library
@@ -158,17 +428,30 @@ private:
    * @param libPath The path of the future library
    * @param objects The objects to be compiled
    * @param is_cpp Whether or not the code is C++
+   * @param export_map The export list restricting the exported symbols (none
+   * if empty)
    * @return whether it worked or not
    */
   bool createSharedLib(const std::string &libPath,
                        const std::vector<std::filesystem::path> &objects,
-                       bool is_cpp) const;
+                       bool is_cpp,
+                       const std::filesystem::path &export_map) const;
 
   std::vector<Package> packages_;
   std::vector<StdPackage> std_packages_;
 
+  // Compiling and linking flags already resolved, by sorted list of
+  // requested packages
+  mutable std::map<std::string, std::array<std::vector<std::string>, 2>>
+      resolved_;
+  // Modification time and size of the registry file the packages come from
+  mutable std::string registry_stamp_;
+
   std::filesystem::path registry_path_ = getZCRootDir() / REGISTRY;
+  std::filesystem::path resolved_path_ = getZCRootDir() / RESOLVED;
 
   std::filesystem::path include_path_ = getZCRootDir() / "include";
   std::filesystem::path lib_path_ = getZCRootDir() / "lib";
+  std::filesystem::path blobs_path_ = getZCRootDir() / BLOBS;
+  std::filesystem::path modules_path_ = getZCRootDir() / MODULES;
 };
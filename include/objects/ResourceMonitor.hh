@@ -0,0 +1,61 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <zcio.hh>
+
+/**
+ * @brief Measures what a process costs: its resource usage once it exits,
+ * and its resident memory over time while it runs
+ */
+class ResourceMonitor
+{
+public:
+  /**
+   * @brief Create a monitor
+   *
+   * @param interval_ms The first delay between two samples of the memory,
+   * doubled whenever too many samples were taken
+   */
+  ResourceMonitor(int interval_ms);
+
+  /**
+   * @brief Wait for a child process to exit, sampling its memory meanwhile
+   *
+   * @param pid The child process
+   * @return The wait status of the process
+   */
+  int wait(pid_t pid);
+
+  /**
+   * @brief Create a Table of the resource usage, ready to be displayed
+   */
+  Table table() const;
+
+  /**
+   * @brief Print a chart of the resident memory over time
+   */
+  void drawTimeline() const;
+
+private:
+  /**
+   * @brief Add a sample of the resident memory of a process
+   *
+   * @param pid The process
+   * @param time The time since the process started, in seconds
+   */
+  void sample(pid_t pid, double time);
+
+  int interval_ms_;
+
+  double wall_ = 0;
+
+  struct rusage usage_{};
+
+  // Time in seconds -> resident memory in KiB
+  std::vector<std::pair<double, long>> samples_;
+};
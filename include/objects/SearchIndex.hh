@@ -0,0 +1,117 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <helpers.hh>
+#include <objects/Registry.hh>
+
+#define SEARCH_INDEX "search.json"
+
+struct SearchResult
+{
+  std::string package_;
+  double score_ = 0;
+
+  // What matched the query (e.g. "function mylib_init")
+  std::vector<std::string> matches_;
+};
+
+/**
+ * @brief Inverted index of the installed packages: their names, authors,
+ * headers and the functions declared in the headers
+ *
+ * The registry updates it whenever a package is indexed or removed
+ */
+class SearchIndex
+{
+public:
+  /**
+   * @brief Get an instance
+   *
+   * @return A SearchIndex instance
+   */
+  static SearchIndex &getInstance();
+
+  /**
+   * @brief Load the index, building it from the registry if there is none
+   */
+  void load();
+
+  /**
+   * @brief Index a package, replacing its previous entries
+   *
+   * @param package The installed package
+   */
+  void addPackage(const Package &package);
+
+  /**
+   * @brief Remove the entries of a package
+   *
+   * @param pkg_name The name of the package
+   */
+  void removePackage(const std::string &pkg_name);
+
+  /**
+   * @brief Index all the packages from scratch
+   *
+   * @param packages The installed packages
+   */
+  void rebuild(const std::vector<Package> &packages);
+
+  /**
+   * @brief Find the packages matching every word of a query, exactly, by
+   * prefix or with a typo
+   *
+   * @param query The words to look for
+   * @param limit The maximum number of results (0 for all of them)
+   * @return The results, best first
+   */
+  std::vector<SearchResult> search(const std::string &query,
+                                   size_t limit) const;
+
+private:
+  /**
+   * @brief A package a term was found in
+   */
+  struct Posting
+  {
+    double weight_;
+    std::string text_; // The indexed text (e.g. "header mylib/m.h")
+  };
+
+  SearchIndex();
+
+  /**
+   * @brief Write the index into its file
+   */
+  void write() const;
+
+  /**
+   * @brief Index a text and the words it is made of
+   *
+   * @param text The text to be indexed
+   * @param pkg_name The package it belongs to
+   * @param label What is shown when the text matches (e.g. "header m/m.h")
+   * @param weight The importance of the field
+   */
+  void indexText(const std::string &text, const std::string &pkg_name,
+                 const std::string &label, double weight);
+
+  /**
+   * @brief Index a package without writing the index
+   */
+  void indexPackage(const Package &package);
+
+  /**
+   * @brief Remove the entries of a package without writing the index
+   */
+  void unindexPackage(const std::string &pkg_name);
+
+  // term -> package -> best posting
+  std::map<std::string, std::map<std::string, Posting>> terms_;
+
+  std::filesystem::path index_path_ = getZCRootDir() / SEARCH_INDEX;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filesystem>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -40,6 +41,11 @@ public:
   bool getClearBeforeRun() const;
   bool getAutoKeep() const;
   bool getEditOnInit() const;
+  const std::map<std::string, std::vector<std::string>> &
+  getLibVariants() const;
+  const std::string &getPackageServer() const;
+  bool getInProcessCompile() const;
+  bool getPrecompileLibs() const;
 
 private:
   /**
@@ -56,6 +62,21 @@ private:
   std::string cpp_std_ = "c++20";
   std::vector<std::string> flags_ = {"-Wall", "-Wextra"};
 
+  /* Compile with the Clang driver linked into ZC instead of spawning it */
+  bool in_process_compile_ = false;
+
+  /* Precompile the headers of the libraries into Clang modules */
+  bool precompile_libs_ = false;
+
+  /* Optimization variants built for each library (name -> flags) */
+  std::map<std::string, std::vector<std::string>> lib_variants_ = {
+      {"debug", {"-O0", "-g"}},
+      {"release", {"-O2"}},
+      {"native", {"-O3", "-march=native"}}};
+
+  /* Package store: a directory or "unix:<socket path>" */
+  std::string package_server_ = (getZCRootDir() / "store").string();
+
   /* User settings */
   std::string editor_ = "nvim";
   bool clear_before_run_ = false;
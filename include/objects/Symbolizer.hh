@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace llvm
+{
+namespace symbolize
+{
+class LLVMSymbolizer;
+} // namespace symbolize
+} // namespace llvm
+
+/**
+ * @brief Finds the functions of the code addresses of a process which
+ * exited, from its memory mappings and the debug information of the files it
+ * mapped
+ *
+ * The preloaded profilers write the mappings (/proc/self/maps) with the
+ * addresses they recorded. The files must still exist.
+ */
+class Symbolizer
+{
+public:
+  Symbolizer();
+  ~Symbolizer();
+
+  Symbolizer(const Symbolizer &) = delete;
+  Symbolizer &operator=(const Symbolizer &) = delete;
+
+  /**
+   * @brief Add a line of /proc/<pid>/maps. Only executable mappings are kept
+   *
+   * @param line The line
+   */
+  void addMapping(const std::string &line);
+
+  /**
+   * @brief Get the functions of a code address, the inlined ones first. When
+   * there is no debug information, the name is "file+0xoffset"
+   *
+   * @param address The address, of the call itself for return addresses
+   */
+  const std::vector<std::string> &symbolize(uintptr_t address);
+
+private:
+  /**
+   * @brief A file mapped by the process
+   */
+  struct Mapping
+  {
+    uintptr_t start_;
+    uintptr_t end_;
+    uintptr_t offset_;
+    std::string path_;
+
+    // Executables which aren't position independent are symbolized by address
+    bool absolute_ = false;
+    // Virtual address minus file offset of the mapped segment
+    intptr_t bias_ = 0;
+  };
+
+  std::vector<Mapping> maps_;
+  bool sorted_ = true;
+
+  std::unique_ptr<llvm::symbolize::LLVMSymbolizer> symbolizer_;
+  std::unordered_map<uintptr_t, std::vector<std::string>> names_;
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#define SOCKET_PREFIX "unix:"
+
+// Largest chunk a package file is cut into, and manifest a store accepts
+#define MAX_CHUNK (128 * 1024)
+#define MAX_MANIFEST (16 * 1024 * 1024)
+
+/**
+ * @brief Access to a package store, which holds content-addressed chunks and
+ * package manifests
+ */
+class Transport
+{
+public:
+  virtual ~Transport() = default;
+
+  /**
+   * @brief Open a transport to a store
+   *
+   * @param server A store directory, or "unix:<path>" for a store served over
+   * a Unix socket
+   * @return The transport
+   */
+  static std::unique_ptr<Transport> open(const std::string &server);
+
+  /**
+   * @brief Check that a package name can be used in a path: package names
+   * end up in paths, so they can't contain separators
+   *
+   * @param name The name of the package
+   */
+  static bool isValidName(const std::string &name);
+
+  /**
+   * @brief Check if the store holds a chunk
+   *
+   * @param hash The SHA-256 of the chunk
+   */
+  virtual bool hasChunk(const std::string &hash) = 0;
+
+  /**
+   * @brief Read a chunk from the store
+   *
+   * @param hash The SHA-256 of the chunk
+   * @param offset The offset to start reading from (to resume a transfer)
+   * @param data Filled with the chunk's content from offset
+   * @return Whether or not the chunk was found
+   */
+  virtual bool getChunk(const std::string &hash, size_t offset,
+                        std::string &data) = 0;
+
+  /**
+   * @brief Store a chunk
+   *
+   * @param hash The SHA-256 of the chunk
+   * @param data The chunk's content
+   * @return Whether or not the chunk was stored
+   */
+  virtual bool putChunk(const std::string &hash, const std::string &data) = 0;
+
+  /**
+   * @brief Read the manifest of a package
+   *
+   * @param name The name of the package
+   * @param data Filled with the manifest
+   * @return Whether or not the package was found
+   */
+  virtual bool getManifest(const std::string &name, std::string &data) = 0;
+
+  /**
+   * @brief Publish the manifest of a package
+   *
+   * @param name The name of the package
+   * @param data The manifest
+   * @return Whether or not the manifest was stored
+   */
+  virtual bool putManifest(const std::string &name,
+                           const std::string &data) = 0;
+};
+
+/**
+ * @brief A store in a local directory
+ */
+class LocalTransport : public Transport
+{
+public:
+  /**
+   * @brief Open a store, creating it if needed
+   *
+   * @param root The root directory of the store
+   */
+  LocalTransport(const std::filesystem::path &root);
+
+  bool hasChunk(const std::string &hash) override;
+  bool getChunk(const std::string &hash, size_t offset,
+                std::string &data) override;
+  bool putChunk(const std::string &hash, const std::string &data) override;
+  bool getManifest(const std::string &name, std::string &data) override;
+  bool putManifest(const std::string &name, const std::string &data) override;
+
+private:
+  std::filesystem::path chunkPath(const std::string &hash) const;
+
+  std::filesystem::path root_;
+};
+
+/**
+ * @brief A store served by `zc lib serve` over a Unix socket
+ *
+ * Requests are single lines ("GET <hash> <offset>", "PUT <hash> <size>"...),
+ * answered by "OK [<size>]" followed by the payload, or "ERR <message>"
+ */
+class SocketTransport : public Transport
+{
+public:
+  /**
+   * @brief Connect to a store server
+   *
+   * @param socket_path The path of the server's socket
+   */
+  SocketTransport(const std::filesystem::path &socket_path);
+  ~SocketTransport();
+
+  bool hasChunk(const std::string &hash) override;
+  bool getChunk(const std::string &hash, size_t offset,
+                std::string &data) override;
+  bool putChunk(const std::string &hash, const std::string &data) override;
+  bool getManifest(const std::string &name, std::string &data) override;
+  bool putManifest(const std::string &name, const std::string &data) override;
+
+  /**
+   * @brief Serve a local store over a Unix socket, one thread per client
+   * (never returns)
+   *
+   * @param store The root directory of the store
+   * @param socket_path The path of the socket to listen on
+   */
+  static void serve(const std::filesystem::path &store,
+                    const std::filesystem::path &socket_path);
+
+private:
+  /**
+   * @brief Send a request and read the response
+   *
+   * @param request The request line
+   * @param payload Data sent after the request line
+   * @param response Filled with the payload of the response
+   * @return Whether or not the server answered OK
+   */
+  bool request(const std::string &request, const std::string &payload,
+               std::string &response);
+
+  int fd_ = -1;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <set>
+#include <vector>
+
+/**
+ * @brief Watches files for changes with inotify
+ *
+ * The directories of the files are watched rather than the files themselves,
+ * so that files saved by writing a new file and renaming it over the old one
+ * (as most editors do) are still followed.
+ */
+class Watcher
+{
+public:
+  Watcher();
+  ~Watcher();
+
+  Watcher(const Watcher &) = delete;
+  Watcher &operator=(const Watcher &) = delete;
+
+  /**
+   * @brief Set the files to be watched, replacing the previous ones
+   *
+   * @param files The files to be watched
+   */
+  void watch(const std::vector<std::filesystem::path> &files);
+
+  /**
+   * @brief Watch every file of a directory tree, including the files and
+   * directories created later. Files deleted from it are reported too
+   *
+   * @param root The root directory of the tree
+   */
+  void watchTree(const std::filesystem::path &root);
+
+  /**
+   * @brief Wait for watched files to change
+   *
+   * A burst of changes (e.g. several files saved at once) is reported at
+   * once: the files are only returned once no change came for the debounce
+   * delay.
+   *
+   * @param timeout_ms The longest time to wait for a first change, -1 to wait
+   * forever
+   * @param debounce_ms The delay without changes ending a burst
+   * @return The files which changed, empty on timeout or if a signal
+   * interrupted the wait
+   */
+  std::vector<std::filesystem::path> wait(int timeout_ms, int debounce_ms);
+
+private:
+  /**
+   * @brief Read the pending events and collect the watched files they concern
+   */
+  void readEvents(std::set<std::filesystem::path> &changed);
+
+  /**
+   * @brief Watch a directory of a tree and its subdirectories
+   */
+  void addTree(const std::filesystem::path &dir);
+
+  /**
+   * @brief Check if a directory belongs to a watched tree
+   */
+  bool inTree(const std::filesystem::path &dir) const;
+
+  int fd_;
+
+  // Watch descriptor -> watched directory
+  std::map<int, std::filesystem::path> dirs_;
+
+  std::set<std::filesystem::path> files_;
+
+  std::vector<std::filesystem::path> trees_;
+};
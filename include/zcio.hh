@@ -1,6 +1,9 @@
 #pragma once
 
+#include <deque>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 // clang-format off
@@ -130,6 +133,19 @@ class Table
 public:
   using Chars = struct TableChars;
 
+  /**
+   * @brief Fill the cells of a row, row 0 being the column headers if there
+   * are some
+   *
+   * Cells may point into the source's own data, or into storage for the
+   * computed ones. Both must stay valid until the next call.
+   *
+   * @return false if the row doesn't exist
+   */
+  using RowSource = std::function<bool(size_t row,
+                                       std::vector<std::string_view> &cells,
+                                       std::deque<std::string> &storage)>;
+
   /**
    * @brief Create a Table instance
    *
@@ -141,10 +157,23 @@ public:
    */
   Table(int n_rows, int n_cols, bool hasRowHeaders, bool hasColHeaders,
         const std::vector<std::vector<std::string>> &content);
+
+  /**
+   * @brief Create a Table instance whose rows are read from a source when it
+   * is drawn, without being copied
+   *
+   * @param n_rows The table's number of rows
+   * @param n_cols The table's number of columns
+   * @param hasRowHeaders Whether or not the table has row headers
+   * @param hasColHeaders Whether or not the table has column headers
+   * @param source The source of the rows
+   */
+  Table(int n_rows, int n_cols, bool hasRowHeaders, bool hasColHeaders,
+        RowSource source);
   ~Table();
 
   /**
-   * @brief Print out the Table
+   * @brief Print out the Table, one write per line
    */
   void draw();
 
@@ -160,6 +189,21 @@ public:
                     bool rowSeparatorThickness, bool colSeparatorThickness,
                     bool rowBorderThickness, bool colBorderThickness);
 
+  /**
+   * @brief Only draw some of the rows (the column headers are always drawn)
+   *
+   * @param offset The number of rows to skip
+   * @param count The maximum number of rows to draw (0 for all of them)
+   */
+  void setRange(size_t offset, size_t count);
+
+  /**
+   * @brief Truncate the cells wider than a given width
+   *
+   * @param width The maximum display width of a cell (0 for no limit)
+   */
+  void setMaxWidth(size_t width);
+
   /**
    * @brief Get the table's size
    *
@@ -169,7 +213,7 @@ public:
 
 private:
   /**
-   * @brief Get the width of each column of the Table
+   * @brief Get the width of each column of the drawn rows, in one pass
    */
   void getWidths();
 
@@ -180,30 +224,34 @@ private:
   void getChars();
 
   /**
-   * @brief Draw the Table's top line
+   * @brief Draw a horizontal line of the Table
+   *
+   * @param left The left border
+   * @param fill The horizontal line
+   * @param sepCross The crossing after the row headers
+   * @param cross The crossing between the other columns
+   * @param right The right border
    */
-  void topLine();
+  void horizontalLine(const std::string &left, const std::string &fill,
+                      const std::string &sepCross, const std::string &cross,
+                      const std::string &right);
 
   /**
-   * @brief Draw a table's middle line with it's content
+   * @brief Draw a table's middle line with the content of the last row read
    */
   void middleLine();
 
   /**
-   * @brief Draw the Table's bottom line
-   */
-  void bottomLine();
-
-  /**
-   * @brief Draw the separator between the column headers and the content of the
-   * table
+   * @brief Read a row from the source, truncating the cells
+   *
+   * @return false if the row doesn't exist
    */
-  void columnHeaderSeparator();
+  bool readRow(size_t row);
 
   /**
-   * @brief Draw the separator between each line
+   * @brief Write a line at once
    */
-  void separator();
+  void writeLine();
 
   /**
    * @brief The number of columns in the table
@@ -215,11 +263,6 @@ private:
    */
   int n_rows_;
 
-  /**
-   * @brief The current line that is being displayed
-   */
-  int current_line_;
-
   /**
    * @brief Characters of the table borders
    */
@@ -231,14 +274,25 @@ private:
   std::vector<int> max_widths_;
 
   /**
-   * @brief The body of the table
+   * @brief The source of the rows
    */
-  std::vector<std::vector<std::string>> content_;
+  RowSource source_;
 
   /**
-   * @brief The size of each element
+   * @brief The cells of the row being read and the storage of the computed
+   * ones
    */
-  std::vector<std::vector<int>> sizes_;
+  std::vector<std::string_view> cells_;
+  std::deque<std::string> storage_;
+
+  /**
+   * @brief The line being drawn
+   */
+  std::string line_;
+
+  size_t offset_ = 0;
+  size_t count_ = 0;
+  size_t max_width_ = 0;
 
   bool hasRowHeaders_ = false;
   bool hasColHeaders_ = false;
@@ -1,19 +1,92 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <commands/Build.hh>
+#include <helpers.hh>
+#include <nlohmann/json.hpp>
 #include <objects/File.hh>
+#include <objects/Watcher.hh>
 #include <objects/ZCError.hh>
 #include <zcio.hh>
 
 using namespace std;
 namespace fs = std::filesystem;
+using json = nlohmann::json;
 
-Build::Build(bool force, bool release_mode)
-    : force_(force), release_mode_(release_mode),
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Set when the watch mode is interrupted (Ctrl+C)
+volatile sig_atomic_t interrupted = 0;
+
+void onInterrupt(int) { interrupted = 1; }
+
+fs::path normalize(const fs::path &file)
+{
+  return fs::absolute(file).lexically_normal();
+}
+
+bool isSource(const fs::path &file)
+{
+  Language language = File(file.string()).getLanguage_();
+  return language == C || language == CPP || language == CPP_MODULE;
+}
+
+/**
+ * @brief Get the local files a file includes with quotes, searched next to it
+ * then in the include/ and src/ directories of the project
+ */
+vector<fs::path> localIncludes(const fs::path &file, const fs::path &root)
+{
+  vector<fs::path> includes;
+  ifstream input(file);
+  string line;
+  while (getline(input, line))
+  {
+    size_t pos = line.find_first_not_of(" \t");
+    if (pos == string::npos || line[pos] != '#')
+      continue;
+    pos = line.find_first_not_of(" \t", pos + 1);
+    if (pos == string::npos || line.compare(pos, 7, "include") != 0)
+      continue;
+    pos = line.find_first_not_of(" \t", pos + 7);
+    if (pos == string::npos || line[pos] != '"')
+      continue;
+    size_t end = line.find('"', pos + 1);
+    if (end == string::npos)
+      continue;
+    string header = line.substr(pos + 1, end - pos - 1);
+    for (const auto &dir :
+         {file.parent_path(), root / "include", root / "src"})
+      if (fs::exists(dir / header))
+      {
+        includes.push_back(normalize(dir / header));
+        break;
+      }
+  }
+  return includes;
+}
+
+} // namespace
+
+// ----------------------------------------------- Build class
+
+Build::Build(bool force, bool release_mode, bool watch)
+    : force_(force), release_mode_(release_mode), watch_(watch),
       registry_(Registry::getInstance()), settings_(Settings::getInstance())
 {
 }
@@ -27,7 +100,8 @@ vector<File> Build::scanSources(const fs::path &root) const
     for (const auto &entry : fs::recursive_directory_iterator(src_code))
     {
       File f(entry.path());
-      if (f.getLanguage_() == C || f.getLanguage_() == CPP)
+      if (f.getLanguage_() == C || f.getLanguage_() == CPP ||
+          f.getLanguage_() == CPP_MODULE)
         sources.push_back(f);
     }
   }
@@ -36,51 +110,319 @@ vector<File> Build::scanSources(const fs::path &root) const
 
 int Build::execute()
 {
-  fs::path project_root = getProjectRoot();
+  if (watch_)
+    return runWatch();
 
-  auto sources = scanSources(project_root);
+  vector<File> sources;
+  vector<string> cflags, libs;
+  configure(getProjectRoot(), sources, cflags, libs);
+
+  info("Building project...");
+  if (system("cmake --build build") != 0)
+    throw ZCError(ZC_COMPILATION_ERROR, "Build failed");
+
+  success("Project was built successfully in build/");
+  return 0;
+}
+
+void Build::configure(const fs::path &root, vector<File> &sources,
+                      vector<string> &cflags, vector<string> &libs)
+{
+  sources = scanSources(root);
   if (sources.empty())
     throw ZCError(ZC_NO_SOURCE_FILES, "No source file were detected");
 
-  auto libs = detectLibraries(sources);
+  cflags.clear();
+  libs.clear();
+  detectLibraries(sources, cflags, libs);
 
   if (force_ || fs::exists("Cmakelists.txt"))
   {
     info("Generating CmakeLists.txt...");
-    generateCMakeLists(sources, libs);
+    generateCMakeLists(sources, cflags, libs);
   }
 
   string build_type = release_mode_ ? "Release" : "Debug";
   string config_cmd = "cmake -B build -DCMAKE_BUILD_TYPE=" + build_type;
-  string build_cmd = "cmake --build build";
+  // CMake only builds C++ modules with Ninja, which can't replace the
+  // generator of an existing build directory
+  if (any_of(sources.begin(), sources.end(),
+             [](const File &f) { return f.getLanguage_() == CPP_MODULE; }) &&
+      !fs::exists("build/CMakeCache.txt"))
+    config_cmd += " -G Ninja";
 
   info("Configuring project...");
   if (system(config_cmd.c_str()) != 0)
     throw ZCError(ZC_CMAKE_ERROR, "CMake configuration failed");
+}
 
-  info("Building project...");
-  if (system(build_cmd.c_str()) != 0)
-    throw ZCError(ZC_COMPILATION_ERROR, "Build failed");
+int Build::runWatch()
+{
+  // Ctrl+C stops the watch. Without SA_RESTART, it also interrupts the wait
+  // for changes
+  struct sigaction stop{}, old_int;
+  stop.sa_handler = onInterrupt;
+  sigaction(SIGINT, &stop, &old_int);
+  interrupted = 0;
 
-  success("Project was built successfully in build/");
+  fs::path root = getProjectRoot();
+  Watcher watcher;
+  watcher.watchTree(root / "src");
+  if (fs::exists(root / "include"))
+    watcher.watchTree(root / "include");
+
+  vector<File> sources;
+  vector<string> cflags, libs;
+  vector<fs::path> changed;
+  bool reconfigure = true;
+  while (!interrupted)
+  {
+    auto start = chrono::steady_clock::now();
+    bool ok = true;
+    try
+    {
+      if (reconfigure)
+      {
+        // 1. Sources were added or removed, or the libraries changed: the
+        // graph is built again from scratch
+        configure(root, sources, cflags, libs);
+        reconfigure = false;
+        loadCompileCommands();
+        graph_.clear();
+        vector<fs::path> files;
+        for (const auto &s : sources)
+          files.push_back(normalize(s.getPath_()));
+        updateGraph(files);
+      }
+      else
+      {
+        // 2. Only the sources reading a changed file are compiled, the most
+        // recently edited first. Modules are left to the generator, which
+        // knows their order
+        updateGraph(changed);
+        vector<pair<long long, fs::path>> queue;
+        bool has_modules = any_of(
+            sources.begin(), sources.end(),
+            [](const File &f) { return f.getLanguage_() == CPP_MODULE; });
+        for (const auto &s : sources)
+        {
+          fs::path source = normalize(s.getPath_());
+          // The file clock's epoch may be in the future, so its counts only
+          // order the sources
+          bool dirty = false;
+          long long priority = numeric_limits<long long>::min();
+          for (const auto &c : changed)
+          {
+            if (source != c && !dependsOn(source, c))
+              continue;
+            dirty = true;
+            error_code ec;
+            auto time = fs::last_write_time(c, ec);
+            if (!ec)
+              priority = max<long long>(priority,
+                                        time.time_since_epoch().count());
+          }
+          if (dirty && !has_modules)
+            queue.push_back({priority, source});
+        }
+        ok = compileSources(queue);
+      }
+
+      // 3. Link, and build what the generator finds out of date
+      info("Building project...");
+      ok = system("cmake --build build") == 0 && ok;
+    }
+    catch (const ZCError &e)
+    {
+      cerr << e << endl;
+      ok = false;
+    }
+
+    auto ms = chrono::duration_cast<chrono::milliseconds>(
+                  chrono::steady_clock::now() - start)
+                  .count();
+    if (ok)
+      success("Project was built successfully in build/ (" + to_string(ms) +
+              " ms)");
+    else
+      cerr << ZCError(ZC_COMPILATION_ERROR, "Build failed") << endl;
+    info("Watching for changes (Ctrl+C to stop)...");
+
+    // 4. Sleep until a file of the project changes
+    changed.clear();
+    while (changed.empty() && !interrupted)
+      changed = watcher.wait(-1, 50);
+
+    // A source was created or deleted, or a directory moved. A failed
+    // configuration is tried again too
+    set<fs::path> known;
+    for (const auto &s : sources)
+      known.insert(normalize(s.getPath_()));
+    for (const auto &c : changed)
+      if (fs::is_directory(c) || (isSource(c) && !known.count(c)))
+        reconfigure = true;
+    for (const auto &s : known)
+      if (!fs::exists(s))
+        reconfigure = true;
+
+    // The included libraries may have changed. The inclusions of unchanged
+    // files come from the cache
+    if (!reconfigure)
+    {
+      vector<string> new_cflags, new_libs;
+      detectLibraries(sources, new_cflags, new_libs);
+      reconfigure = new_cflags != cflags || new_libs != libs;
+    }
+  }
+
+  sigaction(SIGINT, &old_int, nullptr);
+  cout << endl;
+  info("Stopped watching.");
   return 0;
 }
 
-vector<string> Build::detectLibraries(const std::vector<File> &sources) const
+void Build::updateGraph(const vector<fs::path> &files)
+{
+  fs::path root = getProjectRoot();
+  vector<fs::path> queue = files;
+  set<fs::path> visited;
+  while (!queue.empty())
+  {
+    fs::path file = queue.back();
+    queue.pop_back();
+    if (!visited.insert(file).second)
+      continue;
+    if (!fs::is_regular_file(file))
+    {
+      graph_.erase(file);
+      continue;
+    }
+    graph_[file] = localIncludes(file, root);
+    // Headers included for the first time are read too
+    for (const auto &h : graph_[file])
+      if (!graph_.count(h))
+        queue.push_back(h);
+  }
+}
+
+bool Build::dependsOn(const fs::path &file, const fs::path &dependency) const
+{
+  vector<fs::path> stack{file};
+  set<fs::path> visited;
+  while (!stack.empty())
+  {
+    fs::path f = stack.back();
+    stack.pop_back();
+    auto it = graph_.find(f);
+    if (it == graph_.end() || !visited.insert(f).second)
+      continue;
+    for (const auto &h : it->second)
+    {
+      if (h == dependency)
+        return true;
+      stack.push_back(h);
+    }
+  }
+  return false;
+}
+
+void Build::loadCompileCommands()
+{
+  commands_.clear();
+  ifstream input("build/compile_commands.json");
+  if (!input.is_open())
+    return;
+  try
+  {
+    json entries = json::parse(input);
+    for (const auto &entry : entries)
+    {
+      string dir = entry.at("directory").get<string>();
+      string command;
+      if (entry.contains("command"))
+        command = entry["command"].get<string>();
+      else
+        for (const auto &a : entry.at("arguments"))
+          command += (command.empty() ? "" : " ") +
+                     escape_shell_arg(a.get<string>());
+      fs::path file = entry.at("file").get<string>();
+      if (file.is_relative())
+        file = fs::path(dir) / file;
+      commands_[normalize(file)] = {dir, command};
+    }
+  }
+  catch (const json::exception &)
+  {
+    // Left to the generator
+    commands_.clear();
+  }
+}
+
+bool Build::compileSources(
+    const vector<pair<long long, fs::path>> &sources) const
+{
+  priority_queue<pair<long long, fs::path>> queue(sources.begin(),
+                                                  sources.end());
+  size_t total = queue.size();
+  size_t done = 0;
+  atomic<bool> ok{true};
+  mutex queue_mutex;
+
+  auto worker = [&]()
+  {
+    while (true)
+    {
+      fs::path source;
+      pair<string, string> command;
+      {
+        lock_guard<mutex> lock(queue_mutex);
+        if (queue.empty())
+          return;
+        source = queue.top().second;
+        queue.pop();
+        auto it = commands_.find(source);
+        if (it == commands_.end())
+          continue;
+        command = it->second;
+        info("[" + to_string(++done) + "/" + to_string(total) + "] " +
+             fs::relative(source).string());
+      }
+      // The object is written where the generator expects it, so it isn't
+      // compiled again by the build
+      if (system(("cd " + escape_shell_arg(command.first) + " && " +
+                  command.second)
+                     .c_str()) != 0)
+        ok = false;
+    }
+  };
+
+  vector<thread> workers;
+  size_t n_workers =
+      min<size_t>(total, max(1u, thread::hardware_concurrency()));
+  for (size_t w = 0; w < n_workers; w++)
+    workers.emplace_back(worker);
+  for (auto &w : workers)
+    w.join();
+  return ok;
+}
+
+void Build::detectLibraries(const vector<File> &sources, vector<string> &cflags,
+                            vector<string> &libs) const
 {
-  vector<string> libs;
   for (const auto &file : sources)
   {
-    vector<string> file_libs = file.getInclusions(registry_);
+    vector<string> file_cflags, file_libs;
+    file.getInclusions(registry_, file_cflags, file_libs);
 
-    for (const auto &lib : file_libs)
-      if (find(libs.begin(), libs.end(), lib) == libs.end())
-        libs.push_back(lib);
+    mergeFlags(cflags, file_cflags, false);
+    // Keep the last occurrence, so that libraries stay before their
+    // dependencies
+    mergeFlags(libs, file_libs, true);
   }
-  return libs;
 }
 
 bool Build::generateCMakeLists(const vector<File> &sources,
+                               const vector<string> &cflags,
                                const vector<string> &libs)
 {
   ofstream cmake("CMakeLists.txt");
@@ -91,7 +433,15 @@ bool Build::generateCMakeLists(const vector<File> &sources,
   }
   string project_name = fs::current_path().filename().string();
 
-  cmake << "cmake_minimum_required(VERSION 3.12)\n";
+  // C++20 modules are scanned with clang-scan-deps (or the scanner of the
+  // compiler) and their BMIs built in dependency order, since CMake 3.28
+  vector<File> units;
+  for (const auto &src : sources)
+    if (src.getLanguage_() == CPP_MODULE)
+      units.push_back(src);
+
+  cmake << "cmake_minimum_required(VERSION "
+        << (units.empty() ? "3.12" : "3.28") << ")\n";
   cmake << "project(" << project_name << " C CXX)\n\n";
 
   // Standards
@@ -104,14 +454,55 @@ bool Build::generateCMakeLists(const vector<File> &sources,
   cmake << "# ZC Paths\n";
   cmake << "include_directories(" << registry_.getIncludeDir().string()
         << ")\n";
-  cmake << "link_directories(" << registry_.getLibDir().string() << ")\n\n";
+  // Link the library variants matching the build type, then the libraries
+  // installed without variants
+  string debug_libs =
+      registry_.getLibDir(registry_.getVariant({"-O0", "-g"})).string();
+  string release_libs =
+      registry_.getLibDir(registry_.getVariant({"-O3"})).string();
+  string variant_libs = "$<IF:$<CONFIG:Debug>," + debug_libs + "," +
+                        release_libs + ">";
+  cmake << "link_directories(\"" << variant_libs << "\" "
+        << registry_.getLibDir().string() << ")\n\n";
 
   // Source code
   cmake << "add_executable(" << project_name << '\n';
   for (const auto &src : sources)
-    cmake << "    " << src << "\n";
+    if (src.getLanguage_() != CPP_MODULE)
+      cmake << "    " << src << "\n";
   cmake << ")\n";
 
+  if (!units.empty())
+  {
+    cmake << "target_sources(" << project_name
+          << " PRIVATE FILE_SET CXX_MODULES FILES\n";
+    for (const auto &unit : units)
+      cmake << "    " << unit << "\n";
+    cmake << ")\n";
+  }
+
+  // Compiling flags of the included libraries
+  if (!cflags.empty())
+  {
+    cmake << "target_compile_options(" << project_name << " PRIVATE\n";
+    for (const auto &flag : cflags)
+      cmake << "    " << flag << "\n";
+    cmake << ")\n";
+  }
+
+  // Libraries precompiled as Clang modules, only used when building with clang
+  vector<string> module_flags = registry_.getModuleFlags();
+  if (!module_flags.empty())
+  {
+    cmake << "if(CMAKE_C_COMPILER_ID MATCHES \"Clang\" AND "
+             "CMAKE_CXX_COMPILER_ID MATCHES \"Clang\")\n";
+    cmake << "  target_compile_options(" << project_name << " PRIVATE\n";
+    for (const auto &flag : module_flags)
+      cmake << "      " << flag << "\n";
+    cmake << "  )\n";
+    cmake << "endif()\n";
+  }
+
   // Linking
   if (!libs.empty())
   {
@@ -121,6 +512,9 @@ bool Build::generateCMakeLists(const vector<File> &sources,
       cmake << "    " << lib << "\n";
     }
     cmake << ")\n";
+    cmake << "set_target_properties(" << project_name
+          << " PROPERTIES BUILD_RPATH \"" << variant_libs << ";"
+          << registry_.getLibDir().string() << "\")\n";
   }
 
   // Add de pthread/dl if Linux
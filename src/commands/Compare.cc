@@ -0,0 +1,63 @@
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <string>
+
+#include <commands/Compare.hh>
+#include <objects/Benchmark.hh>
+#include <objects/Profile.hh>
+#include <zcio.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// The significance level of the comparison
+#define ALPHA 0.05
+
+// Functions shown by the comparison of two profiles
+#define PROFILE_TOP 20
+
+Compare::Compare(const string &baseline, const string &candidate)
+    : baseline_(baseline), candidate_(candidate)
+{
+}
+
+int Compare::execute()
+{
+  // Profiles written by zc run --profile
+  if (fs::path(baseline_).extension() == ".folded" &&
+      fs::path(candidate_).extension() == ".folded")
+  {
+    Profile baseline = Profile::load(baseline_);
+    Profile candidate = Profile::load(candidate_);
+    Profile::diff(baseline, candidate, PROFILE_TOP).draw();
+    info("Shares of the samples spent in each function itself (" +
+         to_string(baseline.getSamples()) + " and " +
+         to_string(candidate.getSamples()) + " samples)");
+    return 0;
+  }
+
+  Benchmark baseline = Benchmark::load(baseline_);
+  Benchmark candidate = Benchmark::load(candidate_);
+
+  map<string, double> p_value;
+  Benchmark::compare(baseline, candidate, p_value).draw();
+
+  // The verdict is about the wall-clock time, the one users wait for
+  double before = Benchmark::summarize(baseline.getSamples("wall")).mean_;
+  double after = Benchmark::summarize(candidate.getSamples("wall")).mean_;
+  if (p_value["wall"] >= ALPHA)
+  {
+    info("No significant difference of wall-clock time (p >= " +
+         to_string(ALPHA).substr(0, 4) + ")");
+    return 0;
+  }
+
+  char ratio[32];
+  snprintf(ratio, sizeof(ratio), "%.2fx", after > 0 ? before / after : 0.0);
+  if (after < before)
+    success("The candidate is significantly faster: " + string(ratio));
+  else
+    warning("The candidate is significantly slower: " + string(ratio));
+  return 0;
+}
@@ -0,0 +1,49 @@
+#include <string>
+
+#include <commands/Daemon.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+using namespace std;
+
+Daemon::Daemon(bool detach, bool stop, bool status,
+               DaemonServer::Handler handler)
+    : detach_(detach), stop_(stop), status_(status), handler_(handler)
+{
+}
+
+int Daemon::execute()
+{
+  if (status_)
+  {
+    int32_t pid = DaemonServer::getPid();
+    if (pid == 0)
+    {
+      info("No daemon is running");
+      return 1;
+    }
+    info("The daemon is running (PID " + to_string(pid) + ")");
+    return 0;
+  }
+
+  if (stop_)
+  {
+    if (!DaemonServer::stop())
+      throw ZCError(ZC_NOT_FOUND, "No daemon is running");
+    success("Daemon stopped");
+    return 0;
+  }
+
+  DaemonServer server(handler_);
+  if (detach_)
+  {
+    pid_t pid = server.detach();
+    if (pid > 0)
+    {
+      success("Daemon started (PID " + to_string(pid) + ")");
+      return 0;
+    }
+  }
+  server.serve();
+  return 0;
+}
@@ -1,18 +1,23 @@
+#include <algorithm>
 #include <filesystem>
 #include <vector>
 
 #include <commands/Lib/Create.hh>
+#include <objects/Bundle.hh>
 #include <objects/File.hh>
 #include <objects/Registry.hh>
 #include <objects/ZCError.hh>
+#include <zcio.hh>
 
 using namespace std;
 namespace fs = std::filesystem;
 
 Create::Create(const string &package_name, const vector<string> &files,
-               bool force)
+               bool force, const vector<string> &isa_levels,
+               const vector<string> &dependencies)
     : package_name_(package_name), force_(force),
-      registry_(Registry::getInstance())
+      registry_(Registry::getInstance()), isa_levels_(isa_levels),
+      dependencies_(dependencies)
 {
   for (const auto &f : files)
     files_.push_back(File(f));
@@ -21,8 +26,8 @@ Create::Create(const string &package_name, const vector<string> &files,
 int Create::execute()
 {
   bool is_cpp = false;
-  // 1. Sort files (.c, .h, .o)
-  vector<File> sources, headers, objects;
+  // 1. Sort files (.c, .h, .o, .zcpkg)
+  vector<File> sources, headers, objects, bundles;
   for (const auto &f : files_)
   {
     switch (f.getLanguage_())
@@ -43,11 +48,18 @@ int Create::execute()
     case OBJECT:
       objects.push_back(f);
       break;
+    case BUNDLE:
+      bundles.push_back(f);
+      break;
     default:
       break;
     }
   }
 
+  // A bundle already holds the built library: it is installed as is
+  if (!bundles.empty())
+    return installBundle(bundles);
+
   if (sources.empty() && headers.empty())
     throw ZCError(ZC_BAD_COMMAND,
                   "At least one header or source file expected.");
@@ -58,6 +70,14 @@ int Create::execute()
   pkg.version_ = "0.0.1";
   pkg.author_ = "localuser";
   pkg.flags_ = "-l" + package_name_;
+  pkg.isa_ = isa_levels_;
+  pkg.dependencies_ = dependencies_;
+
+  // Resolving the dependencies fails if one of them is unknown
+  vector<string> closure = registry_.getDependencies(dependencies_);
+  if (find(closure.begin(), closure.end(), package_name_) != closure.end())
+    throw ZCError(ZC_BAD_COMMAND,
+                  "Circular dependency on the library " + package_name_);
 
   vector<fs::path> headers_paths, objects_paths, sources_paths;
   for (const auto &h : headers)
@@ -72,3 +92,24 @@ int Create::execute()
 
   return 0;
 }
+
+int Create::installBundle(const vector<File> &bundles) const
+{
+  if (bundles.size() != 1 || files_.size() != 1)
+    throw ZCError(ZC_BAD_COMMAND,
+                  "A bundle can't be combined with other files.");
+
+  Bundle bundle(bundles.front().getPath_());
+  string name = bundle.getPackage().name_;
+  if (name != package_name_)
+    throw ZCError(ZC_BAD_COMMAND, "The bundle holds the library " + name +
+                                      ", not " + package_name_);
+  if (!force_ && registry_.pkgExists(name) &&
+      !ask("The library " + name +
+           " already exists. Do you want to replace it ?"))
+    throw ZCError(ZC_OPERATIONS_ABORTED, "Operations aborted.");
+
+  bundle.install(true);
+  success("Library installed: " + name);
+  return 0;
+}
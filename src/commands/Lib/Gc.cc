@@ -0,0 +1,18 @@
+#include <cstdint>
+#include <string>
+
+#include <commands/Lib/Gc.hh>
+#include <zcio.hh>
+
+using namespace std;
+
+Gc::Gc() : registry_(Registry::getInstance()) {}
+
+int Gc::execute()
+{
+  uintmax_t freed = 0;
+  size_t count = registry_.collectGarbage(freed);
+  success("Removed " + to_string(count) + " unused header blobs (" +
+          to_string(freed / 1024) + " KiB freed)");
+  return 0;
+}
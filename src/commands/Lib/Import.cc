@@ -0,0 +1,37 @@
+#include <string>
+#include <vector>
+
+#include <commands/Lib/Import.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+using namespace std;
+
+Import::Import(const vector<string> &modules, bool all)
+    : modules_(modules), all_(all), registry_(Registry::getInstance())
+{
+}
+
+int Import::execute()
+{
+  if (all_)
+  {
+    string list;
+    if (!captureOutput("pkg-config --list-all", list))
+      throw ZCError(ZC_NOT_FOUND, "pkg-config couldn't list the modules");
+    // Each line is "<module> <description>"
+    for (const auto &line : split(list, '\n'))
+      if (!line.empty())
+        modules_.push_back(line.substr(0, line.find(' ')));
+  }
+  if (modules_.empty())
+    throw ZCError(ZC_BAD_COMMAND, "At least one module expected.");
+
+  vector<string> failed = registry_.importPkgConfig(modules_);
+  success("Imported " + to_string(modules_.size() - failed.size()) +
+          " pkg-config modules");
+  if (!failed.empty())
+    throw ZCError(ZC_PACKAGE_NOT_FOUND,
+                  "Some modules couldn't be imported: " + join(failed, ", "));
+  return 0;
+}
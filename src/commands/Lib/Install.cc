@@ -0,0 +1,55 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <commands/Lib/Install.hh>
+#include <objects/Bundle.hh>
+#include <objects/Postman.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+Install::Install(const vector<string> &targets, const string &server,
+                 bool static_libs)
+    : targets_(targets), static_libs_(static_libs),
+      postman_(Postman::getInstance())
+{
+  if (!server.empty())
+    postman_.setServer(server);
+}
+
+int Install::execute()
+{
+  // Bundles are installed from disk, the other targets from the store
+  vector<string> packages, failed;
+  for (const auto &target : targets_)
+  {
+    if (fs::path(target).extension() != BUNDLE_EXT)
+    {
+      packages.push_back(target);
+      continue;
+    }
+    try
+    {
+      success("Package installed: " + Bundle(target).install(static_libs_));
+    }
+    catch (const ZCError &e)
+    {
+      cerr << e << endl;
+      failed.push_back(target);
+    }
+  }
+
+  if (!packages.empty())
+  {
+    vector<string> not_downloaded = postman_.downloadPackages(packages);
+    failed.insert(failed.end(), not_downloaded.begin(), not_downloaded.end());
+  }
+  if (!failed.empty())
+    throw ZCError(ZC_PACKAGE_NOT_FOUND,
+                  "Some packages couldn't be installed: " + join(failed, ", "));
+  return 0;
+}
@@ -6,8 +6,9 @@
 
 using namespace std;
 
-List::List(bool display_std)
-    : registry_(Registry::getInstance()), display_std_(display_std)
+List::List(bool display_std, size_t page, size_t per_page, size_t max_width)
+    : registry_(Registry::getInstance()), display_std_(display_std),
+      page_(page), per_page_(per_page), max_width_(max_width)
 {
 }
 
@@ -23,6 +24,9 @@ int List::execute()
       return 0;
     }
 
+    if (page_ > 0)
+      std_lib.setRange((page_ - 1) * per_page_, per_page_);
+    std_lib.setMaxWidth(max_width_);
     std_lib.draw();
     return 0;
   }
@@ -35,6 +39,9 @@ int List::execute()
     return 0;
   }
 
+  if (page_ > 0)
+    lib.setRange((page_ - 1) * per_page_, per_page_);
+  lib.setMaxWidth(max_width_);
   lib.draw();
   return 0;
 }
@@ -0,0 +1,33 @@
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <commands/Lib/Pack.hh>
+#include <hash.hh>
+#include <objects/Bundle.hh>
+#include <zcio.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+Pack::Pack(const vector<string> &targets, const string &output_dir)
+    : targets_(targets), output_dir_(output_dir),
+      registry_(Registry::getInstance())
+{
+}
+
+int Pack::execute()
+{
+  fs::path dir =
+      output_dir_.empty() ? fs::current_path() : fs::path(output_dir_);
+  fs::create_directories(dir);
+  for (const auto &target : targets_)
+  {
+    fs::path output = dir / (target + BUNDLE_EXT);
+    Bundle::pack(registry_.getPackage(target), output);
+    // Bundles are reproducible, so the hash identifies the content
+    success("Package packed: " + output.string() + " (sha256 " +
+            sha256File(output) + ")");
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+#include <string>
+#include <vector>
+
+#include <commands/Lib/Search.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+using namespace std;
+
+Search::Search(const vector<string> &query, size_t limit, bool rebuild)
+    : query_(join(query, " ")), limit_(limit), rebuild_(rebuild),
+      registry_(Registry::getInstance()), index_(SearchIndex::getInstance())
+{
+}
+
+int Search::execute()
+{
+  if (rebuild_)
+    index_.rebuild(registry_.getPackages());
+
+  vector<SearchResult> results = index_.search(query_, limit_);
+  if (results.empty())
+  {
+    info("No library matches \"" + query_ + "\"");
+    return 0;
+  }
+
+  vector<vector<string>> content = {{"Package", "Version", "Author", "Matches"}};
+  size_t stale = 0;
+  for (const auto &r : results)
+  {
+    // The index may name packages removed from the registry since it was
+    // written (e.g. by hand)
+    if (!registry_.pkgExists(r.package_))
+    {
+      stale++;
+      continue;
+    }
+    const Package &p = registry_.getPackage(r.package_);
+    content.push_back({p.name_, p.version_, p.author_, join(r.matches_, ", ")});
+  }
+  if (stale > 0)
+    warning("The search index is out of date, run zc lib search --rebuild");
+  if (content.size() == 1)
+  {
+    info("No library matches \"" + query_ + "\"");
+    return 0;
+  }
+  Table table(content.size(), 4, false, true, content);
+  table.draw();
+  return 0;
+}
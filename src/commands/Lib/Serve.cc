@@ -0,0 +1,20 @@
+#include <string>
+
+#include <commands/Lib/Serve.hh>
+#include <objects/Settings.hh>
+#include <objects/Transport.hh>
+
+using namespace std;
+
+Serve::Serve(const string &store, const string &socket_path)
+    : store_(store.empty() ? Settings::getInstance().getPackageServer()
+                           : store),
+      socket_path_(socket_path)
+{
+}
+
+int Serve::execute()
+{
+  SocketTransport::serve(store_, socket_path_);
+  return 0;
+}
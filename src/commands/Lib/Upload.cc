@@ -0,0 +1,39 @@
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <commands/Lib/Upload.hh>
+#include <objects/File.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+Upload::Upload(const vector<string> &targets, const string &server)
+    : targets_(targets), registry_(Registry::getInstance()),
+      postman_(Postman::getInstance())
+{
+  if (!server.empty())
+    postman_.setServer(server);
+}
+
+int Upload::execute()
+{
+  for (const auto &target : targets_)
+  {
+    const Package &pkg = registry_.getPackage(target);
+
+    vector<File> headers, binaries;
+    for (const auto &h : pkg.headers_)
+      headers.push_back(File((registry_.getIncludeDir() / target / h).string()));
+    for (const auto &b : pkg.binaries_)
+      binaries.push_back(File(b));
+
+    if (!postman_.uploadPackage(pkg, headers, binaries))
+      throw ZCError(ZC_WRITING_ERROR, "The package couldn't be uploaded: " +
+                                          target);
+    success("Package uploaded: " + target);
+  }
+  return 0;
+}
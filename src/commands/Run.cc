@@ -1,14 +1,38 @@
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <commands/Run.hh>
 #include <helpers.hh>
+#include <objects/Benchmark.hh>
+#include <objects/Compiler.hh>
 #include <objects/File.hh>
+#include <objects/HeapProfile.hh>
+#include <objects/Jit.hh>
+#include <objects/ModuleBuilder.hh>
+#include <objects/PchCache.hh>
+#include <objects/PerfCounters.hh>
+#include <objects/Profile.hh>
 #include <objects/Registry.hh>
+#include <objects/ResourceMonitor.hh>
 #include <objects/Settings.hh>
+#include <objects/Watcher.hh>
 #include <objects/ZCError.hh>
 #include <zcio.hh>
 
@@ -17,14 +41,111 @@
 using namespace std;
 namespace fs = std::filesystem;
 
-Run::Run(const std::vector<std::string> &files,
-         const std::vector<std::string> &args, bool keep, bool plus,
-         bool preprocess, bool compile, bool assemble)
-    : keep_(keep), plus_(plus), settings_(Settings::getInstance()),
-      registry_(Registry::getInstance()),
-      mode_(getMode(preprocess, compile, assemble))
+// ----------------------------------------------- Helpers
+
+// Functions shown by zc run --profile
+#define PROFILE_TOP 20
+
+// Call sites shown by zc run --heap
+#define HEAP_TOP 10
+
+namespace
+{
+
+// Set when the watch mode is interrupted (Ctrl+C)
+volatile sig_atomic_t interrupted = 0;
+
+void onInterrupt(int) { interrupted = 1; }
+
+/**
+ * @brief Environment variables of the programs started while it exists, the
+ * previous values being restored afterwards
+ */
+class ScopedEnvironment
+{
+public:
+  ~ScopedEnvironment()
+  {
+    for (const auto &[name, value] : saved_)
+      if (value)
+        setenv(name.c_str(), value->c_str(), 1);
+      else
+        unsetenv(name.c_str());
+  }
+
+  void set(const string &name, const string &value)
+  {
+    if (!saved_.count(name))
+    {
+      const char *old = getenv(name.c_str());
+      saved_[name] = old ? optional<string>(old) : nullopt;
+    }
+    setenv(name.c_str(), value.c_str(), 1);
+  }
+
+  /**
+   * @brief Preload a library before the ones already preloaded
+   */
+  void preload(const fs::path &library)
+  {
+    const char *old = getenv("LD_PRELOAD");
+    set("LD_PRELOAD",
+        library.string() + (old && *old ? ":" + string(old) : ""));
+  }
+
+private:
+  map<string, optional<string>> saved_;
+};
+
+/**
+ * @brief Stop a program started by the watch mode, if it is still running
+ */
+void stopProgram(pid_t pid)
+{
+  if (pid <= 0)
+    return;
+  kill(pid, SIGTERM);
+  // Killed for good if it doesn't exit within half a second
+  for (int i = 0; i < 50; i++)
+  {
+    if (waitpid(pid, nullptr, WNOHANG) != 0)
+      return;
+    usleep(10000);
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+}
+
+/**
+ * @brief Whether or not the flags set an optimization level (-O0, -O3, -Os...)
+ */
+bool hasOptimizationLevel(const vector<string> &flags)
 {
-  // 1. Check if CPP was given and that files have correct extensions
+  return any_of(flags.begin(), flags.end(), [](const string &f)
+                { return f.rfind("-O", 0) == 0; });
+}
+
+} // namespace
+
+// ----------------------------------------------- Run class
+
+Run::Run(const RunOptions &options)
+    : keep_(options.keep_), plus_(options.plus_), jit_(options.jit_),
+      watch_(options.watch_), bench_(options.bench_),
+      warmup_(options.warmup_), bench_output_(options.bench_output_),
+      time_(options.time_), max_memory_(options.max_memory_),
+      max_cpu_(options.max_cpu_), counters_(options.counters_),
+      profile_(options.profile_), heap_(options.heap_),
+      mode_(getMode(options.preprocess_, options.compile_, options.assemble_)),
+      settings_(Settings::getInstance()), registry_(Registry::getInstance()),
+      args_(options.args_),
+      noise_(options.cpus_, options.low_noise_, options.priority_)
+{
+  // 1. Fill files_
+  for (const auto &f : options.files_)
+    files_.push_back(File(f));
+
+  // 2. Check if CPP was given and that files have correct extensions
   string badFile;
   if (isCppAndCheckExtensions(badFile))
     plus_ = true;
@@ -33,9 +154,35 @@ Run::Run(const std::vector<std::string> &files,
     throw ZCError(ZC_UNSUPPORTED_LANGUAGE,
                   "File has an uncorrect extension: " + badFile);
 
-  // 2. Fill files_
-  for (const auto &f : files)
-    files_.push_back(File(f));
+  // The JIT doesn't write anything, nor builds C++ modules
+  if (jit_ && (mode_ != FULL || keep_))
+    throw ZCError(ZC_INCOMPATIBLE_FLAGS, "Incompatible options");
+  if (jit_ && any_of(files_.begin(), files_.end(), [](const File &f)
+                     { return f.getLanguage_() == CPP_MODULE; }))
+    throw ZCError(ZC_INCOMPATIBLE_FLAGS,
+                  "C++ modules can't be run by the JIT");
+
+  // The watch mode runs the program it builds, from memory
+  if (watch_ && (jit_ || mode_ != FULL || keep_))
+    throw ZCError(ZC_INCOMPATIBLE_FLAGS, "Incompatible options");
+
+  // The benchmark runs an executable built once, from memory
+  if (bench_ > 0 && (jit_ || watch_ || mode_ != FULL || keep_))
+    throw ZCError(ZC_INCOMPATIBLE_FLAGS, "Incompatible options");
+
+  // The noise controls apply to a separate process running the program
+  if ((noise_.enabled() || max_memory_ > 0 || max_cpu_ > 0) &&
+      (jit_ || mode_ != FULL))
+    throw ZCError(ZC_INCOMPATIBLE_FLAGS, "Incompatible options");
+
+  // The reports are about a single run of the program
+  if ((time_ || counters_ || profile_ || heap_) &&
+      (jit_ || watch_ || bench_ > 0 || mode_ != FULL))
+    throw ZCError(ZC_INCOMPATIBLE_FLAGS, "Incompatible options");
+
+  // The sampler would interrupt the allocator hooks, and be counted by them
+  if (profile_ && heap_)
+    throw ZCError(ZC_INCOMPATIBLE_FLAGS, "Incompatible options");
 }
 
 int Run::execute()
@@ -45,6 +192,18 @@ int Run::execute()
   if (!filesExist(badFile))
     throw ZCError(ZC_NOT_FOUND, "File not found: " + badFile);
 
+  if (jit_)
+    return runJit();
+  noise_.check();
+  if (watch_)
+    return runWatch();
+  if (bench_ > 0)
+    return runBench();
+  if (profile_)
+    return runProfile();
+  if (heap_)
+    return runHeap();
+
   string output_name = "", build_cmd = "";
 
   // 2. Build the compiling command following the given options
@@ -68,7 +227,19 @@ int Run::execute()
     break;
   }
 
-  build_cmd = buildCommand(output_name);
+  // An executable which isn't kept is linked into memory and run from there
+  string program_name = fs::path(output_name).filename().string();
+  int exe_fd = -1;
+  if (mode_ == FULL && !settings_.getAutoKeep() && !keep_)
+  {
+    // Inherited by the linker, which writes it through /proc/self/fd
+    exe_fd = memfd_create(program_name.c_str(), 0);
+    if (exe_fd >= 0)
+      output_name = "/proc/self/fd/" + to_string(exe_fd);
+  }
+
+  vector<string> build_args = buildArgs(output_name);
+  build_cmd = buildCommand(build_args);
 
 #ifdef DEBUG_MODE
   debug("Build command: " + build_cmd);
@@ -78,11 +249,14 @@ int Run::execute()
   // TODO : get command output in a variable instead of stdout for better
   // display
 
-  // 3. Compile program
-  int compile_res = system(build_cmd.c_str());
-
-  if (compile_res != 0)
+  // 3. Compile program, in-process if enabled: the objects are linked from
+  // memory
+  if (!runCompiler(build_args))
+  {
+    if (exe_fd >= 0)
+      close(exe_fd);
     throw ZCError(ZC_COMPILATION_ERROR, "Compilation failed");
+  }
 
   success("Compilation successful.");
   if (!(mode_ == FULL))
@@ -100,21 +274,27 @@ int Run::execute()
   }
 
   info("Executing program...");
-  string exec_cmd = fs::absolute(output_name).string();
-
-  for (const auto &arg : args_)
-    exec_cmd += " " + escape_shell_arg(arg);
-
-  int run_res = system(exec_cmd.c_str());
-
-  if (!settings_.getAutoKeep() && !keep_ && fs::exists(output_name))
+  int run_res;
+  if (exe_fd >= 0)
   {
-    fs::remove(output_name);
+    // The program must not inherit its own executable
+    fcntl(exe_fd, F_SETFD, FD_CLOEXEC);
+    run_res = runProgram(program_name, exe_fd);
+    close(exe_fd);
+  }
+  else
+  {
+    run_res = runProgram(fs::absolute(output_name).string(), -1);
+
+    if (!settings_.getAutoKeep() && !keep_ && fs::exists(output_name))
+    {
+      fs::remove(output_name);
 
 #ifdef DEBUG_MODE
-    cout << endl;
-    debug("Temporary file removed: " + output_name);
+      cout << endl;
+      debug("Temporary file removed: " + output_name);
 #endif
+    }
   }
 
   if (run_res == 0)
@@ -122,10 +302,588 @@ int Run::execute()
 
   stringstream msg;
   msg << "Program exited with code " << run_res;
+  if (max_cpu_ > 0 &&
+      (run_res == 128 + SIGXCPU || run_res == 128 + SIGKILL))
+    msg << ": CPU time limit of " << max_cpu_ << " s exceeded";
+  else if (max_memory_ > 0)
+    msg << " (memory limited to " << max_memory_ << " MiB)";
   throw ZCError(ZC_EXECUTION_ERROR, msg.str());
   return run_res;
 }
 
+bool Run::runCompiler(const vector<string> &args) const
+{
+  if (settings_.getInProcessCompile())
+    return Compiler::getInstance().run(args);
+  return runCommand(args);
+}
+
+int Run::runProgram(const string &path, int fd) const
+{
+  // The counters are opened before the program starts
+  PerfCounters counters;
+  function<void(pid_t)> on_start;
+  if (counters_)
+    on_start = [&](pid_t child) { counters.attach(child); };
+  pid_t pid = startProgram(path, fd, false, on_start);
+
+  // Like system(), the terminal interrupts the program only
+  struct sigaction ignore{}, old_int, old_quit;
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGINT, &ignore, &old_int);
+  sigaction(SIGQUIT, &ignore, &old_quit);
+
+  int status = 0;
+  ResourceMonitor monitor(10);
+  if (time_)
+    status = monitor.wait(pid);
+  else
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+      ;
+
+  sigaction(SIGINT, &old_int, nullptr);
+  sigaction(SIGQUIT, &old_quit, nullptr);
+
+  if (time_)
+  {
+    cout << endl;
+    monitor.table().draw();
+    monitor.drawTimeline();
+  }
+  if (counters_)
+  {
+    counters.read();
+    cout << endl;
+    counters.table().draw();
+    if (counters.hasHardware())
+      counters.metrics().draw();
+  }
+
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+pid_t Run::startProgram(const string &path, int fd, bool quiet,
+                        const function<void(pid_t)> &on_start) const
+{
+  vector<string> arg_strings{path};
+  arg_strings.insert(arg_strings.end(), args_.begin(), args_.end());
+  vector<char *> argv;
+  for (auto &a : arg_strings)
+    argv.push_back(a.data());
+  argv.push_back(nullptr);
+
+  // Built before forking, the child only making system calls
+  vector<string> env_strings = noise_.environment(arg_strings);
+  vector<char *> envp;
+  for (auto &var : env_strings)
+    envp.push_back(var.data());
+  envp.push_back(nullptr);
+
+  // The program waits for ZC to close the gate before executing
+  int gate[2] = {-1, -1};
+  if (on_start && pipe2(gate, O_CLOEXEC) < 0)
+    throw ZCError(ZC_INTERNAL_ERROR,
+                  string("Couldn't start the program: ") + strerror(errno));
+
+  cout << flush;
+  pid_t pid = fork();
+  if (pid < 0)
+    throw ZCError(ZC_INTERNAL_ERROR,
+                  string("Couldn't start the program: ") + strerror(errno));
+  if (pid == 0)
+  {
+    // The program doesn't outlive ZC
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (gate[0] >= 0)
+    {
+      char c;
+      close(gate[1]);
+      while (::read(gate[0], &c, 1) < 0 && errno == EINTR)
+        ;
+    }
+    // Caps making the runaway programs fail, e.g. in CI. The CPU limit sends
+    // SIGXCPU, then SIGKILL a second later
+    if (max_memory_ > 0)
+    {
+      struct rlimit limit{max_memory_ << 20, max_memory_ << 20};
+      setrlimit(RLIMIT_AS, &limit);
+    }
+    if (max_cpu_ > 0)
+    {
+      struct rlimit limit{max_cpu_, max_cpu_ + 1};
+      setrlimit(RLIMIT_CPU, &limit);
+    }
+    if (quiet)
+    {
+      int null_fd = open("/dev/null", O_WRONLY);
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+      if (null_fd > STDERR_FILENO)
+        close(null_fd);
+    }
+    noise_.apply();
+    if (fd >= 0)
+      fexecve(fd, argv.data(), envp.data());
+    else
+      execve(path.c_str(), argv.data(), envp.data());
+    cerr << ZCError(ZC_EXECUTION_ERROR,
+                    "Couldn't execute " + path + ": " + strerror(errno))
+         << endl;
+    _exit(127);
+  }
+
+  if (gate[0] >= 0)
+  {
+    close(gate[0]);
+    try
+    {
+      on_start(pid);
+    }
+    catch (...)
+    {
+      kill(pid, SIGKILL);
+      close(gate[1]);
+      waitpid(pid, nullptr, 0);
+      throw;
+    }
+    close(gate[1]);
+  }
+  return pid;
+}
+
+int Run::runWatch() const
+{
+  // Ctrl+C stops the program and the watch. Without SA_RESTART, it also
+  // interrupts the wait for changes
+  struct sigaction stop{}, old_int;
+  stop.sa_handler = onInterrupt;
+  sigaction(SIGINT, &stop, &old_int);
+  interrupted = 0;
+
+  fs::path work_dir =
+      fs::temp_directory_path() / ("zc-watch-" + to_string(getpid()));
+  fs::create_directories(work_dir);
+  string program_name = fs::path(files_[0].getPath_()).stem().string();
+
+  Watcher watcher;
+  map<string, vector<fs::path>> deps;
+  vector<string> last_args;
+  vector<fs::path> changed;
+  pid_t program = -1;
+  while (!interrupted)
+  {
+    // 1. Build the program again, the previous one running meanwhile
+    if (!changed.empty() && settings_.getInProcessCompile())
+      Compiler::getInstance().forgetFiles();
+    int exe_fd = memfd_create(program_name.c_str(), 0);
+    if (exe_fd < 0)
+      throw ZCError(ZC_INTERNAL_ERROR, string("Couldn't create the program: ") +
+                                           strerror(errno));
+    cout << flush;
+    if (buildWatched(work_dir, changed, deps, last_args, exe_fd))
+    {
+      // 2. Replace the running program
+      stopProgram(program);
+      if (settings_.getClearBeforeRun() && system("clear") != 0)
+        warning("Couldn't clear the terminal");
+      info("Executing program...");
+      fcntl(exe_fd, F_SETFD, FD_CLOEXEC);
+      program = startProgram(program_name, exe_fd, false, nullptr);
+    }
+    else
+      cerr << ZCError(ZC_COMPILATION_ERROR, "Compilation failed") << endl;
+    close(exe_fd);
+
+    // 3. Wait for the sources or their local headers to change
+    vector<fs::path> watched;
+    for (const auto &f : files_)
+      watched.push_back(f.getPath_());
+    for (const auto &[source, files] : deps)
+      watched.insert(watched.end(), files.begin(), files.end());
+    watcher.watch(watched);
+
+    changed.clear();
+    while (changed.empty() && !interrupted)
+    {
+      changed = watcher.wait(200, 30);
+
+      int status;
+      if (program > 0 && waitpid(program, &status, WNOHANG) == program)
+      {
+        int code = WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                       : WEXITSTATUS(status);
+        if (code == 0)
+          info("Program exited, watching for changes (Ctrl+C to stop)...");
+        else
+          warning("Program exited with code " + to_string(code) +
+                  ", watching for changes (Ctrl+C to stop)...");
+        program = -1;
+      }
+    }
+  }
+
+  stopProgram(program);
+  sigaction(SIGINT, &old_int, nullptr);
+  error_code ec;
+  fs::remove_all(work_dir, ec);
+  cout << endl;
+  info("Stopped watching.");
+  return 0;
+}
+
+int Run::runBench() const
+{
+  // 1. Build the program once, into memory
+  string program_name = fs::path(files_[0].getPath_()).stem().string();
+  int exe_fd = memfd_create(program_name.c_str(), 0);
+  if (exe_fd < 0)
+    throw ZCError(ZC_INTERNAL_ERROR, string("Couldn't create the program: ") +
+                                         strerror(errno));
+  vector<string> build_args = buildArgs("/proc/self/fd/" + to_string(exe_fd));
+
+#ifdef DEBUG_MODE
+  debug("Build command: " + buildCommand(build_args));
+#endif
+
+  cout << flush;
+  if (!runCompiler(build_args))
+  {
+    close(exe_fd);
+    throw ZCError(ZC_COMPILATION_ERROR, "Compilation failed");
+  }
+  success("Compilation successful.");
+  fcntl(exe_fd, F_SETFD, FD_CLOEXEC);
+
+  // 2. Run it, nothing being printed between the runs. The warmup runs fill
+  // the caches and are left out
+  info("Benchmarking " + program_name + ": " + to_string(warmup_) +
+       " warmup runs, " + to_string(bench_) + " timed runs...");
+  Benchmark benchmark(program_name, warmup_);
+  for (size_t i = 0; i < warmup_ + bench_; i++)
+  {
+    double wall, user, sys;
+    int run_res = timeProgram(program_name, exe_fd, wall, user, sys);
+    if (run_res != 0)
+    {
+      close(exe_fd);
+      throw ZCError(ZC_EXECUTION_ERROR,
+                    "Program exited with code " + to_string(run_res) +
+                        " on run " + to_string(i + 1));
+    }
+    if (i >= warmup_)
+      benchmark.addRun(wall, user, sys);
+  }
+  close(exe_fd);
+
+  // 3. Report the statistics and save the timings
+  benchmark.table().draw();
+  size_t outliers = benchmark.getOutliers();
+  if (outliers > 0)
+    warning(to_string(outliers) +
+            " runs are outliers, the system may be noisy: the median is "
+            "more reliable than the mean");
+
+  fs::path output = bench_output_.empty()
+                        ? fs::path(program_name + ".bench.json")
+                        : fs::path(bench_output_);
+  benchmark.save(output);
+  success("Results written to " + output.string());
+  return 0;
+}
+
+int Run::runProfile() const
+{
+  // 1. Build the program into a file, which its samples are symbolized from
+  string program_name = fs::path(files_[0].getPath_()).stem().string();
+  fs::path work_dir =
+      fs::temp_directory_path() / ("zc-profile-" + to_string(getpid()));
+  fs::create_directories(work_dir);
+  fs::path executable = work_dir / program_name;
+  fs::path samples = work_dir / "samples";
+
+  vector<string> build_args = buildArgs(executable.string());
+
+#ifdef DEBUG_MODE
+  debug("Build command: " + buildCommand(build_args));
+#endif
+
+  error_code ec;
+  cout << flush;
+  if (!runCompiler(build_args))
+  {
+    fs::remove_all(work_dir, ec);
+    throw ZCError(ZC_COMPILATION_ERROR, "Compilation failed");
+  }
+  success("Compilation successful.");
+
+  // 2. Run it with the sampler preloaded
+  info("Profiling program...");
+  int run_res;
+  Profile profile;
+  try
+  {
+    {
+      ScopedEnvironment env;
+      env.preload(getPreloadLibrary("libzcprof.so"));
+      env.set("ZC_PROF_OUTPUT", samples.string());
+      run_res = runProgram(executable.string(), -1);
+    }
+    profile = Profile::fromSamples(samples);
+  }
+  catch (...)
+  {
+    fs::remove_all(work_dir, ec);
+    throw;
+  }
+  fs::remove_all(work_dir, ec);
+
+  // 3. Write the folded stacks and the flame graph, and show the hottest
+  // functions
+  fs::path folded = program_name + ".folded";
+  fs::path svg = program_name + ".svg";
+  profile.save(folded);
+  profile.saveFlameGraph(svg, program_name);
+  cout << endl;
+  if (profile.getSamples() == 0)
+    warning("No sample was taken: the program ran too shortly");
+  else
+    profile.table(PROFILE_TOP).draw();
+  success("Profile written to " + folded.string() + " and " + svg.string());
+
+  if (run_res == 0)
+    return 0;
+  throw ZCError(ZC_EXECUTION_ERROR,
+                "Program exited with code " + to_string(run_res));
+}
+
+int Run::runHeap() const
+{
+  // 1. Build the program into a file, which its call sites are symbolized
+  // from
+  string program_name = fs::path(files_[0].getPath_()).stem().string();
+  fs::path work_dir =
+      fs::temp_directory_path() / ("zc-heap-" + to_string(getpid()));
+  fs::create_directories(work_dir);
+  fs::path executable = work_dir / program_name;
+
+  vector<string> build_args = buildArgs(executable.string());
+
+#ifdef DEBUG_MODE
+  debug("Build command: " + buildCommand(build_args));
+#endif
+
+  error_code ec;
+  cout << flush;
+  if (!runCompiler(build_args))
+  {
+    fs::remove_all(work_dir, ec);
+    throw ZCError(ZC_COMPILATION_ERROR, "Compilation failed");
+  }
+  success("Compilation successful.");
+
+  // 2. Run it with the allocator hooks preloaded
+  info("Recording heap allocations...");
+  int run_res;
+  HeapProfile heap;
+  try
+  {
+    {
+      ScopedEnvironment env;
+      env.preload(getPreloadLibrary("libzcheap.so"));
+      env.set("ZC_HEAP_OUTPUT", work_dir.string());
+      run_res = runProgram(executable.string(), -1);
+    }
+    heap = HeapProfile::load(work_dir);
+  }
+  catch (...)
+  {
+    fs::remove_all(work_dir, ec);
+    throw;
+  }
+  fs::remove_all(work_dir, ec);
+
+  // 3. Write every call site, and show the totals and the busiest sites
+  fs::path output = program_name + ".heap.json";
+  heap.save(output, program_name);
+  cout << endl;
+  heap.summary().draw();
+  if (heap.getAllocations() > 0)
+  {
+    heap.histogram().draw();
+    heap.sites(HEAP_TOP).draw();
+  }
+  success("Heap profile written to " + output.string());
+
+  if (run_res == 0)
+    return 0;
+  throw ZCError(ZC_EXECUTION_ERROR,
+                "Program exited with code " + to_string(run_res));
+}
+
+int Run::timeProgram(const string &path, int fd, double &wall, double &user,
+                     double &sys) const
+{
+  auto start = chrono::steady_clock::now();
+  pid_t pid = startProgram(path, fd, true, nullptr);
+
+  int status = 0;
+  struct rusage usage{};
+  while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR)
+    ;
+  auto end = chrono::steady_clock::now();
+
+  wall = chrono::duration<double>(end - start).count();
+  user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+  sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+bool Run::buildWatched(const fs::path &work_dir,
+                       const vector<fs::path> &changed,
+                       map<string, vector<fs::path>> &deps,
+                       vector<string> &last_args, int exe_fd) const
+{
+  // 1. The arguments are computed again, as the files may include other
+  // libraries now. The inclusions of unchanged files come from the cache
+  vector<string> cflags, ldflags;
+  getInclusions(cflags, ldflags);
+  vector<string> args = getCompileArgs(cflags);
+
+  vector<fs::path> units, unit_objects;
+  for (const auto &file : files_)
+    if (file.getLanguage_() == CPP_MODULE)
+      units.push_back(file.getPath_());
+  vector<string> module_flags;
+  try
+  {
+    if (!units.empty())
+      module_flags = ModuleBuilder(args, settings_.getInProcessCompile())
+                         .build(units, unit_objects);
+  }
+  catch (const ZCError &e)
+  {
+    cerr << e << endl;
+    return false;
+  }
+  args.insert(args.end(), module_flags.begin(), module_flags.end());
+
+  // 2. Everything is compiled again if the arguments or a module changed,
+  // otherwise only the units reading a changed file are
+  bool all = args != last_args;
+  for (const auto &f : changed)
+    if (File(f.string()).getLanguage_() == CPP_MODULE)
+      all = true;
+  last_args = args;
+
+  vector<size_t> dirty;
+  vector<fs::path> objects;
+  for (size_t i = 0; i < files_.size(); i++)
+  {
+    const File &file = files_[i];
+    if (file.getLanguage_() != C && file.getLanguage_() != CPP)
+      continue;
+    fs::path object =
+        work_dir / (to_string(i) + "_" +
+                    fs::path(file.getPath_()).filename().string() + ".o");
+    objects.push_back(object);
+    const auto &read = deps[file.getPath_()];
+    if (all || !fs::exists(object) ||
+        any_of(read.begin(), read.end(), [&](const fs::path &f)
+               { return find(changed.begin(), changed.end(), f) !=
+                        changed.end(); }))
+      dirty.push_back(i);
+  }
+
+  // 3. Compile them, in parallel unless the compiler runs in-process. Each
+  // unit gets the precompiled header of its own inclusions
+  vector<vector<string>> dirty_args;
+  for (size_t i : dirty)
+  {
+    dirty_args.push_back(args);
+    addPrecompiledHeader(dirty_args.back(), {files_[i]},
+                         settings_.getInProcessCompile());
+  }
+  size_t n_workers =
+      settings_.getInProcessCompile()
+          ? 1
+          : min<size_t>(dirty.size(), max(1u, thread::hardware_concurrency()));
+  atomic<size_t> next{0};
+  atomic<bool> ok{true};
+  vector<thread> workers;
+  for (size_t w = 0; w < n_workers; w++)
+    workers.emplace_back(
+        [&]()
+        {
+          for (size_t i = next++; i < dirty.size(); i = next++)
+          {
+            const string source = files_[dirty[i]].getPath_();
+            fs::path object =
+                work_dir / (to_string(dirty[i]) + "_" +
+                            fs::path(source).filename().string() + ".o");
+            fs::path depfile = fs::path(object).replace_extension(".d");
+            vector<string> unit_args = dirty_args[i];
+            unit_args.insert(unit_args.end(),
+                             {"-c", source, "-o", object.string(), "-MMD",
+                              "-MF", depfile.string()});
+            if (!runCompiler(unit_args))
+            {
+              error_code ec;
+              fs::remove(object, ec);
+              ok = false;
+            }
+          }
+        });
+  for (auto &w : workers)
+    w.join();
+
+  // The local files each unit read, the system headers being left out. A
+  // unit which failed keeps the files of its last build
+  for (size_t i : dirty)
+  {
+    const string source = files_[i].getPath_();
+    fs::path depfile =
+        work_dir /
+        (to_string(i) + "_" + fs::path(source).filename().string() + ".d");
+    vector<fs::path> read{fs::absolute(source).lexically_normal()};
+    for (const auto &f : readDependencies(depfile))
+      read.push_back(fs::absolute(f).lexically_normal());
+    if (read.size() > 1 || deps[source].empty())
+      deps[source] = read;
+  }
+  if (!ok)
+    return false;
+
+  // 4. Link the objects with the other inputs
+  vector<string> link_args{args[0]};
+  for (const auto &f : settings_.getFlags())
+    link_args.push_back(f);
+  link_args.insert(link_args.end(), cflags.begin(), cflags.end());
+  for (const auto &dir : getLibDirs())
+    link_args.insert(link_args.end(),
+                     {"-L" + dir.string(), "-Wl,-rpath," + dir.string()});
+  for (const auto &o : objects)
+    link_args.push_back(o.string());
+  for (const auto &o : unit_objects)
+    link_args.push_back(o.string());
+  for (const auto &file : files_)
+    if (file.getLanguage_() == OBJECT || file.getLanguage_() == ASSEMBLER ||
+        file.getLanguage_() == INSTANCE)
+      link_args.push_back(file.getPath_());
+  link_args.insert(link_args.end(),
+                   {"-o", "/proc/self/fd/" + to_string(exe_fd)});
+  link_args.insert(link_args.end(), ldflags.begin(), ldflags.end());
+
+  if (!runCompiler(link_args))
+    return false;
+  success("Compilation successful.");
+  return true;
+}
+
 Mode Run::getMode(bool preprocess, bool compile, bool assemble) const
 {
   int flags_found = 0;
@@ -157,6 +915,7 @@ bool Run::isCppAndCheckExtensions(string &badFile) const
     switch (f.getLanguage_())
     {
     case CPP:
+    case CPP_MODULE:
       found = true;
       break;
     case C:
@@ -172,58 +931,195 @@ bool Run::isCppAndCheckExtensions(string &badFile) const
   return found;
 }
 
-string Run::buildCommand(const string &output_name) const
+vector<string> Run::getCompileArgs(const vector<string> &cflags) const
 {
-  stringstream cmd;
+  vector<string> args;
   // Compiler and standard
   if (plus_)
-    cmd << settings_.getCppCompiler() << " '-std=" << settings_.getCppStd()
-        << "' ";
+    args = {settings_.getCppCompiler(), "-std=" + settings_.getCppStd()};
   else
-    cmd << settings_.getCCompiler() << " '-std=" << settings_.getCStd()
-        << "' ";
+    args = {settings_.getCCompiler(), "-std=" + settings_.getCStd()};
 
   // User flags
   for (const auto &f : settings_.getFlags())
-    cmd << escape_shell_arg(f) << " ";
+    args.push_back(f);
+
+  // Benchmarks measure the optimized program, unless the user chose the level
+  if (bench_ > 0 && !hasOptimizationLevel(settings_.getFlags()))
+    args.push_back("-O2");
+
+  // The profilers walk the stacks through the frame pointers, and symbolize
+  // them with the debug information
+  if (profile_ || heap_)
+    args.insert(args.end(), {"-g", "-fno-omit-frame-pointer"});
+
+  args.push_back("-I" + registry_.getIncludeDir().string());
 
-  cmd << "-I" << escape_shell_arg(registry_.getIncludeDir()) << " ";
-  cmd << "-L" << escape_shell_arg(registry_.getLibDir()) << " ";
+  // Compiling flags of the included libraries (e.g. -fopenmp), which matter
+  // in every mode
+  for (const auto &f : cflags)
+    args.push_back(f);
+
+  // Libraries precompiled as Clang modules at install time, which only clang
+  // can import
+  if (jit_ || settings_.getInProcessCompile() ||
+      fs::path(args[0]).filename().string().find("clang") != string::npos)
+    for (const auto &f : registry_.getModuleFlags())
+      args.push_back(f);
+
+  // Color flags
+  args.push_back("-fdiagnostics-color=always");
+  return args;
+}
+
+void Run::addPrecompiledHeader(vector<string> &args,
+                               const vector<File> &units,
+                               bool in_process) const
+{
+  // Only clang reads the precompiled headers of clang
+  if (!in_process &&
+      fs::path(args[0]).filename().string().find("clang") == string::npos)
+    return;
+
+  // The header is included before the first line of every unit, so it must be
+  // what each of them starts with
+  vector<string> headers;
+  bool first = true;
+  for (const auto &f : units)
+  {
+    if (f.getLanguage_() != C && f.getLanguage_() != CPP)
+      continue;
+    vector<string> block = f.getSystemIncludes();
+    if (!first && block != headers)
+      return;
+    headers = block;
+    first = false;
+  }
+  if (headers.empty())
+    return;
+
+  fs::path pch = PchCache().get(args, headers, plus_, in_process);
+  if (pch.empty())
+    return;
+  args.push_back("-include-pch");
+  args.push_back(pch.string());
+}
+
+vector<fs::path> Run::getLibDirs() const
+{
+  // Link the library variant matching the optimization level, then fall back
+  // on libraries installed without variants
+  vector<fs::path> lib_dirs;
+  vector<string> flags = settings_.getFlags();
+  if (bench_ > 0 && !hasOptimizationLevel(flags))
+    flags.push_back("-O2");
+  string variant = registry_.getVariant(flags);
+  if (!variant.empty())
+    lib_dirs.push_back(registry_.getLibDir(variant));
+  lib_dirs.push_back(registry_.getLibDir());
+  return lib_dirs;
+}
+
+vector<string> Run::buildArgs(const string &output_name) const
+{
+  vector<string> cflags, ldflags;
+  getInclusions(cflags, ldflags);
+  vector<string> args = getCompileArgs(cflags);
+
+  // The C++20 module interface units are built first, into BMIs which the
+  // other units import and objects linked with them
+  vector<fs::path> units, unit_objects;
+  for (const auto &file : files_)
+    if (file.getLanguage_() == CPP_MODULE)
+      units.push_back(file.getPath_());
+  vector<string> module_flags;
+  if (!units.empty() && mode_ != PREPROCESS)
+    module_flags = ModuleBuilder(args, settings_.getInProcessCompile())
+                       .build(units, unit_objects);
+
+  if (mode_ != PREPROCESS)
+    addPrecompiledHeader(args, files_, settings_.getInProcessCompile());
+  args.insert(args.end(), module_flags.begin(), module_flags.end());
+
+  vector<fs::path> lib_dirs = getLibDirs();
+  for (const auto &dir : lib_dirs)
+    args.push_back("-L" + dir.string());
 
   // On build mode : use map header -> lib provided by the registry
 
   if (mode_ == FULL)
-    cmd << "-Wl,-rpath," << escape_shell_arg(registry_.getLibDir()) << " ";
+    for (const auto &dir : lib_dirs)
+      args.push_back("-Wl,-rpath," + dir.string());
 
-  // Source files
+  // Source files, the module interface units being linked from their objects
+  size_t unit = 0;
   for (const auto &file : files_)
-    cmd << file << " ";
+    if (file.getLanguage_() != CPP_MODULE)
+      args.push_back(file.getPath_());
+    else if (mode_ == FULL)
+      args.push_back(unit_objects[unit++].string());
+    else
+      args.insert(args.end(),
+                  {"-x", "c++-module", file.getPath_(), "-x", "none"});
 
   // Output
-  cmd << "-o " << escape_shell_arg(output_name) << " ";
+  args.push_back("-o");
+  args.push_back(output_name);
 
   // Mode and libraries for normal mode
   switch (mode_)
   {
   case PREPROCESS:
-    cmd << "-E ";
+    args.push_back("-E");
     break;
   case COMPILE:
-    cmd << "-S ";
+    args.push_back("-S");
     break;
   case ASSEMBLE:
-    cmd << "-c ";
+    args.push_back("-c");
     break;
   default:
-    const vector<string> includes = getInclusions();
-    for (const auto &include : includes)
-      cmd << escape_shell_arg(include) << " ";
+    for (const auto &f : ldflags)
+      args.push_back(f);
     break;
   }
+  return args;
+}
 
-  // Color flags
-  cmd << "-fdiagnostics-color=always";
-  return cmd.str();
+int Run::runJit() const
+{
+  // 1. Compile the sources to LLVM IR, or take it from the cache
+  vector<string> cflags, ldflags;
+  getInclusions(cflags, ldflags);
+
+  vector<string> compile_args = getCompileArgs(cflags);
+  addPrecompiledHeader(compile_args, files_, true);
+
+  cout << flush;
+  Jit jit(compile_args);
+  jit.loadLibraries(ldflags, getLibDirs());
+  for (const auto &f : files_)
+    jit.addFile(f.getPath_());
+
+  success("Compilation successful.");
+
+  // 2. Run main in this process
+  if (settings_.getClearBeforeRun())
+  {
+    int clear_res = system("clear");
+    if (clear_res != 0)
+      throw ZCError(ZC_INTERNAL_ERROR, "Unexpected terminal clearing error");
+  }
+
+  info("Executing program...");
+  string name = fs::path(files_[0].getPath_()).stem().string();
+  int run_res = jit.run(name, args_);
+  if (run_res == 0)
+    return 0;
+
+  stringstream msg;
+  msg << "Program exited with code " << run_res;
+  throw ZCError(ZC_EXECUTION_ERROR, msg.str());
 }
 
 bool Run::filesExist(string &badFile) const
@@ -239,16 +1135,15 @@ bool Run::filesExist(string &badFile) const
   return true;
 }
 
-vector<string> Run::getInclusions() const
+void Run::getInclusions(vector<string> &cflags, vector<string> &ldflags) const
 {
-  vector<string> flags;
-
   for (const auto &f : files_)
   {
-    vector<string> includes = f.getInclusions(registry_);
-    for (const auto &include : includes)
-      if (find(flags.begin(), flags.end(), include) == flags.end())
-        flags.push_back(include);
+    vector<string> file_cflags, file_ldflags;
+    f.getInclusions(registry_, file_cflags, file_ldflags);
+    mergeFlags(cflags, file_cflags, false);
+    // Keep the last occurrence, so that libraries stay before their
+    // dependencies
+    mergeFlags(ldflags, file_ldflags, true);
   }
-  return flags;
 }
@@ -1,15 +1,59 @@
+#include <algorithm>
 #include <cctype>
+#include <cstdio>
 #include <cstdlib>
 #include <filesystem>
+#include <fstream>
 #include <helpers.hh>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <llvm/Config/llvm-config.h>
+
 #include <objects/ZCError.hh>
 
 using namespace std;
 namespace fs = std::filesystem;
 
+namespace
+{
+
+/**
+ * @brief Check whether a flag takes its operand as the next argument
+ */
+bool takesOperand(const string &flag)
+{
+  static const vector<string> flags{
+      "-framework", "-weak_framework", "-Xlinker", "-Xpreprocessor",
+      "-Xassembler", "-Xclang", "-include", "-imacros", "-isystem",
+      "-idirafter", "-iquote", "-iprefix", "-isysroot", "-I", "-L", "-l",
+      "-D", "-U", "-u", "-x", "-z", "-T", "-rpath"};
+  return find(flags.begin(), flags.end(), flag) != flags.end();
+}
+
+/**
+ * @brief Split flags into groups: a flag, with its operand if it takes one
+ */
+vector<vector<string>> groupFlags(const vector<string> &flags)
+{
+  vector<vector<string>> groups;
+  for (size_t i = 0; i < flags.size(); i++)
+  {
+    if (flags[i].empty())
+      continue;
+    groups.push_back({flags[i]});
+    if (takesOperand(flags[i]) && i + 1 < flags.size())
+      groups.back().push_back(flags[++i]);
+  }
+  return groups;
+}
+
+} // namespace
+
 fs::path getZCRootDir()
 {
 #if defined(_WIN32) || defined(_WIN64)
@@ -66,6 +110,19 @@ vector<string> split(const string &s, char delimiter)
   return tokens;
 }
 
+bool captureOutput(const string &cmd, string &output)
+{
+  output.clear();
+  FILE *pipe = popen(cmd.c_str(), "r");
+  if (!pipe)
+    return false;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+    output.append(buffer, n);
+  return pclose(pipe) == 0;
+}
+
 std::string upper(const std::string &s)
 {
   stringstream output;
@@ -93,3 +150,151 @@ fs::path getProjectRoot()
   throw ZCError(ZC_NOT_A_ZC_PROJECT,
                 "This directory is not inside a ZC project");
 }
+
+string compilerId(const string &compiler)
+{
+  fs::path path = compiler;
+  if (compiler.find('/') == string::npos)
+    if (const char *env = getenv("PATH"))
+      for (const auto &dir : split(env, ':'))
+        if (access((fs::path(dir) / compiler).c_str(), X_OK) == 0)
+        {
+          path = fs::path(dir) / compiler;
+          break;
+        }
+
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return compiler;
+  return path.string() + ":" + to_string(st.st_size) + ":" +
+         to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec);
+}
+
+vector<string> readDependencies(const fs::path &deps)
+{
+  ifstream input(deps);
+  stringstream content;
+  content << input.rdbuf();
+
+  vector<string> files;
+  string text = content.str();
+  size_t start = text.find(": ");
+  if (start == string::npos)
+    return files;
+
+  string file;
+  for (size_t i = start + 2; i <= text.size(); i++)
+  {
+    char c = i < text.size() ? text[i] : ' ';
+    // Escaped spaces belong to the file name, escaped newlines separate
+    if (c == '\\' && i + 1 < text.size())
+    {
+      if (text[i + 1] == ' ')
+        file += ' ';
+      i++;
+    }
+    else if (isspace(c))
+    {
+      if (!file.empty())
+        files.push_back(file);
+      file.clear();
+    }
+    else
+      file += c;
+  }
+  return files;
+}
+
+fs::path getPreloadLibrary(const string &name)
+{
+  error_code ec;
+  vector<fs::path> dirs{fs::read_symlink("/proc/self/exe", ec).parent_path()};
+#ifdef ZC_PRELOAD_DIR
+  dirs.push_back(ZC_PRELOAD_DIR);
+#endif
+  for (const auto &dir : dirs)
+    if (!dir.empty() && fs::exists(dir / name, ec))
+      return dir / name;
+  throw ZCError(ZC_NOT_FOUND, "ZC library not found: " + name +
+                                  " (reinstall ZC to get it)");
+}
+
+void mergeFlags(vector<string> &flags, const vector<string> &added,
+                bool keep_last)
+{
+  vector<vector<string>> groups = groupFlags(flags);
+  for (const auto &group : groupFlags(added))
+  {
+    auto it = find(groups.begin(), groups.end(), group);
+    if (it != groups.end() && !keep_last)
+      continue;
+    if (it != groups.end())
+      groups.erase(it);
+    groups.push_back(group);
+  }
+
+  flags.clear();
+  for (const auto &group : groups)
+    flags.insert(flags.end(), group.begin(), group.end());
+}
+
+string buildCommand(const vector<string> &args)
+{
+  stringstream cmd;
+  cmd << args[0];
+  for (size_t i = 1; i < args.size(); i++)
+    cmd << " " << escape_shell_arg(args[i]);
+  return cmd.str();
+}
+
+bool runCommand(const vector<string> &args, bool quiet)
+{
+  string cmd = buildCommand(args);
+  if (quiet)
+    cmd += " > /dev/null 2>&1";
+  return system(cmd.c_str()) == 0;
+}
+
+string toolchainId(const string &compiler, bool in_process)
+{
+  if (in_process)
+    return string("in-process:") + LLVM_VERSION_STRING;
+  return compilerId(compiler);
+}
+
+fs::path tempPath(const fs::path &path)
+{
+  fs::path tmp = path;
+  tmp += ".tmp" + to_string(getpid()) + "_" +
+         to_string(hash<thread::id>{}(this_thread::get_id()));
+  return tmp;
+}
+
+bool moveIntoPlace(const fs::path &tmp, const fs::path &path)
+{
+  error_code ec;
+  fs::rename(tmp, path, ec);
+  if (ec)
+    fs::remove(tmp, ec);
+  return !ec;
+}
+
+bool writeAtomically(const fs::path &path, const string &data)
+{
+  error_code ec;
+  fs::create_directories(path.parent_path(), ec);
+  fs::path tmp = tempPath(path);
+  {
+    ofstream output(tmp, ios::binary);
+    if (!output.is_open())
+      return false;
+    output.write(data.data(), data.size());
+    if (!output.good())
+    {
+      output.close();
+      fs::remove(tmp, ec);
+      return false;
+    }
+  }
+  return moveIntoPlace(tmp, path);
+}
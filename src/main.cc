@@ -7,18 +7,34 @@
 
 #include <commands/Build.hh>
 #include <commands/Command.hh>
+#include <commands/Compare.hh>
+#include <commands/Daemon.hh>
 #include <commands/Init.hh>
 #include <commands/Lib/Create.hh>
+#include <commands/Lib/Gc.hh>
+#include <commands/Lib/Import.hh>
+#include <commands/Lib/Install.hh>
 #include <commands/Lib/List.hh>
+#include <commands/Lib/Pack.hh>
 #include <commands/Lib/Remove.hh>
+#include <commands/Lib/Search.hh>
+#include <commands/Lib/Serve.hh>
+#include <commands/Lib/Upload.hh>
 #include <commands/Project.hh>
 #include <commands/Run.hh>
+#include <objects/DaemonServer.hh>
 #include <objects/ZCError.hh>
 #include <zcio.hh>
 
 using namespace std;
 
-int main(int argc, char *argv[])
+namespace
+{
+
+/**
+ * @brief Parse the arguments and run the command in this process
+ */
+int runZC(int argc, char *argv[])
 {
   // Initialize CLI11 App
   CLI::App app{"ZC, a C utility to perform all actions on C and C++ files"};
@@ -37,19 +53,40 @@ int main(int argc, char *argv[])
   vector<string> input_files;
 
   // ========================= RUN
-  bool run_keep = false, run_plus = false;
-  bool run_c = false, run_S = false, run_E = false;
+  RunOptions run_options;
 
-  vector<string> run_args;
+  // ========================= COMPARE
+  string baseline, candidate;
 
   // ========================= LIB LIST
   bool display_std = false;
+  size_t list_page = 0, list_per_page = 50, list_max_width = 0;
 
   // ========================= LIB CREATE
   string pkg_name;
+  vector<string> isa_levels;
+  vector<string> dependencies;
 
-  // ========================= LIB REMOVE
+  // ========================= LIB REMOVE / INSTALL / UPLOAD
   vector<string> pkgs;
+  string server;
+
+  // ========================= LIB INSTALL
+  bool no_static = false;
+
+  // ========================= LIB IMPORT
+  bool import_all = false;
+
+  // ========================= LIB SEARCH
+  vector<string> search_query;
+  size_t search_limit = 20;
+  bool search_rebuild = false;
+
+  // ========================= LIB PACK
+  string output_dir;
+
+  // ========================= LIB SERVE
+  string store, socket_path;
 
   // ========================= INIT
   vector<string> new_files;
@@ -61,7 +98,10 @@ int main(int argc, char *argv[])
   bool git;
 
   //  ========================= BUILD
-  bool release_mode = false;
+  bool release_mode = false, build_watch = false;
+
+  //  ========================= DAEMON
+  bool daemon_detach = false, daemon_stop = false, daemon_status = false;
 
   /* ========================================================= *
    *                         SUBCOMMANDS                       *
@@ -73,21 +113,42 @@ int main(int argc, char *argv[])
   auto init    = app.add_subcommand("init", "Initialize file(s) with a template");
   auto project = app.add_subcommand("project", "Initiliaze a new C/C++ project");
   auto build   = app.add_subcommand("build", "Build ZC project using Cmake");
+  auto daemon  = app.add_subcommand("daemon", "Keep ZC loaded to run the next commands faster");
+  auto compare = app.add_subcommand("compare", "Compare the results of two benchmarks or profiles");
 
   /*
    * ========================== RUN ===============================
    */
 
-  run->add_option("files", input_files, "The files to be compiled (and executed)")->required();
-  run->add_option("--args,-a", run_args, "Arguments to be passed to the program when executing");
+  run->add_option("files", run_options.files_, "The files to be compiled (and executed)")->required();
+  run->add_option("--args,-a", run_options.args_, "Arguments to be passed to the program when executing");
+
+  run->add_flag("--keep,-k", run_options.keep_, "Do not delete the executable after program ends");
+  run->add_flag("--plus,-p", run_options.plus_, "Force compilation as C++");
+  run->add_flag("-E", run_options.preprocess_, "Preprocess only");
+  run->add_flag("-S", run_options.compile_, "Compile, but do not assemble or link");
+  run->add_flag("-c", run_options.assemble_, "Compile and assemble, but do not link");
+  run->add_flag("--jit,-j", run_options.jit_, "Run the program through the JIT, without building an executable");
+  run->add_flag("--watch,-w", run_options.watch_, "Build and run the program again whenever one of its files changes");
+
+  run->add_option("--bench", run_options.bench_, "Build an optimized program and time this many runs of it");
+  run->add_option("--warmup", run_options.warmup_, "The number of untimed runs before the benchmark");
+  run->add_option("--bench-output", run_options.bench_output_, "The JSON file of the benchmark results (default: <program>.bench.json)");
+
+  run->add_option("--cpus", run_options.cpus_, "Pin the program to these CPUs (e.g. 2,3)")->delimiter(',');
+  run->add_flag("--low-noise", run_options.low_noise_, "Run the program without ASLR and with a normalized environment");
+  run->add_flag("--priority", run_options.priority_, "Raise the scheduling priority of the program (needs CAP_SYS_NICE)");
 
-  run->add_flag("--keep,-k", run_keep, "Do not delete the executable after program ends");
-  run->add_flag("--plus,-p", run_plus, "Force compilation as C++");
-  run->add_flag("-E", run_E, "Preprocess only");
-  run->add_flag("-S", run_S, "Compile, but do not assemble or link");
-  run->add_flag("-c", run_c, "Compile and assemble, but do not link");
+  run->add_flag("--time", run_options.time_, "Report the time, memory and I/O used by the program");
+  run->add_option("--max-memory", run_options.max_memory_, "Limit the address space of the program, in MiB");
+  run->add_option("--max-cpu", run_options.max_cpu_, "Limit the CPU time of the program, in seconds");
 
-  run->callback([&]() { command = make_unique<Run>(input_files, run_args, run_keep, run_plus, run_E, run_S, run_c); });
+  run->add_flag("--counters", run_options.counters_, "Report the hardware performance counters of the program (IPC, cache and branch misses)");
+
+  run->add_flag("--profile", run_options.profile_, "Sample the stacks of the program, and write its folded stacks and flame graph");
+  run->add_flag("--heap", run_options.heap_, "Record the heap allocations of the program, and write their call sites and lifetimes");
+
+  run->callback([&]() { command = make_unique<Run>(run_options); });
 
 
   /*
@@ -123,8 +184,30 @@ int main(int argc, char *argv[])
 
   build->add_flag("--force,-f", force, "Force regenerating CMakeLists.txt");
   build->add_flag("--release,-r", release_mode, "Compile as release mode");
+  build->add_flag("--watch,-w", build_watch, "Build again whenever a file of the project changes");
 
-  build->callback([&]() { command = make_unique<Build>(force, release_mode); });
+  build->callback([&]() { command = make_unique<Build>(force, release_mode, build_watch); });
+
+
+  /*
+   * ========================== DAEMON ===============================
+   */
+
+  daemon->add_flag("--detach,-d", daemon_detach, "Run the daemon in the background");
+  daemon->add_flag("--stop", daemon_stop, "Stop the running daemon");
+  daemon->add_flag("--status", daemon_status, "Tell whether a daemon is running");
+
+  daemon->callback([&]() { command = make_unique<Daemon>(daemon_detach, daemon_stop, daemon_status, runZC); });
+
+
+  /*
+   * ========================== COMPARE ===============================
+   */
+
+  compare->add_option("baseline", baseline, "The reference benchmark (.json) or profile (.folded)")->required();
+  compare->add_option("candidate", candidate, "The benchmark or profile compared to it")->required();
+
+  compare->callback([&]() { command = make_unique<Compare>(baseline, candidate); });
 
 
   /*
@@ -136,21 +219,36 @@ int main(int argc, char *argv[])
   auto lib_list   = lib->add_subcommand("list", "List all installed libraries");
   auto lib_create = lib->add_subcommand("create", "Create a library and install it on the system");
   auto lib_remove = lib->add_subcommand("remove", "Remove an installed library");
+  auto lib_install = lib->add_subcommand("install", "Install libraries from a package store");
+  auto lib_upload = lib->add_subcommand("upload", "Upload installed libraries to a package store");
+  auto lib_serve  = lib->add_subcommand("serve", "Serve a package store over a Unix socket");
+  auto lib_pack   = lib->add_subcommand("pack", "Pack installed libraries into .zcpkg bundles");
+  auto lib_gc     = lib->add_subcommand("gc", "Reclaim the header blobs not used by any library");
+  auto lib_import = lib->add_subcommand("import", "Import system libraries from pkg-config");
+  auto lib_search = lib->add_subcommand("search", "Search libraries by name, author, header or function");
 
   // ========================== LIB LIST ===============================
 
   lib_list->add_flag("--std,-s", display_std, "Also display standard libraries");
 
-  lib_list->callback([&]() { command = make_unique<List>(display_std); });
+  lib_list->add_option("--page,-p", list_page, "Only display the given page of libraries");
+  lib_list->add_option("--per-page", list_per_page, "The number of libraries per page")->check(CLI::PositiveNumber);
+  lib_list->add_option("--max-width,-w", list_max_width, "Truncate the cells wider than this width");
+
+  lib_list->callback([&]() { command = make_unique<List>(display_std, list_page, list_per_page, list_max_width); });
 
   // ========================== LIB CREATE ===============================
 
   lib_create->add_option("library_name", pkg_name, "The name of the future library")->required();
   lib_create->add_option("files", input_files, "The headers / binaries of the future library")->required();
 
+  lib_create->add_option("--isa", isa_levels, "ISA levels to compile the sources for, picked at load time (e.g. x86-64-v2,x86-64-v3,x86-64-v4)")->delimiter(',');
+
+  lib_create->add_option("--deps,-d", dependencies, "The libraries this library depends on")->delimiter(',');
+
   lib_create->add_flag("--force,-f", force, "Force installation even if the library already exists");
 
-  lib_create->callback([&]() { command = make_unique<Create>(pkg_name, input_files, force); });
+  lib_create->callback([&]() { command = make_unique<Create>(pkg_name, input_files, force, isa_levels, dependencies); });
 
   // ========================== LIB REMOVE ===============================
 
@@ -158,6 +256,57 @@ int main(int argc, char *argv[])
 
   lib_remove->callback([&]() { command = make_unique<Remove>(pkgs); });
 
+  // ========================== LIB INSTALL ===============================
+
+  lib_install->add_option("targets", pkgs, "The packages (or .zcpkg bundles) to be installed")->required();
+  lib_install->add_option("--server,-s", server, "The package store: a directory or unix:<socket>");
+
+  lib_install->add_flag("--no-static", no_static, "Do not extract the static libraries of bundles");
+
+  lib_install->callback([&]() { command = make_unique<Install>(pkgs, server, !no_static); });
+
+  // ========================== LIB UPLOAD ===============================
+
+  lib_upload->add_option("targets", pkgs, "The packages to be uploaded")->required();
+  lib_upload->add_option("--server,-s", server, "The package store: a directory or unix:<socket>");
+
+  lib_upload->callback([&]() { command = make_unique<Upload>(pkgs, server); });
+
+  // ========================== LIB SERVE ===============================
+
+  lib_serve->add_option("socket", socket_path, "The path of the socket to listen on")->required();
+  lib_serve->add_option("--store", store, "The directory of the store to be served");
+
+  lib_serve->callback([&]() { command = make_unique<Serve>(store, socket_path); });
+
+  // ========================== LIB PACK ===============================
+
+  lib_pack->add_option("targets", pkgs, "The packages to be packed")->required();
+  lib_pack->add_option("--output,-o", output_dir, "The directory of the bundles");
+
+  lib_pack->callback([&]() { command = make_unique<Pack>(pkgs, output_dir); });
+
+  // ========================== LIB GC ===============================
+
+  lib_gc->callback([&]() { command = make_unique<Gc>(); });
+
+  // ========================== LIB IMPORT ===============================
+
+  lib_import->add_option("modules", pkgs, "The pkg-config modules to be imported");
+
+  lib_import->add_flag("--all,-a", import_all, "Import every module known by pkg-config");
+
+  lib_import->callback([&]() { command = make_unique<Import>(pkgs, import_all); });
+
+  // ========================== LIB SEARCH ===============================
+
+  lib_search->add_option("query", search_query, "The words to look for")->required();
+  lib_search->add_option("--limit,-n", search_limit, "The maximum number of results (0 for all of them)");
+
+  lib_search->add_flag("--rebuild", search_rebuild, "Rebuild the search index first");
+
+  lib_search->callback([&]() { command = make_unique<Search>(search_query, search_limit, search_rebuild); });
+
 
   /* ========================================================= *
    *                          PARSING                          *
@@ -185,3 +334,14 @@ int main(int argc, char *argv[])
     return -1;
   }
 }
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  // A running daemon has everything loaded already
+  int exit_code;
+  if (DaemonServer::forward(argc, argv, exit_code))
+    return exit_code;
+  return runZC(argc, argv);
+}
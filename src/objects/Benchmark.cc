@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+
+#include <objects/Benchmark.hh>
+#include <objects/ZCError.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+const vector<string> TIMES{"wall", "user", "sys"};
+
+/**
+ * @brief Get a percentile of sorted samples, interpolating between the two
+ * closest ones
+ */
+double percentile(const vector<double> &sorted, double q)
+{
+  double h = (sorted.size() - 1) * q;
+  size_t low = floor(h);
+  if (low + 1 >= sorted.size())
+    return sorted.back();
+  return sorted[low] + (h - low) * (sorted[low + 1] - sorted[low]);
+}
+
+/**
+ * @brief Regularized incomplete beta function I_x(a, b), evaluated with its
+ * continued fraction (modified Lentz's method)
+ */
+double incompleteBeta(double a, double b, double x)
+{
+  if (x <= 0)
+    return 0;
+  if (x >= 1)
+    return 1;
+  // The continued fraction converges quickly below this point only
+  if (x > (a + 1) / (a + b + 2))
+    return 1 - incompleteBeta(b, a, 1 - x);
+
+  const double tiny = 1e-300;
+  double front =
+      exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log1p(-x)) /
+      a;
+  double f = 1, c = 1, d = 0;
+  for (int i = 0; i <= 300; i++)
+  {
+    int m = i / 2;
+    double numerator;
+    if (i == 0)
+      numerator = 1;
+    else if (i % 2 == 0)
+      numerator = (m * (b - m) * x) / ((a + 2 * m - 1) * (a + 2 * m));
+    else
+      numerator =
+          -((a + m) * (a + b + m) * x) / ((a + 2 * m) * (a + 2 * m + 1));
+
+    d = 1 + numerator * d;
+    d = fabs(d) < tiny ? tiny : d;
+    d = 1 / d;
+    c = 1 + numerator / c;
+    c = fabs(c) < tiny ? tiny : c;
+    f *= c * d;
+    if (fabs(1 - c * d) < 1e-12)
+      break;
+  }
+  return front * (f - 1);
+}
+
+/**
+ * @brief Two-sided p-value of Student's t distribution
+ */
+double tPValue(double t, double df)
+{
+  return incompleteBeta(df / 2, 0.5, df / (df + t * t));
+}
+
+/**
+ * @brief Get the value of Student's t distribution leaving 2.5% on each side
+ */
+double tCritical(double df)
+{
+  double low = 0, high = 1000;
+  for (int i = 0; i < 100; i++)
+  {
+    double mid = (low + high) / 2;
+    if (tPValue(mid, df) > 0.05)
+      low = mid;
+    else
+      high = mid;
+  }
+  return (low + high) / 2;
+}
+
+/**
+ * @brief Write a time with the unit which suits it
+ */
+string formatTime(double seconds)
+{
+  char buffer[32];
+  if (fabs(seconds) < 1e-3)
+    snprintf(buffer, sizeof(buffer), "%.1f µs", seconds * 1e6);
+  else if (fabs(seconds) < 1)
+    snprintf(buffer, sizeof(buffer), "%.2f ms", seconds * 1e3);
+  else
+    snprintf(buffer, sizeof(buffer), "%.3f s", seconds);
+  return buffer;
+}
+
+} // namespace
+
+// ----------------------------------------------- Summary
+
+void to_json(json &j, const Summary &s)
+{
+  j = json{{"min", s.min_},         {"median", s.median_},
+           {"mean", s.mean_},       {"stddev", s.stddev_},
+           {"p90", s.p90_},         {"p99", s.p99_},
+           {"ci95", {s.ci_low_, s.ci_high_}},
+           {"outliers", s.outliers_}};
+}
+
+// ----------------------------------------------- Benchmark class
+
+Benchmark::Benchmark(const string &program, size_t warmup)
+    : program_(program), warmup_(warmup)
+{
+  for (const auto &t : TIMES)
+    samples_[t] = {};
+}
+
+void Benchmark::addRun(double wall, double user, double sys)
+{
+  samples_["wall"].push_back(wall);
+  samples_["user"].push_back(user);
+  samples_["sys"].push_back(sys);
+}
+
+Summary Benchmark::summarize(const vector<double> &samples)
+{
+  Summary s;
+  if (samples.empty())
+    return s;
+  vector<double> sorted = samples;
+  sort(sorted.begin(), sorted.end());
+  size_t n = sorted.size();
+
+  s.min_ = sorted.front();
+  s.median_ = percentile(sorted, 0.5);
+  s.p90_ = percentile(sorted, 0.9);
+  s.p99_ = percentile(sorted, 0.99);
+  s.mean_ = accumulate(sorted.begin(), sorted.end(), 0.0) / n;
+
+  double squares = 0;
+  for (double x : sorted)
+    squares += (x - s.mean_) * (x - s.mean_);
+  s.stddev_ = n > 1 ? sqrt(squares / (n - 1)) : 0;
+
+  double margin = n > 1 ? tCritical(n - 1) * s.stddev_ / sqrt(n) : 0;
+  s.ci_low_ = s.mean_ - margin;
+  s.ci_high_ = s.mean_ + margin;
+
+  double q1 = percentile(sorted, 0.25), q3 = percentile(sorted, 0.75);
+  double fence = 1.5 * (q3 - q1);
+  s.outliers_ = count_if(sorted.begin(), sorted.end(), [&](double x)
+                         { return x < q1 - fence || x > q3 + fence; });
+  return s;
+}
+
+Table Benchmark::table() const
+{
+  vector<vector<string>> content{{"Time", "Min", "Median", "Mean ± σ", "p90",
+                                  "p99", "95% CI of the mean", "Outliers"}};
+  for (const auto &t : TIMES)
+  {
+    Summary s = summarize(samples_.at(t));
+    content.push_back({t, formatTime(s.min_), formatTime(s.median_),
+                       formatTime(s.mean_) + " ± " + formatTime(s.stddev_),
+                       formatTime(s.p90_), formatTime(s.p99_),
+                       formatTime(s.ci_low_) + " – " + formatTime(s.ci_high_),
+                       to_string(s.outliers_)});
+  }
+  return Table(content.size(), content[0].size(), true, true, content);
+}
+
+size_t Benchmark::getOutliers() const
+{
+  size_t outliers = 0;
+  for (const auto &t : TIMES)
+    outliers = max(outliers, summarize(samples_.at(t)).outliers_);
+  return outliers;
+}
+
+void Benchmark::save(const fs::path &file) const
+{
+  json j{{"program", program_},
+         {"warmup", warmup_},
+         {"runs", samples_.at("wall").size()},
+         {"samples", samples_},
+         {"summary", json::object()}};
+  for (const auto &t : TIMES)
+    j["summary"][t] = summarize(samples_.at(t));
+
+  ofstream output(file);
+  if (!output.is_open())
+    throw ZCError(ZC_WRITING_ERROR,
+                  "The results couldn't be written: " + file.string());
+  output << j.dump(2) << endl;
+}
+
+Benchmark Benchmark::load(const fs::path &file)
+{
+  ifstream input(file);
+  if (!input.is_open())
+    throw ZCError(ZC_NOT_FOUND, "File not found: " + file.string());
+  try
+  {
+    json j = json::parse(input);
+    Benchmark b(j.value("program", ""), j.value<size_t>("warmup", 0));
+    for (const auto &t : TIMES)
+      b.samples_[t] = j.at("samples").at(t).get<vector<double>>();
+    if (b.samples_["wall"].empty())
+      throw ZCError(ZC_PARSING_ERROR, "No run in " + file.string());
+    return b;
+  }
+  catch (const json::exception &e)
+  {
+    throw ZCError(ZC_PARSING_ERROR, "The results couldn't be parsed: " +
+                                        file.string() + ": " + e.what());
+  }
+}
+
+Table Benchmark::compare(const Benchmark &baseline,
+                         const Benchmark &candidate,
+                         map<string, double> &p_value)
+{
+  vector<vector<string>> content{
+      {"Time", "Baseline", "Candidate", "Difference", "p-value"}};
+  for (const auto &t : TIMES)
+  {
+    const vector<double> &a = baseline.samples_.at(t);
+    const vector<double> &b = candidate.samples_.at(t);
+    Summary sa = summarize(a), sb = summarize(b);
+
+    // Welch's t-test: the variances of the two runs may differ
+    double va = sa.stddev_ * sa.stddev_ / a.size();
+    double vb = sb.stddev_ * sb.stddev_ / b.size();
+    double p = 1;
+    if (va + vb > 0 && a.size() > 1 && b.size() > 1)
+    {
+      double t_stat = (sb.mean_ - sa.mean_) / sqrt(va + vb);
+      double df = (va + vb) * (va + vb) /
+                  (va * va / (a.size() - 1) + vb * vb / (b.size() - 1));
+      p = tPValue(t_stat, df);
+    }
+    else if (sa.mean_ != sb.mean_)
+      p = 0;
+    p_value[t] = p;
+
+    char diff[32], p_text[32];
+    snprintf(diff, sizeof(diff), "%+.2f %%",
+             sa.mean_ != 0 ? (sb.mean_ - sa.mean_) / sa.mean_ * 100 : 0.0);
+    snprintf(p_text, sizeof(p_text), "%.4f", p);
+    content.push_back({t,
+                       formatTime(sa.mean_) + " ± " + formatTime(sa.stddev_),
+                       formatTime(sb.mean_) + " ± " + formatTime(sb.stddev_),
+                       diff, p_text});
+  }
+  return Table(content.size(), content[0].size(), true, true, content);
+}
+
+const vector<double> &Benchmark::getSamples(const string &time) const
+{
+  return samples_.at(time);
+}
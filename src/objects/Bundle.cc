@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <hash.hh>
+#include <nlohmann/json.hpp>
+#include <objects/Bundle.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// The table of contents is mapped as is
+static_assert(endian::native == endian::little,
+              "Bundles are only supported on little-endian systems");
+static_assert(sizeof(BundleHeader) == 32 && sizeof(BundleEntry) == 104);
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Compression level of the members: bundles are packed once and extracted
+// many times
+const int COMPRESSION_LEVEL = 9;
+
+// Deflate expands data by 1032 times at most: a larger size in the table of
+// contents is a lie, which mustn't make us allocate that much
+const uint64_t MAX_DEFLATE_RATIO = 1032;
+
+struct Member
+{
+  string name;
+  fs::path source; // Empty for the manifest
+  string data;     // The manifest, then the compressed content
+  BundleEntry entry{};
+};
+
+MemberKind memberKind(const string &name)
+{
+  if (name == BUNDLE_MANIFEST)
+    return MEMBER_MANIFEST;
+  fs::path path(name);
+  if (*path.begin() == "include")
+    return MEMBER_HEADER;
+  string ext = path.extension().string();
+  if (ext == ".a")
+    return MEMBER_STATIC_LIB;
+  if (ext == ".so" || ext == ".dylib" || ext == ".dll")
+    return MEMBER_SHARED_LIB;
+  return MEMBER_OTHER;
+}
+
+/**
+ * @brief Read a member's file and compress it into the member
+ */
+void compressMember(Member &m)
+{
+  string content = m.data;
+  if (!m.source.empty())
+  {
+    ifstream input(m.source, ios::binary);
+    if (!input.is_open())
+      throw runtime_error("file not found: " + m.source.string());
+    content.assign(istreambuf_iterator<char>(input),
+                   istreambuf_iterator<char>());
+    // Only the executable bit is kept, the rest depends on the umask
+    bool exec = (fs::status(m.source).permissions() & fs::perms::owner_exec) !=
+                fs::perms::none;
+    m.entry.mode = exec ? 0755 : 0644;
+  }
+  else
+    m.entry.mode = 0644;
+
+  uLongf size = compressBound(content.size());
+  m.data.resize(size);
+  if (compress2((Bytef *)m.data.data(), &size, (const Bytef *)content.data(),
+                content.size(), COMPRESSION_LEVEL) != Z_OK)
+    throw runtime_error("couldn't compress " + m.name);
+  m.data.resize(size);
+
+  m.entry.size = content.size();
+  m.entry.compressed_size = size;
+  m.entry.kind = memberKind(m.name);
+  string hash = sha256(content);
+  memcpy(m.entry.hash, hash.data(), sizeof(m.entry.hash));
+}
+
+} // namespace
+
+// ----------------------------------------------- Bundle class
+
+Bundle::Bundle(const fs::path &path) : path_(path)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw ZCError(ZC_NOT_FOUND, "Bundle not found: " + path.string());
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(BundleHeader))
+  {
+    size_ = st.st_size;
+    void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+      map_ = (const unsigned char *)map;
+  }
+  close(fd);
+  if (!map_)
+    throw ZCError(ZC_PARSING_ERROR, "Invalid bundle: " + path.string());
+
+  // Check that the whole table of contents lies within the file
+  header_ = (const BundleHeader *)map_;
+  uint64_t toc_end = sizeof(BundleHeader) +
+                     (uint64_t)header_->count * sizeof(BundleEntry) +
+                     header_->names_size;
+  if (memcmp(header_->magic, BUNDLE_MAGIC, sizeof(header_->magic)) != 0 ||
+      header_->version != BUNDLE_VERSION || header_->count > size_ ||
+      toc_end > header_->data_offset || header_->data_offset > size_)
+  {
+    munmap((void *)map_, size_);
+    throw ZCError(ZC_PARSING_ERROR, "Invalid bundle: " + path.string());
+  }
+  entries_ = (const BundleEntry *)(map_ + sizeof(BundleHeader));
+  names_ = (const char *)(entries_ + header_->count);
+}
+
+Bundle::~Bundle() { munmap((void *)map_, size_); }
+
+void Bundle::pack(const Package &package, const fs::path &output)
+{
+  const fs::path root = getZCRootDir();
+  const fs::path include_dir = Registry::getInstance().getIncludeDir();
+
+  // 1. List the members: the manifest, the headers and the binaries, with
+  // paths relative to the ZC root directory
+  Package published = package;
+  for (auto &b : published.binaries_)
+    b = fs::path(b).lexically_relative(root).string();
+
+  vector<Member> members;
+  members.push_back({BUNDLE_MANIFEST, {}, json(published).dump(), {}});
+  for (const auto &h : package.headers_)
+  {
+    fs::path header = include_dir / package.name_ / h;
+    members.push_back(
+        {header.lexically_relative(root).string(), header, {}, {}});
+  }
+  for (const auto &b : package.binaries_)
+    members.push_back(
+        {fs::path(b).lexically_relative(root).string(), b, {}, {}});
+  sort(members.begin() + 1, members.end(),
+       [](const Member &a, const Member &b) { return a.name < b.name; });
+
+  // 2. Compress the members in parallel
+  atomic<size_t> next{0};
+  mutex errors_mutex;
+  vector<string> errors;
+  vector<thread> workers;
+  size_t n_workers = min<size_t>(members.size(),
+                                 max(1u, thread::hardware_concurrency()));
+  for (size_t w = 0; w < n_workers; w++)
+    workers.emplace_back(
+        [&]()
+        {
+          for (size_t i = next++; i < members.size(); i = next++)
+            try
+            {
+              compressMember(members[i]);
+            }
+            catch (const exception &e)
+            {
+              lock_guard<mutex> lock(errors_mutex);
+              errors.push_back(e.what());
+            }
+        });
+  for (auto &w : workers)
+    w.join();
+  if (!errors.empty())
+    throw ZCError(ZC_WRITING_ERROR, "Couldn't pack " + package.name_ + ": " +
+                                        join(errors, ", "));
+
+  // 3. Lay out the table of contents, then the members in the same order
+  string names;
+  uint64_t offset = 0;
+  for (auto &m : members)
+  {
+    m.entry.offset = offset;
+    m.entry.name_offset = names.size();
+    m.entry.name_size = m.name.size();
+    names += m.name;
+    offset += m.entry.compressed_size;
+  }
+
+  BundleHeader header{};
+  memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+  header.version = BUNDLE_VERSION;
+  header.count = members.size();
+  header.names_size = names.size();
+  header.data_offset = sizeof(BundleHeader) +
+                       members.size() * sizeof(BundleEntry) + names.size();
+
+  fs::path tmp = tempPath(output);
+  bool written;
+  {
+    ofstream out(tmp, ios::binary);
+    out.write((const char *)&header, sizeof(header));
+    for (const auto &m : members)
+      out.write((const char *)&m.entry, sizeof(m.entry));
+    out << names;
+    for (const auto &m : members)
+      out << m.data;
+    written = out.good();
+  }
+  error_code ec;
+  if (!written)
+    fs::remove(tmp, ec);
+  if (!written || !moveIntoPlace(tmp, output))
+    throw ZCError(ZC_WRITING_ERROR, "Couldn't write " + output.string());
+}
+
+string Bundle::name(const BundleEntry &entry) const
+{
+  if ((uint64_t)entry.name_offset + entry.name_size > header_->names_size)
+    return "";
+  return string(names_ + entry.name_offset, entry.name_size);
+}
+
+bool Bundle::read(const BundleEntry &entry, string &data) const
+{
+  uint64_t available = size_ - header_->data_offset;
+  if (entry.compressed_size > available ||
+      entry.offset > available - entry.compressed_size ||
+      entry.size / MAX_DEFLATE_RATIO > entry.compressed_size)
+    return false;
+  data.resize(entry.size);
+  uLongf size = entry.size;
+  if (uncompress((Bytef *)data.data(), &size,
+                 map_ + header_->data_offset + entry.offset,
+                 entry.compressed_size) != Z_OK ||
+      size != entry.size)
+    return false;
+  return sha256(data) == string(entry.hash, sizeof(entry.hash));
+}
+
+Package Bundle::getPackage() const
+{
+  string manifest;
+  for (uint32_t i = 0; i < header_->count; i++)
+    if (entries_[i].kind == MEMBER_MANIFEST)
+    {
+      if (!read(entries_[i], manifest))
+        break;
+      try
+      {
+        return json::parse(manifest).get<Package>();
+      }
+      catch (const exception &e)
+      {
+        break;
+      }
+    }
+  throw ZCError(ZC_PARSING_ERROR,
+                "The bundle has no valid manifest: " + path_.string());
+}
+
+Package Bundle::extract(const fs::path &staging, bool static_libs) const
+{
+  Package package = getPackage();
+  vector<string> skipped;
+  for (uint32_t i = 0; i < header_->count; i++)
+  {
+    const BundleEntry &entry = entries_[i];
+    string member = name(entry);
+    if (entry.kind == MEMBER_MANIFEST)
+      continue;
+    if (entry.kind == MEMBER_STATIC_LIB && !static_libs)
+    {
+      skipped.push_back(member);
+      continue;
+    }
+
+    // Only write inside the include and lib directories
+    fs::path rel = fs::path(member).lexically_normal();
+    if (rel.is_absolute() || rel.empty() ||
+        (*rel.begin() != "include" && *rel.begin() != "lib"))
+      throw ZCError(ZC_PARSING_ERROR,
+                    "Invalid member " + member + " in " + path_.string());
+
+    string data;
+    if (!read(entry, data))
+      throw ZCError(ZC_PARSING_ERROR,
+                    "Corrupted member " + member + " in " + path_.string());
+    fs::path dest = staging / rel;
+    fs::create_directories(dest.parent_path());
+    ofstream output(dest, ios::binary);
+    output << data;
+    output.close();
+    if (!output.good())
+      throw ZCError(ZC_WRITING_ERROR, "Couldn't write " + dest.string());
+    fs::permissions(dest, (fs::perms)(entry.mode & 0777));
+  }
+
+  auto end = remove_if(package.binaries_.begin(), package.binaries_.end(),
+                       [&](const string &b)
+                       {
+                         return find(skipped.begin(), skipped.end(), b) !=
+                                skipped.end();
+                       });
+  package.binaries_.erase(end, package.binaries_.end());
+  for (const auto &b : package.binaries_)
+  {
+    if (!Registry::isValidBinary(b))
+      throw ZCError(ZC_PARSING_ERROR,
+                    "Invalid binary " + b + " in " + path_.string());
+    if (!fs::exists(staging / b))
+      throw ZCError(ZC_PARSING_ERROR,
+                    "Missing binary " + b + " in " + path_.string());
+  }
+  return package;
+}
+
+string Bundle::install(bool static_libs) const
+{
+  fs::path staging = getZCRootDir() / STAGING /
+                     (path_.stem().string() + "." + to_string(getpid()));
+  fs::remove_all(staging);
+  try
+  {
+    Package package = extract(staging, static_libs);
+    Registry::getInstance().installPackage(package, staging);
+    fs::remove_all(staging);
+    return package.name_;
+  }
+  catch (...)
+  {
+    fs::remove_all(staging);
+    throw;
+  }
+}
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/CodeGen/CodeGenAction.h>
+#include <clang/Driver/Compilation.h>
+#include <clang/Driver/Driver.h>
+#include <clang/Driver/Job.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/TextDiagnosticPrinter.h>
+#include <clang/Frontend/Utils.h>
+#include <clang/FrontendTool/Utils.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <helpers.hh>
+#include <objects/Compiler.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+/**
+ * @brief Get the output file of a compilation job
+ *
+ * @return The output file, nullptr if there is none
+ */
+const char *getOutput(const llvm::opt::ArgStringList &args)
+{
+  for (size_t i = 0; i + 1 < args.size(); i++)
+    if (strcmp(args[i], "-o") == 0)
+      return args[i + 1];
+  return nullptr;
+}
+
+bool isTempFile(const clang::driver::Compilation &c, const char *path)
+{
+  for (const char *f : c.getTempFiles())
+    if (strcmp(f, path) == 0)
+      return true;
+  return false;
+}
+
+/**
+ * @brief Put an object into a memory file the linker can read
+ *
+ * @return The file descriptor of the memory file, -1 on failure
+ */
+int memoryFile(const string &name, const string &content)
+{
+  // Inherited by the linker, which reads it as /proc/self/fd/<fd>
+  int fd = memfd_create(name.c_str(), 0);
+  if (fd < 0)
+    return -1;
+  const char *p = content.data();
+  size_t size = content.size();
+  while (size > 0)
+  {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      close(fd);
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  return fd;
+}
+
+} // namespace
+
+// ----------------------------------------------- Compiler class
+
+Compiler::Compiler()
+    : files_(new clang::FileManager(clang::FileSystemOptions(),
+                                    llvm::vfs::getRealFileSystem()))
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> diag_opts =
+      new clang::DiagnosticOptions();
+  diag_opts->ShowColors = llvm::sys::Process::StandardErrHasColors();
+  diags_ = make_unique<clang::DiagnosticsEngine>(
+      new clang::DiagnosticIDs(), diag_opts,
+      new clang::TextDiagnosticPrinter(llvm::errs(), diag_opts.get()));
+}
+
+Compiler::~Compiler() = default;
+
+Compiler &Compiler::getInstance()
+{
+  static Compiler instance;
+  return instance;
+}
+
+unique_ptr<clang::driver::Compilation>
+Compiler::buildCompilation(const vector<string> &args)
+{
+  if (args.empty())
+    throw ZCError(ZC_INTERNAL_ERROR, "No compiler given");
+
+  // A new driver, as it keeps the mode of the previous command
+  diags_->Reset();
+  driver_ = make_unique<clang::driver::Driver>(
+      ZC_CLANG_PATH, LLVM_DEFAULT_TARGET_TRIPLE, *diags_, "zc");
+
+  // The name of the compiler chooses the driver mode (clang++ for C++)
+  vector<const char *> argv{ZC_CLANG_PATH};
+  string name = args[0].substr(args[0].find_last_of('/') + 1);
+  if (name.find("++") != string::npos)
+    argv.push_back("--driver-mode=g++");
+  for (size_t i = 1; i < args.size(); i++)
+    argv.push_back(args[i].c_str());
+
+  unique_ptr<clang::driver::Compilation> c(driver_->BuildCompilation(argv));
+  if (!c || c->containsError() || diags_->hasErrorOccurred())
+    return nullptr;
+  return c;
+}
+
+bool Compiler::run(const vector<string> &args)
+{
+  unique_ptr<clang::driver::Compilation> c = buildCompilation(args);
+  if (!c)
+    return false;
+
+  // Objects of the temporary files, replaced by memory files in the jobs
+  // reading them
+  map<string, int> memory_files;
+  bool ok = true;
+  for (auto &job : c->getJobs())
+  {
+    llvm::opt::ArgStringList job_args = job.getArguments();
+    for (auto &arg : job_args)
+    {
+      auto it = memory_files.find(arg);
+      if (it != memory_files.end())
+        arg = c->getArgs().MakeArgString("/proc/self/fd/" +
+                                         to_string(it->second));
+    }
+
+    if (!job_args.empty() && strcmp(job_args[0], "-cc1") == 0)
+    {
+      const char *output = getOutput(job_args);
+      vector<const char *> cc1_args(job_args.begin(), job_args.end());
+      if (!output || !isTempFile(*c, output))
+        ok = compile(cc1_args, nullptr);
+      else
+      {
+        string object;
+        ok = compile(cc1_args, &object);
+        int fd = ok ? memoryFile(fs::path(output).filename().string(), object)
+                    : -1;
+        if (fd >= 0)
+          memory_files[output] = fd;
+        else if (ok)
+        {
+          warning(string("Couldn't create a memory file: ") + strerror(errno));
+          ok = false;
+        }
+      }
+    }
+    else
+    {
+      job.replaceArguments(job_args);
+      string error;
+      bool failed = false;
+      llvm::errs().flush();
+      ok = job.Execute({}, &error, &failed) == 0;
+      if (failed)
+        warning("Couldn't run " + string(job.getExecutable()) + ": " + error);
+    }
+    if (!ok)
+      break;
+  }
+
+  for (const auto &[file, fd] : memory_files)
+    close(fd);
+  llvm::errs().flush();
+  return ok;
+}
+
+unique_ptr<llvm::Module> Compiler::emitModule(const vector<string> &args,
+                                              llvm::LLVMContext &context,
+                                              vector<string> &dependencies)
+{
+  unique_ptr<clang::driver::Compilation> c = buildCompilation(args);
+  if (!c)
+    return nullptr;
+
+  const auto &jobs = c->getJobs().getJobs();
+  if (jobs.size() != 1 || jobs.front()->getArguments().empty() ||
+      strcmp(jobs.front()->getArguments().front(), "-cc1") != 0)
+    throw ZCError(ZC_BAD_COMMAND,
+                  "A single source file must be compiled to LLVM IR");
+  const llvm::opt::ArgStringList &job_args = jobs.front()->getArguments();
+
+  auto invocation = make_shared<clang::CompilerInvocation>();
+  clang::CompilerInstance ci;
+  ci.createDiagnostics();
+  if (!clang::CompilerInvocation::CreateFromArgs(
+          *invocation, llvm::ArrayRef<const char *>(job_args).drop_front(),
+          ci.getDiagnostics(), ZC_CLANG_PATH))
+    return nullptr;
+  invocation->getFrontendOpts().DisableFree = false;
+  ci.setInvocation(invocation);
+  ci.createDiagnostics();
+  ci.setFileManager(files_.get());
+
+  auto collector = make_shared<clang::DependencyCollector>();
+  ci.addDependencyCollector(collector);
+
+  clang::EmitLLVMOnlyAction action(&context);
+  if (!ci.ExecuteAction(action))
+    return nullptr;
+
+  const auto &inputs = invocation->getFrontendOpts().Inputs;
+  dependencies.clear();
+  if (!inputs.empty() && inputs.front().isFile())
+    dependencies.push_back(inputs.front().getFile().str());
+  for (const auto &d : collector->getDependencies())
+    if (find(dependencies.begin(), dependencies.end(), d) ==
+        dependencies.end())
+      dependencies.push_back(d);
+  return action.takeModule();
+}
+
+void Compiler::forgetFiles()
+{
+  // The file manager keeps the size of the files, which a new content
+  // wouldn't match
+  files_ = new clang::FileManager(clang::FileSystemOptions(),
+                                  llvm::vfs::getRealFileSystem());
+}
+
+bool Compiler::compile(const vector<const char *> &args, string *object)
+{
+  auto invocation = make_shared<clang::CompilerInvocation>();
+  clang::CompilerInstance ci;
+  ci.createDiagnostics();
+  if (!clang::CompilerInvocation::CreateFromArgs(
+          *invocation, llvm::ArrayRef<const char *>(args).drop_front(),
+          ci.getDiagnostics(), ZC_CLANG_PATH))
+    return false;
+
+  // Several translation units are compiled in this process
+  invocation->getFrontendOpts().DisableFree = false;
+  ci.setInvocation(invocation);
+
+  // The diagnostics follow the options of the job (e.g. colors)
+  ci.createDiagnostics();
+  ci.setFileManager(files_.get());
+
+  llvm::SmallString<0> buffer;
+  if (object)
+    ci.setOutputStream(make_unique<llvm::raw_svector_ostream>(buffer));
+
+  unique_ptr<clang::FrontendAction> action = clang::CreateFrontendAction(ci);
+  bool ok = action && ci.ExecuteAction(*action);
+  if (ok && object)
+    *object = buffer.str().str();
+  return ok;
+}
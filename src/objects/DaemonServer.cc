@@ -0,0 +1,674 @@
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+#include <objects/DaemonServer.hh>
+#include <objects/IncludeCache.hh>
+#include <objects/Registry.hh>
+#include <objects/SearchIndex.hh>
+#include <objects/Settings.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+extern char **environ;
+
+using namespace std;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Reply telling the client to run the command itself
+const int32_t REFUSED = INT32_MIN;
+
+// Standard streams passed to the daemon
+const int N_STREAMS = 3;
+
+// Maximum size of a request (arguments and environment)
+const uint32_t MAX_REQUEST = 1 << 20;
+
+// Time a client has to send its whole request
+const chrono::milliseconds REQUEST_TIMEOUT(1000);
+
+// Connection to the daemon, for the signal handlers of the client
+volatile sig_atomic_t client_fd = -1;
+
+/**
+ * @brief Forward a signal received by the client to the command
+ */
+void forwardSignal(int sig)
+{
+  if (client_fd >= 0)
+  {
+    char byte = sig;
+    (void)!write(client_fd, &byte, 1);
+  }
+}
+
+/**
+ * @brief Identify the running zc binary by its inode and modification time
+ */
+string buildId()
+{
+  struct stat st;
+  if (stat("/proc/self/exe", &st) != 0)
+    return "";
+  return to_string(st.st_dev) + ":" + to_string(st.st_ino) + ":" +
+         to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec);
+}
+
+int64_t mtime(const fs::path &path)
+{
+  error_code ec;
+  auto time = fs::last_write_time(path, ec);
+  return ec ? -1 : time.time_since_epoch().count();
+}
+
+bool socketAddress(sockaddr_un &addr)
+{
+  string path = DaemonServer::getSocketPath().string();
+  addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    return false;
+  strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+/**
+ * @brief Connect to the daemon
+ *
+ * @return The connection, -1 if no daemon is running
+ */
+int connectDaemon()
+{
+  sockaddr_un addr;
+  if (!socketAddress(addr))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+  const char *p = (const char *)data;
+  while (size > 0)
+  {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool readAll(int fd, void *data, size_t size)
+{
+  char *p = (char *)data;
+  while (size > 0)
+  {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Send a request, with the given file descriptors attached
+ */
+bool sendRequest(int fd, const json &request, const vector<int> &fds)
+{
+  string body = request.dump();
+  uint32_t size = body.size();
+  string message((const char *)&size, sizeof(size));
+  message += body;
+
+  iovec iov{message.data(), message.size()};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  char control[CMSG_SPACE(sizeof(int) * N_STREAMS)]{};
+  if (!fds.empty())
+  {
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+  }
+
+  ssize_t n;
+  do
+    n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  while (n < 0 && errno == EINTR);
+  if (n < 0)
+    return false;
+  return writeAll(fd, message.data() + n, message.size() - n);
+}
+
+/**
+ * @brief Read what arrived on a connection without waiting, and the file
+ * descriptors attached to it
+ *
+ * @return false if the connection was closed, failed, or sent too much
+ */
+bool receiveSome(int fd, string &data, vector<int> &fds)
+{
+  while (true)
+  {
+    char buffer[4096];
+    iovec iov{buffer, sizeof(buffer)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int) * N_STREAMS)]{};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (n == 0)
+      return false;
+    for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+      {
+        size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        size_t old = fds.size();
+        fds.resize(old + count);
+        memcpy(fds.data() + old, CMSG_DATA(c), sizeof(int) * count);
+      }
+    data.append(buffer, n);
+    if (data.size() > sizeof(uint32_t) + MAX_REQUEST)
+      return false;
+  }
+}
+
+/**
+ * @brief Send a request which doesn't run a command
+ *
+ * @return The reply, 0 if no daemon is running
+ */
+int32_t control(const string &type)
+{
+  int fd = connectDaemon();
+  if (fd < 0)
+    return 0;
+  int32_t reply = 0;
+  if (!sendRequest(fd, {{"type", type}}, {}) ||
+      !readAll(fd, &reply, sizeof(reply)))
+    reply = 0;
+  close(fd);
+  return reply;
+}
+
+} // namespace
+
+// ----------------------------------------------- DaemonServer class
+
+fs::path DaemonServer::getSocketPath() { return getZCRootDir() / DAEMON_SOCKET; }
+
+DaemonServer::DaemonServer(Handler handler)
+    : handler_(handler), build_(buildId())
+{
+  if (getPid() != 0)
+    throw ZCError(ZC_BAD_COMMAND, "A daemon is already running");
+
+  sockaddr_un addr;
+  if (!socketAddress(addr))
+    throw ZCError(ZC_BAD_COMMAND,
+                  "Socket path too long: " + getSocketPath().string());
+
+  // Only the user can connect
+  fs::remove(getSocketPath());
+  server_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  mode_t old_umask = umask(0077);
+  bool ok = server_ >= 0 &&
+            bind(server_, (sockaddr *)&addr, sizeof(addr)) == 0 &&
+            listen(server_, SOMAXCONN) == 0;
+  umask(old_umask);
+  if (!ok)
+    throw ZCError(ZC_INTERNAL_ERROR, "Couldn't listen on " +
+                                         getSocketPath().string() + ": " +
+                                         strerror(errno));
+
+  // Load everything once, then only what changes
+  Settings::getInstance();
+  Registry::getInstance();
+  SearchIndex::getInstance();
+  IncludeCache::getInstance();
+  for (const char *file : {CONFIG, REGISTRY, SEARCH_INDEX, INCLUDE_CACHE})
+    mtimes_[file] = mtime(getZCRootDir() / file);
+}
+
+DaemonServer::~DaemonServer()
+{
+  if (server_ >= 0)
+  {
+    close(server_);
+    fs::remove(getSocketPath());
+  }
+  if (signals_ >= 0)
+    close(signals_);
+}
+
+pid_t DaemonServer::detach()
+{
+  pid_t pid = fork();
+  if (pid < 0)
+    throw ZCError(ZC_INTERNAL_ERROR,
+                  string("Couldn't start the daemon: ") + strerror(errno));
+  if (pid > 0)
+  {
+    // The socket now belongs to the daemon
+    close(server_);
+    server_ = -1;
+    return pid;
+  }
+  setsid();
+  int null = open("/dev/null", O_RDWR);
+  for (int i = 0; i < N_STREAMS; i++)
+    dup2(null, i);
+  if (null >= N_STREAMS)
+    close(null);
+  return 0;
+}
+
+void DaemonServer::refresh()
+{
+  for (auto &[file, time] : mtimes_)
+  {
+    int64_t current = mtime(getZCRootDir() / file);
+    if (current == time)
+      continue;
+    if (file == CONFIG)
+      Settings::getInstance().load();
+    else if (file == REGISTRY)
+      Registry::getInstance().load();
+    else if (file == SEARCH_INDEX)
+      SearchIndex::getInstance().load();
+    else
+      IncludeCache::getInstance().load();
+    time = current;
+  }
+}
+
+void DaemonServer::serve()
+{
+  // Signals are read like the connections
+  sigset_t mask;
+  sigemptyset(&mask);
+  for (int sig : {SIGCHLD, SIGINT, SIGTERM, SIGHUP})
+    sigaddset(&mask, sig);
+  sigprocmask(SIG_BLOCK, &mask, nullptr);
+  signals_ = signalfd(-1, &mask, SFD_CLOEXEC);
+  signal(SIGPIPE, SIG_IGN);
+  if (signals_ < 0)
+    throw ZCError(ZC_INTERNAL_ERROR,
+                  string("Couldn't watch signals: ") + strerror(errno));
+
+  info("Daemon listening on " + getSocketPath().string() + " (PID " +
+       to_string(getpid()) + ")");
+  bool running = true;
+  while (running || !jobs_.empty())
+  {
+    vector<pollfd> fds{{signals_, POLLIN, 0}};
+    if (running)
+      fds.push_back({server_, POLLIN, 0});
+    vector<int> pids;
+    for (const auto &[pid, client] : jobs_)
+      if (client >= 0)
+      {
+        fds.push_back({client, POLLIN, 0});
+        pids.push_back(pid);
+      }
+
+    // Requests are read as they arrive, so a slow client doesn't hold the
+    // others back, until their deadline
+    size_t first_pending = fds.size();
+    int timeout = -1;
+    auto now = chrono::steady_clock::now();
+    vector<int> expired;
+    for (const auto &[client, pending] : pending_)
+    {
+      int left = chrono::ceil<chrono::milliseconds>(pending.deadline_ - now)
+                     .count();
+      if (left <= 0)
+        expired.push_back(client);
+      else
+      {
+        fds.push_back({client, POLLIN, 0});
+        timeout = timeout < 0 ? left : min(timeout, left);
+      }
+    }
+    for (int client : expired)
+      drop(client);
+
+    if (poll(fds.data(), fds.size(), timeout) < 0)
+      continue;
+
+    if (fds[0].revents & POLLIN)
+    {
+      signalfd_siginfo si;
+      while (read(signals_, &si, sizeof(si)) == sizeof(si))
+        if (si.ssi_signo == SIGCHLD)
+          reap();
+        else
+          running = false;
+    }
+
+    // Signals and disconnections of the clients reach their commands
+    size_t first_job = running ? 2 : 1;
+    for (size_t i = first_job; i < first_pending; i++)
+    {
+      if (!fds[i].revents)
+        continue;
+      // The command may have exited and been reaped above, its client being
+      // closed already
+      int pid = pids[i - first_job];
+      auto job = jobs_.find(pid);
+      if (job == jobs_.end() || job->second != fds[i].fd)
+        continue;
+      char sigs[16];
+      ssize_t n = read(fds[i].fd, sigs, sizeof(sigs));
+      if (n <= 0)
+      {
+        kill(-pid, SIGKILL);
+        close(fds[i].fd);
+        job->second = -1;
+        continue;
+      }
+      for (ssize_t s = 0; s < n; s++)
+        kill(-pid, sigs[s]);
+    }
+
+    for (size_t i = first_pending; i < fds.size(); i++)
+      if (fds[i].revents && pending_.count(fds[i].fd) && !receive(fds[i].fd))
+        running = false;
+
+    if (running && fds[1].revents & POLLIN)
+    {
+      // Only the user running the daemon can use it
+      int client = accept4(server_, nullptr, nullptr, SOCK_CLOEXEC);
+      ucred cred;
+      socklen_t len = sizeof(cred);
+      if (client >= 0 &&
+          getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+          cred.uid == geteuid())
+        pending_[client].deadline_ =
+            chrono::steady_clock::now() + REQUEST_TIMEOUT;
+      else if (client >= 0)
+        close(client);
+    }
+
+    if (!running)
+      while (!pending_.empty())
+        drop(pending_.begin()->first);
+  }
+  info("Daemon stopped");
+}
+
+bool DaemonServer::receive(int client)
+{
+  Pending &pending = pending_.at(client);
+  bool open = receiveSome(client, pending.data_, pending.fds_);
+
+  // The request is its size then its body
+  uint32_t size = 0;
+  if (pending.data_.size() >= sizeof(size))
+    memcpy(&size, pending.data_.data(), sizeof(size));
+  if (pending.data_.size() < sizeof(size) || size > MAX_REQUEST ||
+      pending.data_.size() < sizeof(size) + size)
+  {
+    if (!open || size > MAX_REQUEST)
+      drop(client);
+    return true;
+  }
+
+  string body = pending.data_.substr(sizeof(size), size);
+  vector<int> fds = move(pending.fds_);
+  pending_.erase(client);
+  return handle(client, body, fds);
+}
+
+void DaemonServer::drop(int client)
+{
+  auto it = pending_.find(client);
+  if (it == pending_.end())
+    return;
+  for (int fd : it->second.fds_)
+    close(fd);
+  close(client);
+  pending_.erase(it);
+}
+
+bool DaemonServer::handle(int client, const string &body,
+                          const vector<int> &fds)
+{
+  json request;
+  try
+  {
+    request = json::parse(body);
+  }
+  catch (const json::exception &)
+  {
+  }
+  if (!request.is_object())
+  {
+    for (int fd : fds)
+      close(fd);
+    close(client);
+    return true;
+  }
+
+  int32_t reply = getpid();
+  string type = request.value("type", "");
+  if (type != "run")
+  {
+    writeAll(client, &reply, sizeof(reply));
+    close(client);
+    return type != "stop";
+  }
+
+  // Clients of another build of zc run their command themselves
+  reply = REFUSED;
+  bool accepted = request.value("build", "") == build_ &&
+                  fds.size() == N_STREAMS;
+  if (accepted)
+    try
+    {
+      refresh();
+    }
+    catch (const ZCError &)
+    {
+      // The client reports the error, and everything is loaded again next
+      // time
+      for (auto &[file, time] : mtimes_)
+        time = -2;
+      accepted = false;
+    }
+
+  pid_t pid = accepted ? fork() : -1;
+  if (pid == 0)
+  {
+    try
+    {
+      runChild(client, request.at("args").get<vector<string>>(),
+               request.at("cwd").get<string>(),
+               request.at("env").get<vector<string>>(), fds);
+    }
+    catch (const json::exception &)
+    {
+      _exit(1);
+    }
+  }
+
+  for (int fd : fds)
+    close(fd);
+  if (pid < 0)
+  {
+    writeAll(client, &reply, sizeof(reply));
+    close(client);
+    return true;
+  }
+  jobs_[pid] = client;
+  return true;
+}
+
+void DaemonServer::runChild(int client, const vector<string> &args,
+                            const string &cwd, const vector<string> &env,
+                            const vector<int> &fds)
+{
+  // A process group of its own, so that signals reach the whole command. It
+  // stays in the session, whose controlling terminal it keeps
+  setpgid(0, 0);
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigprocmask(SIG_SETMASK, &mask, nullptr);
+  signal(SIGPIPE, SIG_DFL);
+
+  for (int i = 0; i < N_STREAMS; i++)
+    dup2(fds[i], i);
+  for (int fd : fds)
+    if (fd >= N_STREAMS)
+      close(fd);
+  close(client);
+  close(server_);
+  close(signals_);
+  for (const auto &[pid, c] : jobs_)
+    if (c >= 0)
+      close(c);
+  for (const auto &[c, pending] : pending_)
+  {
+    close(c);
+    for (int fd : pending.fds_)
+      close(fd);
+  }
+
+  clearenv();
+  for (const auto &e : env)
+    putenv(strdup(e.c_str()));
+
+  int code = 1;
+  if (chdir(cwd.c_str()) != 0)
+    cerr << ZCError(ZC_NOT_FOUND, "Couldn't enter " + cwd + ": " +
+                                      strerror(errno))
+         << endl;
+  else
+  {
+    // The handler reports its own errors
+    vector<char *> argv;
+    for (const auto &a : args)
+      argv.push_back(strdup(a.c_str()));
+    argv.push_back(nullptr);
+    code = handler_(args.size(), argv.data());
+  }
+  cout.flush();
+  cerr.flush();
+  fflush(nullptr);
+  _exit(code);
+}
+
+void DaemonServer::reap()
+{
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+  {
+    auto it = jobs_.find(pid);
+    if (it == jobs_.end())
+      continue;
+    int32_t code = WIFEXITED(status) ? WEXITSTATUS(status)
+                                     : 128 + WTERMSIG(status);
+    if (it->second >= 0)
+    {
+      writeAll(it->second, &code, sizeof(code));
+      close(it->second);
+    }
+    jobs_.erase(it);
+  }
+}
+
+bool DaemonServer::forward(int argc, char *argv[], int &exit_code)
+{
+  if (argc < 2 || getenv("ZC_NO_DAEMON") || string(argv[1]) == "daemon")
+    return false;
+  int fd = connectDaemon();
+  if (fd < 0)
+    return false;
+
+  json request;
+  request["type"] = "run";
+  request["build"] = buildId();
+  request["args"] = vector<string>(argv, argv + argc);
+  request["cwd"] = fs::current_path().string();
+  request["env"] = json::array();
+  for (char **e = environ; *e; e++)
+    request["env"].push_back(*e);
+
+  int32_t reply = REFUSED;
+  if (sendRequest(fd, request, {0, 1, 2}))
+  {
+    // Until the command exits, the signals of the terminal go to it
+    client_fd = fd;
+    struct sigaction sa{}, old[4];
+    sa.sa_handler = forwardSignal;
+    const int sigs[] = {SIGINT, SIGTERM, SIGHUP, SIGQUIT};
+    for (int i = 0; i < 4; i++)
+      sigaction(sigs[i], &sa, &old[i]);
+
+    if (!readAll(fd, &reply, sizeof(reply)))
+    {
+      cerr << ZCError(ZC_INTERNAL_ERROR, "The daemon closed the connection")
+           << endl;
+      reply = ZC_INTERNAL_ERROR;
+    }
+
+    for (int i = 0; i < 4; i++)
+      sigaction(sigs[i], &old[i], nullptr);
+    client_fd = -1;
+  }
+  close(fd);
+
+  if (reply == REFUSED)
+    return false;
+  exit_code = reply;
+  return true;
+}
+
+int32_t DaemonServer::getPid() { return control("ping"); }
+
+bool DaemonServer::stop() { return control("stop") != 0; }
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <clang-c/Index.h>
 #include <filesystem>
@@ -5,6 +6,7 @@
 
 #include <helpers.hh>
 #include <objects/File.hh>
+#include <objects/IncludeCache.hh>
 #include <objects/Registry.hh>
 #include <objects/ZCError.hh>
 #include <zcio.hh>
@@ -194,6 +196,10 @@ CXChildVisitResult visitor_extract(CXCursor cursor, CXCursor parent,
     if (text.find("extern") == string::npos)
       text = "extern " + text;
     (*ctx->decls)["globals"].push_back(text);
+
+    CXString name_str = clang_getCursorSpelling(cursor);
+    (*ctx->decls)["symbols"].push_back(clang_getCString(name_str));
+    clang_disposeString(name_str);
   }
   else if (kind == CXCursor_FunctionDecl)
   {
@@ -211,6 +217,10 @@ CXChildVisitResult visitor_extract(CXCursor cursor, CXCursor parent,
       if (!text.empty() && text.back() == ';')
         text.pop_back();
       (*ctx->decls)["functions"].push_back(text);
+      // Inline functions are only defined where they are used, so they
+      // aren't symbols of the library
+      if (!clang_Cursor_isFunctionInlined(cursor))
+        (*ctx->decls)["symbols"].push_back(name);
     }
   }
 
@@ -260,6 +270,32 @@ CXChildVisitResult visitor_find_includes(CXCursor cursor, CXCursor parent,
   return CXChildVisit_Continue;
 }
 
+/**
+ * @brief Collect the files included by a translation unit, directly or not
+ */
+void visitor_included_files(CXFile included_file, CXSourceLocation *,
+                            unsigned, CXClientData client_data)
+{
+  auto *files = static_cast<vector<fs::path> *>(client_data);
+  CXString name = clang_getFileName(included_file);
+  if (const char *s = clang_getCString(name))
+    files->push_back(s);
+  clang_disposeString(name);
+}
+
+/**
+ * @brief Check if an inclusion belongs to a package: it is one of the
+ * package's headers. A package without a header list (ZC packages, some
+ * standard packages) is included as <name/...> or <name.h>
+ */
+bool includesPackage(const string &inclusion, const string &name,
+                     const vector<string> &headers)
+{
+  if (headers.empty())
+    return inclusion.rfind(name + "/", 0) == 0 || inclusion == name + ".h";
+  return find(headers.begin(), headers.end(), inclusion) != headers.end();
+}
+
 } // namespace
 
 // ----------------------------------------------- File class
@@ -277,6 +313,8 @@ File::File(const string &filepath) : path_(filepath)
     language_ = H;
   else if (ext == ".cpp" || ext == ".cc" || ext == ".cxx")
     language_ = CPP;
+  else if (ext == ".cppm" || ext == ".ixx")
+    language_ = CPP_MODULE;
   else if (ext == ".hpp" || ext == ".hh" || ext == ".hxx")
     language_ = HPP;
   else if (ext == ".a")
@@ -289,6 +327,8 @@ File::File(const string &filepath) : path_(filepath)
     language_ = INSTANCE;
   else if (ext == ".asm" || ext == ".s")
     language_ = ASSEMBLER;
+  else if (ext == ".zcpkg")
+    language_ = BUNDLE;
   else
     language_ = OTHER;
 }
@@ -504,48 +544,156 @@ ostream &operator<<(ostream &stream, const File &file)
   return stream;
 }
 
-vector<string> File::getInclusions(const Registry &reg) const
+void File::getInclusions(const Registry &reg, vector<string> &cflags,
+                         vector<string> &ldflags) const
 {
   vector<string> found_includes;
-  vector<string> flags;
+  cflags.clear();
+  ldflags.clear();
 
-  CXIndex index = clang_createIndex(0, 0);
+  // Only parse the file if it or one of its headers changed since last time
+  IncludeCache &cache = IncludeCache::getInstance();
+  bool found = cache.lookup(path_, found_includes);
+  if (!found)
+  {
+    CXIndex index = clang_createIndex(0, 0);
 
-  // To see #includes
-  unsigned options = CXTranslationUnit_DetailedPreprocessingRecord;
+    // To see #includes
+    unsigned options = CXTranslationUnit_DetailedPreprocessingRecord;
 
-  const char *args[] = {"-x", "c"};
-  CXTranslationUnit unit = clang_parseTranslationUnit(
-      index, path_.c_str(), args, 2, nullptr, 0, options);
+    const char *args[] = {"-x", "c"};
+    CXTranslationUnit unit = clang_parseTranslationUnit(
+        index, path_.c_str(), args, 2, nullptr, 0, options);
 
-  if (unit)
-  {
-    CXCursor cursor = clang_getTranslationUnitCursor(unit);
+    if (unit)
+    {
+      CXCursor cursor = clang_getTranslationUnitCursor(unit);
+
+      // On récupère tous les noms de fichiers inclus
+      clang_visitChildren(cursor, visitor_find_includes, &found_includes);
 
-    // On récupère tous les noms de fichiers inclus
-    clang_visitChildren(cursor, visitor_find_includes, &found_includes);
+      vector<fs::path> files;
+      clang_getInclusions(unit, visitor_included_files, &files);
+      cache.store(path_, found_includes, files);
+      found = true;
 
+      clang_disposeTranslationUnit(unit);
+    }
+
+    clang_disposeIndex(index);
+  }
+
+  if (found)
+  {
     // On compare avec votre map de bibliothèques pour extraire les flags
+    vector<string> packages;
     for (const auto &inc : found_includes)
     {
+      // ZC packages are included as <name/header.h>
       for (const auto &package : reg.getPackages())
-      {
-        if (inc.find(package.name_) != string::npos)
-        {
-          // TODO : Registry::getFlagsforHeader(inclusions) ?
-          flags.push_back(package.flags_);
-        }
-      }
+        if (includesPackage(inc, package.name_, {}))
+          packages.push_back(package.name_);
       for (const auto &std_package : reg.getStdPackages())
-        if (inc.find(std_package.name_) != string::npos)
-          flags.push_back(std_package.flags_);
+        if (includesPackage(inc, std_package.name_, std_package.headers_))
+          packages.push_back(std_package.name_);
     }
 
-    clang_disposeTranslationUnit(unit);
+    // The dependencies of the packages are enabled too, linked in order
+    if (!packages.empty())
+      reg.getFlags(packages, cflags, ldflags);
   }
+}
 
-  clang_disposeIndex(index);
-  return flags;
+vector<string> File::getSystemIncludes() const
+{
+  vector<string> includes;
+  ifstream input(path_);
+  string line;
+  bool in_comment = false;
+  while (getline(input, line))
+  {
+    // Blank lines and comments may come between the inclusions
+    size_t pos = line.find_first_not_of(" \t");
+    if (in_comment)
+    {
+      size_t end = line.find("*/");
+      if (end == string::npos)
+        continue;
+      in_comment = false;
+      pos = line.find_first_not_of(" \t", end + 2);
+    }
+    if (pos == string::npos || line.compare(pos, 2, "//") == 0)
+      continue;
+    if (line.compare(pos, 2, "/*") == 0)
+    {
+      size_t end = line.find("*/", pos + 2);
+      in_comment = end == string::npos;
+      if (in_comment ||
+          line.find_first_not_of(" \t", end + 2) == string::npos)
+        continue;
+      break;
+    }
+
+    // #include <header>, spaces allowed around the '#'. The block ends on
+    // anything else, code and other directives included
+    if (line[pos] != '#')
+      break;
+    pos = line.find_first_not_of(" \t", pos + 1);
+    if (pos == string::npos || line.compare(pos, 7, "include") != 0)
+      break;
+    pos = line.find_first_not_of(" \t", pos + 7);
+    if (pos == string::npos || line[pos] != '<')
+      break;
+    size_t end = line.find('>', pos);
+    if (end == string::npos)
+      break;
+    string header = line.substr(pos + 1, end - pos - 1);
+    if (find(includes.begin(), includes.end(), header) == includes.end())
+      includes.push_back(header);
+  }
+  return includes;
+}
+
+void File::getModuleDeclarations(string &name, vector<string> &imports) const
+{
+  name.clear();
+  imports.clear();
+  ifstream input(path_);
+  string line;
+  vector<string> partitions;
+  while (getline(input, line))
+  {
+    // [export] module name; and [export] import name;, at the start of a line
+    size_t pos = line.find_first_not_of(" \t");
+    if (pos == string::npos)
+      continue;
+    if (line.compare(pos, 7, "export ") == 0)
+      pos = line.find_first_not_of(" \t", pos + 7);
+    bool is_module = pos != string::npos && line.compare(pos, 7, "module ") == 0;
+    bool is_import = pos != string::npos && line.compare(pos, 7, "import ") == 0;
+    if (!is_module && !is_import)
+      continue;
+    pos = line.find_first_not_of(" \t", pos + 7);
+    size_t end = line.find(';', pos);
+    if (pos == string::npos || end == string::npos)
+      continue;
+    string module = line.substr(pos, end - pos);
+    module.erase(module.find_last_not_of(" \t") + 1);
+    if (module.empty() || module[0] == '<' || module[0] == '"')
+      continue;
+
+    if (is_module)
+      name = module;
+    else if (module[0] == ':')
+      partitions.push_back(module);
+    else
+      imports.push_back(module);
+  }
+
+  // A partition is imported by its name within the module
+  string primary = name.substr(0, name.find(':'));
+  for (const auto &p : partitions)
+    imports.push_back(primary + p);
 }
 
 bool File::copy(const File &file) const { return write(file.read()); }
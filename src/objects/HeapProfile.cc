@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <nlohmann/json.hpp>
+
+#include <objects/HeapProfile.hh>
+#include <objects/Symbolizer.hh>
+#include <objects/ZCError.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Frames of a call site shown in the tables
+const size_t SITE_FRAMES = 3;
+
+string formatBytes(uint64_t bytes)
+{
+  char buffer[32];
+  if (bytes < 1024)
+    snprintf(buffer, sizeof(buffer), "%llu B", (unsigned long long)bytes);
+  else if (bytes < 1024 * 1024)
+    snprintf(buffer, sizeof(buffer), "%.1f KiB", bytes / 1024.0);
+  else if (bytes < 1024ull * 1024 * 1024)
+    snprintf(buffer, sizeof(buffer), "%.1f MiB", bytes / (1024.0 * 1024));
+  else
+    snprintf(buffer, sizeof(buffer), "%.2f GiB",
+             bytes / (1024.0 * 1024 * 1024));
+  return buffer;
+}
+
+string formatDuration(double ns)
+{
+  char buffer[32];
+  if (ns < 1e3)
+    snprintf(buffer, sizeof(buffer), "%.0f ns", ns);
+  else if (ns < 1e6)
+    snprintf(buffer, sizeof(buffer), "%.1f µs", ns / 1e3);
+  else if (ns < 1e9)
+    snprintf(buffer, sizeof(buffer), "%.2f ms", ns / 1e6);
+  else
+    snprintf(buffer, sizeof(buffer), "%.3f s", ns / 1e9);
+  return buffer;
+}
+
+string className(size_t c)
+{
+  if (c == 0)
+    return "<= 16 B";
+  if (c == HEAP_SIZE_CLASSES - 1)
+    return "> " + formatBytes(1ull << (c + 3));
+  return "<= " + formatBytes(1ull << (c + 4));
+}
+
+string percent(size_t count, size_t total)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.1f %%",
+           total ? 100.0 * count / total : 0.0);
+  return buffer;
+}
+
+} // namespace
+
+// ----------------------------------------------- HeapProfile class
+
+HeapProfile HeapProfile::load(const fs::path &directory)
+{
+  ifstream input(directory / "profile");
+  if (!input.is_open())
+    throw ZCError(ZC_NOT_FOUND, "No heap profile was written: the program may "
+                                "have crashed or exited with _exit");
+
+  // 1. The header and the executable mappings
+  string line;
+  getline(input, line);
+  if (line != "zcheap 2")
+    throw ZCError(ZC_PARSING_ERROR, "Unknown heap profile format: " + line);
+  getline(input, line);
+  Symbolizer symbolizer;
+  while (getline(input, line) && line.rfind("totals ", 0) != 0)
+    symbolizer.addMapping(line);
+
+  // 2. The totals, size classes and lifetimes of every thread
+  HeapProfile profile;
+  string label;
+  stringstream totals(line);
+  totals >> label >> profile.allocations_ >> profile.frees_ >>
+      profile.bytes_ >> profile.largest_ >> profile.peak_ >>
+      profile.peak_time_ >> profile.duration_;
+  getline(input, line);
+  stringstream classes(line);
+  classes >> label;
+  for (size_t c = 0; c < HEAP_SIZE_CLASSES; c++)
+    classes >> profile.class_allocations_[c] >> profile.class_bytes_[c];
+  getline(input, line);
+  stringstream lifetimes(line);
+  lifetimes >> label;
+  for (auto &count : profile.lifetimes_)
+    lifetimes >> count;
+  if (!totals || label != "lifetimes" || !classes || !lifetimes ||
+      !getline(input, line) || line != "sites")
+    throw ZCError(ZC_PARSING_ERROR, "Corrupted heap profile in " +
+                                        directory.string());
+
+  // 3. The sites and their call stacks, the call site first. They are return
+  // addresses, symbolized at the call, one byte before
+  while (getline(input, line))
+  {
+    stringstream fields(line);
+    uint32_t id;
+    uint64_t freed_bytes;
+    Site site;
+    if (!(fields >> id >> site.allocations_ >> site.bytes_ >> site.frees_ >>
+          freed_bytes >> site.lifetimes_))
+      continue;
+    string hex;
+    while (fields >> hex)
+      for (const auto &name :
+           symbolizer.symbolize(stoull(hex, nullptr, 16) - 1))
+        site.frames_.push_back(name);
+    if (site.frames_.empty())
+      site.frames_.push_back("[unknown]");
+
+    // The blocks never released
+    site.live_ = site.allocations_ - site.frees_;
+    site.live_bytes_ = site.bytes_ - freed_bytes;
+    profile.live_ += site.live_;
+    profile.live_bytes_ += site.live_bytes_;
+    profile.sites_[id] = site;
+  }
+  return profile;
+}
+
+Table HeapProfile::summary() const
+{
+  // Median of the lifetimes, within a power of two
+  string median = "-";
+  size_t seen = 0;
+  for (size_t b = 0; b < lifetimes_.size() && frees_ > 0; b++)
+    if ((seen += lifetimes_[b]) * 2 >= frees_)
+    {
+      median = formatDuration(1ull << b) + " - " +
+               formatDuration(b < 63 ? (double)(1ull << (b + 1)) : 1.8e19);
+      break;
+    }
+
+  vector<vector<string>> content{
+      {"Measure", "Value"},
+      {"Allocations", to_string(allocations_)},
+      {"Releases", to_string(frees_)},
+      {"Bytes allocated", formatBytes(bytes_)},
+      {"Average size",
+       allocations_ ? formatBytes(bytes_ / allocations_) : "-"},
+      {"Largest allocation", formatBytes(largest_)},
+      {"Peak live heap",
+       formatBytes(peak_) + " (at " + formatDuration(peak_time_) + ")"},
+      {"Median lifetime", median},
+      {"Allocation rate",
+       duration_ ? to_string((uint64_t)(allocations_ * 1e9 / duration_)) +
+                       " /s"
+                 : "-"},
+      {"Live at exit",
+       formatBytes(live_bytes_) + " in " + to_string(live_) + " blocks"}};
+  return Table(content.size(), 2, true, true, content);
+}
+
+Table HeapProfile::histogram() const
+{
+  vector<vector<string>> content{{"Size", "Allocations", "Bytes"}};
+  for (size_t c = 0; c < HEAP_SIZE_CLASSES; c++)
+    if (class_allocations_[c] > 0)
+      content.push_back({className(c),
+                         to_string(class_allocations_[c]) + " (" +
+                             percent(class_allocations_[c], allocations_) +
+                             ")",
+                         formatBytes(class_bytes_[c]) + " (" +
+                             percent(class_bytes_[c], bytes_) + ")"});
+  return Table(content.size(), 3, true, true, content);
+}
+
+Table HeapProfile::sites(size_t n) const
+{
+  vector<const Site *> sorted = sortedSites();
+  if (sorted.size() > n)
+    sorted.resize(n);
+
+  vector<vector<string>> content{
+      {"Call site", "Allocations", "Bytes", "Mean lifetime", "Live at exit"}};
+  for (const Site *site : sorted)
+  {
+    // The callers follow the function which allocated
+    string name;
+    for (size_t f = 0; f < min(site->frames_.size(), SITE_FRAMES); f++)
+      name += (f ? " < " : "") + site->frames_[f];
+    content.push_back(
+        {name, to_string(site->allocations_), formatBytes(site->bytes_),
+         site->frees_ ? formatDuration((double)site->lifetimes_ / site->frees_)
+                      : "-",
+         site->live_ ? formatBytes(site->live_bytes_) : "-"});
+  }
+  Table table(content.size(), 5, true, true, content);
+  table.setMaxWidth(80);
+  return table;
+}
+
+void HeapProfile::save(const fs::path &file, const string &program) const
+{
+  json classes = json::array();
+  for (size_t c = 0; c < HEAP_SIZE_CLASSES; c++)
+    if (class_allocations_[c] > 0)
+      classes.push_back({{"class", className(c)},
+                         {"allocations", class_allocations_[c]},
+                         {"bytes", class_bytes_[c]}});
+  json lifetimes = json::array();
+  for (size_t b = 0; b < lifetimes_.size(); b++)
+    if (lifetimes_[b] > 0)
+      lifetimes.push_back({{"min_ns", 1ull << b}, {"frees", lifetimes_[b]}});
+  json sites = json::array();
+  for (const Site *site : sortedSites())
+    sites.push_back({{"frames", site->frames_},
+                     {"allocations", site->allocations_},
+                     {"bytes", site->bytes_},
+                     {"frees", site->frees_},
+                     {"lifetime_ns", site->lifetimes_},
+                     {"live", site->live_},
+                     {"live_bytes", site->live_bytes_}});
+
+  json j{{"program", program},
+         {"allocations", allocations_},
+         {"frees", frees_},
+         {"bytes", bytes_},
+         {"largest", largest_},
+         {"peak_bytes", peak_},
+         {"peak_time_ns", peak_time_},
+         {"duration_ns", duration_},
+         {"live", live_},
+         {"live_bytes", live_bytes_},
+         {"size_classes", classes},
+         {"lifetimes", lifetimes},
+         {"sites", sites}};
+
+  ofstream output(file);
+  if (!output.is_open())
+    throw ZCError(ZC_WRITING_ERROR,
+                  "The heap profile couldn't be written: " + file.string());
+  output << j.dump(2) << endl;
+}
+
+size_t HeapProfile::getAllocations() const { return allocations_; }
+
+vector<const HeapProfile::Site *> HeapProfile::sortedSites() const
+{
+  vector<const Site *> sorted;
+  for (const auto &[id, site] : sites_)
+    sorted.push_back(&site);
+  sort(sorted.begin(), sorted.end(), [](const Site *a, const Site *b)
+       { return a->allocations_ != b->allocations_
+                    ? a->allocations_ > b->allocations_
+                    : a->bytes_ > b->bytes_; });
+  return sorted;
+}
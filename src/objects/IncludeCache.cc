@@ -0,0 +1,89 @@
+#include <fstream>
+
+#include <nlohmann/json.hpp>
+#include <objects/IncludeCache.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+/**
+ * @brief Get the modification time of a file in nanoseconds, -1 if it doesn't
+ * exist
+ */
+int64_t mtime(const string &path)
+{
+  error_code ec;
+  auto time = fs::last_write_time(path, ec);
+  return ec ? -1 : time.time_since_epoch().count();
+}
+
+} // namespace
+
+// ----------------------------------------------- IncludeCache class
+
+IncludeCache::IncludeCache() { load(); }
+
+IncludeCache &IncludeCache::getInstance()
+{
+  static IncludeCache instance;
+  return instance;
+}
+
+void IncludeCache::load()
+{
+  entries_.clear();
+  ifstream input(cache_path_);
+  if (!input.is_open())
+    return;
+  try
+  {
+    json root = json::parse(input);
+    for (const auto &[file, e] : root.items())
+      entries_[file] = {e.at("includes").get<vector<string>>(),
+                        e.at("mtimes").get<map<string, int64_t>>()};
+  }
+  catch (const json::exception &)
+  {
+    // It is only a cache
+    entries_.clear();
+  }
+}
+
+bool IncludeCache::lookup(const fs::path &file, vector<string> &includes) const
+{
+  error_code ec;
+  auto it = entries_.find(fs::absolute(file, ec).string());
+  if (ec || it == entries_.end())
+    return false;
+  for (const auto &[path, time] : it->second.mtimes_)
+    if (mtime(path) != time)
+      return false;
+  includes = it->second.includes_;
+  return true;
+}
+
+void IncludeCache::store(const fs::path &file, const vector<string> &includes,
+                         const vector<fs::path> &files)
+{
+  error_code ec;
+  string key = fs::absolute(file, ec).string();
+  if (ec)
+    return;
+  Entry entry{includes, {{key, mtime(key)}}};
+  for (const auto &f : files)
+    entry.mtimes_[fs::absolute(f, ec).string()] = mtime(f.string());
+  entries_[key] = entry;
+
+  json root = json::object();
+  for (const auto &[f, e] : entries_)
+    root[f] = {{"includes", e.includes_}, {"mtimes", e.mtimes_}};
+
+  // Concurrent runs never read half a file
+  writeAtomically(cache_path_, root.dump());
+}
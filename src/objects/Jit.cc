@@ -0,0 +1,268 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <hash.hh>
+#include <nlohmann/json.hpp>
+#include <objects/Compiler.hh>
+#include <objects/File.hh>
+#include <objects/Jit.hh>
+#include <objects/ZCError.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+int64_t mtime(const string &path)
+{
+  error_code ec;
+  auto time = fs::last_write_time(path, ec);
+  return ec ? -1 : time.time_since_epoch().count();
+}
+
+/**
+ * @brief Identify the IR of a file by the LLVM version, the compiling
+ * arguments and the path of the file
+ */
+string cacheKey(const vector<string> &args, const fs::path &file)
+{
+  Sha256 hash;
+  hash.update(LLVM_VERSION_STRING, sizeof(LLVM_VERSION_STRING));
+  for (const auto &a : args)
+    hash.update(a.c_str(), a.size() + 1);
+  string path = fs::absolute(file).string();
+  hash.update(path.c_str(), path.size() + 1);
+  return hash.hex();
+}
+
+bool loadLibrary(const string &path)
+{
+  string error;
+  return !llvm::sys::DynamicLibrary::LoadLibraryPermanently(path.c_str(),
+                                                            &error);
+}
+
+/**
+ * @brief Get the address of a symbol found by the JIT
+ */
+template <typename Symbol> uintptr_t addressOf(const Symbol &symbol)
+{
+  // An ExecutorAddr since LLVM 15, a JITEvaluatedSymbol before
+  if constexpr (requires { symbol.getValue(); })
+    return symbol.getValue();
+  else
+    return symbol.getAddress();
+}
+
+/**
+ * @brief Throw an error if a file couldn't be added to the JIT
+ */
+void checkError(llvm::Error error, const fs::path &file)
+{
+  if (error)
+    throw ZCError(ZC_EXECUTION_ERROR, "Couldn't add " + file.string() +
+                                          " to the JIT: " +
+                                          llvm::toString(std::move(error)));
+}
+
+} // namespace
+
+// ----------------------------------------------- Jit class
+
+Jit::Jit(const vector<string> &compile_args)
+    : compile_args_(compile_args),
+      context_(make_unique<llvm::orc::ThreadSafeContext>(
+          make_unique<llvm::LLVMContext>()))
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+
+  auto jit = llvm::orc::LLJITBuilder().create();
+  if (!jit)
+    throw ZCError(ZC_INTERNAL_ERROR, "Couldn't start the JIT: " +
+                                         llvm::toString(jit.takeError()));
+  jit_ = std::move(*jit);
+
+  // The program finds the C and C++ libraries in the ZC process, and the
+  // libraries loaded later
+  auto generator =
+      llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          jit_->getDataLayout().getGlobalPrefix());
+  if (!generator)
+    throw ZCError(ZC_INTERNAL_ERROR,
+                  "Couldn't expose the libraries to the JIT: " +
+                      llvm::toString(generator.takeError()));
+  jit_->getMainJITDylib().addGenerator(std::move(*generator));
+}
+
+Jit::~Jit() = default;
+
+void Jit::addFile(const fs::path &file)
+{
+  switch (File(file.string()).getLanguage_())
+  {
+  case C:
+  case CPP:
+    checkError(jit_->addIRModule(
+                   llvm::orc::ThreadSafeModule(getModule(file), *context_)),
+               file);
+    break;
+  case OBJECT:
+  {
+    auto buffer = llvm::MemoryBuffer::getFile(file.string());
+    if (!buffer)
+      throw ZCError(ZC_NOT_FOUND, "Couldn't read " + file.string() + ": " +
+                                      buffer.getError().message());
+    checkError(jit_->addObjectFile(std::move(*buffer)), file);
+    break;
+  }
+  case DYN_LIB:
+    if (!loadLibrary(fs::absolute(file).string()))
+      throw ZCError(ZC_EXECUTION_ERROR, "Couldn't load " + file.string());
+    break;
+  default:
+    throw ZCError(ZC_UNSUPPORTED_LANGUAGE,
+                  "File can't be run by the JIT: " + file.string());
+  }
+}
+
+void Jit::loadLibraries(const vector<string> &ldflags,
+                        const vector<fs::path> &lib_dirs)
+{
+  vector<fs::path> dirs = lib_dirs;
+  for (const auto &f : ldflags)
+    if (f.rfind("-L", 0) == 0 && f.size() > 2)
+      dirs.push_back(f.substr(2));
+
+  for (const auto &f : ldflags)
+  {
+    if (f.rfind("-l", 0) != 0 || f.size() <= 2)
+      continue;
+    string name = "lib" + f.substr(2) + ".so";
+    bool loaded = false;
+    for (const auto &dir : dirs)
+      if (fs::exists(dir / name))
+      {
+        loaded = loadLibrary((dir / name).string());
+        break;
+      }
+    // Left to the dynamic loader otherwise. The libraries of the C runtime
+    // (libm, libpthread) are linker scripts it can't load, but ZC already
+    // brings them, and a missing symbol is reported when main is looked up
+    if (!loaded)
+      loadLibrary(name);
+  }
+}
+
+int Jit::run(const string &name, const vector<string> &args)
+{
+  llvm::orc::JITDylib &main_dylib = jit_->getMainJITDylib();
+  auto main_symbol = jit_->lookup("main");
+  if (!main_symbol)
+    throw ZCError(ZC_EXECUTION_ERROR,
+                  "Couldn't link the program: " +
+                      llvm::toString(main_symbol.takeError()));
+
+  // Constructors of the global variables (C++) run before main
+  if (llvm::Error error = jit_->initialize(main_dylib))
+    throw ZCError(ZC_EXECUTION_ERROR, "Couldn't initialize the program: " +
+                                          llvm::toString(std::move(error)));
+
+  auto main_fn = (int (*)(int, char **))addressOf(*main_symbol);
+  vector<string> arg_strings{name};
+  arg_strings.insert(arg_strings.end(), args.begin(), args.end());
+  vector<char *> argv;
+  for (auto &a : arg_strings)
+    argv.push_back(a.data());
+  argv.push_back(nullptr);
+
+  cout << flush;
+  int code = main_fn(arg_strings.size(), argv.data());
+  fflush(nullptr);
+
+  if (llvm::Error error = jit_->deinitialize(main_dylib))
+    llvm::consumeError(std::move(error));
+  return code;
+}
+
+unique_ptr<llvm::Module> Jit::getModule(const fs::path &file)
+{
+  string key = cacheKey(compile_args_, file);
+  fs::path bitcode = cache_dir_ / (key + ".bc");
+  fs::path deps = cache_dir_ / (key + ".json");
+  llvm::LLVMContext &context = *context_->getContext();
+
+  // 1. Reuse the IR if none of the files it was compiled from changed
+  ifstream input(deps);
+  if (input.is_open())
+  {
+    bool fresh = true;
+    try
+    {
+      json times = json::parse(input);
+      for (const auto &[path, time] : times.items())
+        if (mtime(path) != time.get<int64_t>())
+          fresh = false;
+    }
+    catch (const json::exception &)
+    {
+      fresh = false;
+    }
+    if (fresh)
+      if (auto buffer = llvm::MemoryBuffer::getFile(bitcode.string()))
+      {
+        auto ir =
+            llvm::parseBitcodeFile((*buffer)->getMemBufferRef(), context);
+        if (ir)
+          return std::move(*ir);
+        llvm::consumeError(ir.takeError());
+      }
+  }
+
+  // 2. Compile it otherwise
+  vector<string> args = compile_args_;
+  args.insert(args.end(), {"-c", file.string()});
+  vector<string> dependencies;
+  unique_ptr<llvm::Module> ir =
+      Compiler::getInstance().emitModule(args, context, dependencies);
+  if (!ir)
+    throw ZCError(ZC_COMPILATION_ERROR, "Compilation failed: " + file.string());
+
+  // 3. Cache it, errors being ignored. The dependencies are written last, so
+  // that they always describe the cached IR
+  json times = json::object();
+  for (const auto &d : dependencies)
+    times[fs::absolute(d).string()] = mtime(d);
+
+  error_code ec;
+  fs::create_directories(cache_dir_, ec);
+  fs::path bitcode_tmp = tempPath(bitcode);
+  {
+    llvm::raw_fd_ostream output(bitcode_tmp.string(), ec);
+    if (!ec)
+      llvm::WriteBitcodeToFile(*ir, output);
+  }
+  if (moveIntoPlace(bitcode_tmp, bitcode))
+    writeAtomically(deps, times.dump());
+  return ir;
+}
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+
+#include <hash.hh>
+#include <nlohmann/json.hpp>
+#include <objects/Compiler.hh>
+#include <objects/File.hh>
+#include <objects/ModuleBuilder.hh>
+#include <objects/ZCError.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+bool isClang(const string &compiler)
+{
+  return fs::path(compiler).filename().string().find("clang") != string::npos;
+}
+
+/**
+ * @brief Get the clang-scan-deps installed with a compiler, which has the
+ * same version suffix (clang++-18 comes with clang-scan-deps-18)
+ */
+string scanDepsTool(const string &compiler)
+{
+  fs::path path = compiler;
+  string name = path.filename().string();
+  size_t pos = name.find("clang");
+  if (pos == string::npos)
+    return "clang-scan-deps";
+  string suffix = name.substr(pos + 5);
+  if (suffix.rfind("++", 0) == 0)
+    suffix = suffix.substr(2);
+  return (path.parent_path() / ("clang-scan-deps" + suffix)).string();
+}
+
+} // namespace
+
+// ----------------------------------------------- ModuleBuilder class
+
+ModuleBuilder::ModuleBuilder(const vector<string> &compile_args,
+                             bool in_process)
+    : compile_args_(compile_args), in_process_(in_process)
+{
+  if (compile_args_.empty() || (!in_process_ && !isClang(compile_args_[0])))
+    throw ZCError(ZC_UNSUPPORTED_LANGUAGE,
+                  "C++ modules are only supported with clang");
+}
+
+vector<string> ModuleBuilder::build(const vector<fs::path> &units,
+                                    vector<fs::path> &objects) const
+{
+  // 1. Scan the units. Each unit is cached under a key covering the compiler,
+  // the arguments and its path
+  string id = toolchainId(compile_args_[0], in_process_);
+  vector<Unit> scanned;
+  map<string, size_t> providers;
+  for (const auto &source : units)
+  {
+    Unit unit;
+    unit.source_ = fs::absolute(source);
+    scan(unit);
+    if (unit.name_.empty())
+      throw ZCError(ZC_COMPILATION_ERROR,
+                    "No module is declared in " + source.string());
+    if (providers.count(unit.name_))
+      throw ZCError(ZC_COMPILATION_ERROR,
+                    "The module " + unit.name_ + " is declared twice: " +
+                        source.string());
+    providers[unit.name_] = scanned.size();
+
+    Sha256 hash;
+    hash.update(id.c_str(), id.size() + 1);
+    for (const auto &a : compile_args_)
+      hash.update(a.c_str(), a.size() + 1);
+    string path = unit.source_.string();
+    hash.update(path.c_str(), path.size() + 1);
+    string key = hash.hex();
+    unit.bmi_ = cache_dir_ / (key + ".pcm");
+    unit.object_ = cache_dir_ / (key + ".o");
+    unit.deps_ = cache_dir_ / (key + ".d");
+    scanned.push_back(unit);
+  }
+  error_code ec;
+  fs::create_directories(cache_dir_, ec);
+
+  // 2. Build them level by level: a unit is built once all the modules it
+  // imports are. Other imports (e.g. the standard library) are left to the
+  // compiler
+  vector<string> flags;
+  vector<bool> built(scanned.size(), false);
+  size_t remaining = scanned.size();
+  while (remaining > 0)
+  {
+    vector<size_t> level;
+    for (size_t i = 0; i < scanned.size(); i++)
+      if (!built[i] &&
+          all_of(scanned[i].imports_.begin(), scanned[i].imports_.end(),
+                 [&](const string &m)
+                 { return !providers.count(m) || built[providers[m]]; }))
+        level.push_back(i);
+    if (level.empty())
+      throw ZCError(ZC_COMPILATION_ERROR, "Cyclic module imports");
+
+    // The in-process compiler builds one unit at a time
+    size_t n_workers =
+        in_process_ ? 1
+                    : min<size_t>(level.size(),
+                                  max(1u, thread::hardware_concurrency()));
+    atomic<size_t> next{0};
+    vector<char> ok(level.size(), 0);
+    vector<thread> workers;
+    for (size_t w = 0; w < n_workers; w++)
+      workers.emplace_back(
+          [&]()
+          {
+            for (size_t i = next++; i < level.size(); i = next++)
+            {
+              const Unit &unit = scanned[level[i]];
+              vector<fs::path> imported;
+              for (const auto &m : unit.imports_)
+                if (providers.count(m))
+                  imported.push_back(scanned[providers.at(m)].bmi_);
+              ok[i] = buildUnit(unit, flags, imported);
+            }
+          });
+    for (auto &w : workers)
+      w.join();
+
+    for (size_t i = 0; i < level.size(); i++)
+    {
+      const Unit &unit = scanned[level[i]];
+      if (!ok[i])
+        throw ZCError(ZC_COMPILATION_ERROR,
+                      "Compilation failed: " + unit.source_.string());
+      flags.push_back("-fmodule-file=" + unit.name_ + "=" +
+                      unit.bmi_.string());
+      built[level[i]] = true;
+      remaining--;
+    }
+  }
+
+  objects.clear();
+  for (const auto &unit : scanned)
+    objects.push_back(unit.object_);
+  return flags;
+}
+
+void ModuleBuilder::scan(Unit &unit) const
+{
+  vector<string> args{scanDepsTool(in_process_ ? ZC_CLANG_PATH
+                                               : compile_args_[0]),
+                      "-format=p1689", "--"};
+  args.insert(args.end(), compile_args_.begin(), compile_args_.end());
+  args.insert(args.end(), {"-x", "c++-module", "-c", unit.source_.string(),
+                           "-o", unit.source_.string() + ".o"});
+
+  string output;
+  if (captureOutput(buildCommand(args) + " 2>/dev/null", output))
+    try
+    {
+      const json rule = json::parse(output).at("rules").at(0);
+      if (rule.contains("provides") && !rule["provides"].empty())
+        unit.name_ = rule["provides"][0].at("logical-name").get<string>();
+      if (rule.contains("requires"))
+        for (const auto &r : rule["requires"])
+          // Header units are looked up by path
+          if (r.value("lookup-method", "by-name") == "by-name")
+            unit.imports_.push_back(r.at("logical-name").get<string>());
+      return;
+    }
+    catch (const json::exception &)
+    {
+    }
+
+  File(unit.source_.string()).getModuleDeclarations(unit.name_,
+                                                    unit.imports_);
+}
+
+bool ModuleBuilder::buildUnit(const Unit &unit, const vector<string> &flags,
+                              const vector<fs::path> &imported) const
+{
+  if (isFresh(unit, imported))
+    return true;
+
+  // 1. The BMI and the object are built aside and renamed, as other runs may
+  // use them. The BMI is renamed last, so that a fresh BMI has its object
+  fs::path bmi = tempPath(unit.bmi_), object = tempPath(unit.object_),
+           deps = tempPath(unit.deps_);
+  vector<string> precompile = compile_args_;
+  precompile.insert(precompile.end(), flags.begin(), flags.end());
+  precompile.insert(precompile.end(),
+                    {"-x", "c++-module", unit.source_.string(), "--precompile",
+                     "-o", bmi.string(), "-MD", "-MF", deps.string()});
+
+  // 2. The object is generated from the BMI, without parsing the unit again
+  vector<string> compile = compile_args_;
+  compile.insert(compile.end(), flags.begin(), flags.end());
+  compile.insert(compile.end(), {"-Wno-unused-command-line-argument", "-c",
+                                 bmi.string(), "-o", object.string()});
+
+  bool built = runCompiler(precompile) && runCompiler(compile) &&
+               moveIntoPlace(object, unit.object_) &&
+               moveIntoPlace(deps, unit.deps_) && moveIntoPlace(bmi, unit.bmi_);
+  error_code ec;
+  for (const auto &path : {bmi, object, deps})
+    fs::remove(path, ec);
+  return built;
+}
+
+bool ModuleBuilder::isFresh(const Unit &unit,
+                            const vector<fs::path> &imported) const
+{
+  error_code ec;
+  auto bmi_time = fs::last_write_time(unit.bmi_, ec);
+  if (ec || !fs::exists(unit.object_, ec) || !fs::exists(unit.deps_, ec))
+    return false;
+
+  vector<string> files = readDependencies(unit.deps_);
+  if (files.empty())
+    return false;
+  for (const auto &bmi : imported)
+    files.push_back(bmi.string());
+  for (const auto &f : files)
+  {
+    auto time = fs::last_write_time(f, ec);
+    if (ec || time > bmi_time)
+      return false;
+  }
+  return true;
+}
+
+bool ModuleBuilder::runCompiler(const vector<string> &args) const
+{
+  if (in_process_)
+    return Compiler::getInstance().run(args);
+  return runCommand(args);
+}
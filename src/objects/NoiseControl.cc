@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <sys/personality.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <objects/NoiseControl.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+extern char **environ;
+
+using namespace std;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Capability allowing to raise the priority of a process
+const int CAP_SYS_NICE_BIT = 23;
+
+// Variables the shell changes from one command to the other
+const vector<string> VOLATILE_VARIABLES{"_", "OLDPWD", "SHLVL"};
+
+const string PADDING_VARIABLE = "ZC_ENV_PAD";
+
+string readLine(const string &file)
+{
+  ifstream input(file);
+  string line;
+  getline(input, line);
+  return line;
+}
+
+/**
+ * @brief Check if the effective capabilities of ZC include one
+ */
+bool hasCapability(int bit)
+{
+  ifstream status("/proc/self/status");
+  string line;
+  while (getline(status, line))
+    if (line.rfind("CapEff:", 0) == 0)
+      return (stoull(line.substr(7), nullptr, 16) >> bit) & 1;
+  return false;
+}
+
+string joinCpus(const vector<unsigned> &cpus)
+{
+  stringstream list;
+  for (size_t i = 0; i < cpus.size(); i++)
+    list << (i ? "," : "") << cpus[i];
+  return list.str();
+}
+
+} // namespace
+
+// ----------------------------------------------- NoiseControl class
+
+NoiseControl::NoiseControl(const vector<unsigned> &cpus, bool normalize,
+                           bool priority)
+    : cpus_(cpus), normalize_(normalize), priority_(priority)
+{
+  // The CPUs must be among the ones ZC may run on
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  CPU_ZERO(&cpu_set_);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  for (unsigned cpu : cpus_)
+  {
+    if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+      throw ZCError(ZC_BAD_COMMAND,
+                    "CPU " + to_string(cpu) + " isn't available");
+    CPU_SET(cpu, &cpu_set_);
+  }
+}
+
+bool NoiseControl::enabled() const
+{
+  return !cpus_.empty() || normalize_ || priority_;
+}
+
+void NoiseControl::check() const
+{
+  if (!enabled())
+    return;
+
+  // 1. The settings ZC may not be allowed to apply
+  if (normalize_)
+  {
+    // Set on ZC itself for a moment: a container may forbid it
+    int persona = personality(0xffffffff);
+    if (persona == -1 || personality(persona | ADDR_NO_RANDOMIZE) == -1)
+      warning("ASLR couldn't be disabled: the addresses will vary");
+    else
+      personality(persona);
+  }
+  struct rlimit nice_limit{};
+  getrlimit(RLIMIT_NICE, &nice_limit);
+  if (priority_ && !hasCapability(CAP_SYS_NICE_BIT) &&
+      nice_limit.rlim_cur < 40)
+    warning("The priority can't be raised without root or CAP_SYS_NICE");
+
+  // 2. The frequency of the CPUs the program runs on should not vary
+  vector<unsigned> cpus = cpus_;
+  if (cpus.empty())
+  {
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &allowed))
+        cpus.push_back(cpu);
+  }
+  vector<unsigned> scaled;
+  for (unsigned cpu : cpus)
+  {
+    string governor = readLine("/sys/devices/system/cpu/cpu" +
+                               to_string(cpu) + "/cpufreq/scaling_governor");
+    if (!governor.empty() && governor != "performance")
+      scaled.push_back(cpu);
+  }
+  if (!scaled.empty())
+    warning("The CPU governor isn't 'performance' on CPUs " +
+            joinCpus(scaled) + ": their frequency will vary");
+
+  if (readLine("/sys/devices/system/cpu/intel_pstate/no_turbo") == "0" ||
+      readLine("/sys/devices/system/cpu/cpufreq/boost") == "1")
+    warning("Turbo boost is enabled: the frequency will depend on the "
+            "temperature and the load of the other cores");
+}
+
+vector<string> NoiseControl::environment(const vector<string> &argv) const
+{
+  vector<string> env;
+  for (char **var = environ; *var; var++)
+    env.push_back(*var);
+  if (!normalize_)
+    return env;
+
+  // 1. Leave out what changes from one command to the other, in a fixed
+  // order
+  env.erase(remove_if(env.begin(), env.end(),
+                      [](const string &var)
+                      {
+                        string name = var.substr(0, var.find('='));
+                        return name == PADDING_VARIABLE ||
+                               find(VOLATILE_VARIABLES.begin(),
+                                    VOLATILE_VARIABLES.end(),
+                                    name) != VOLATILE_VARIABLES.end();
+                      }),
+            env.end());
+  sort(env.begin(), env.end());
+
+  // 2. Pad the strings copied onto the stack up to the next page
+  size_t size = PADDING_VARIABLE.size() + 2;
+  for (const auto &a : argv)
+    size += a.size() + 1;
+  for (const auto &var : env)
+    size += var.size() + 1;
+  size_t page = sysconf(_SC_PAGESIZE);
+  env.push_back(PADDING_VARIABLE + "=" +
+                string((page - size % page) % page, 'x'));
+  return env;
+}
+
+void NoiseControl::apply() const
+{
+  if (!cpus_.empty())
+    sched_setaffinity(0, sizeof(cpu_set_), &cpu_set_);
+  if (normalize_)
+    personality(personality(0xffffffff) | ADDR_NO_RANDOMIZE);
+  if (priority_)
+    setpriority(PRIO_PROCESS, 0, -20);
+}
@@ -0,0 +1,94 @@
+#include <fstream>
+
+#include <hash.hh>
+#include <objects/Compiler.hh>
+#include <objects/PchCache.hh>
+#include <objects/Registry.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// ----------------------------------------------- PchCache class
+
+fs::path PchCache::get(const vector<string> &compile_args,
+                       const vector<string> &headers, bool is_cpp,
+                       bool in_process) const
+{
+  if (compile_args.empty() || headers.empty())
+    return {};
+
+  // 1. The key covers everything the content of the PCH depends on
+  Sha256 hash;
+  string id = toolchainId(compile_args[0], in_process);
+  hash.update(id.c_str(), id.size() + 1);
+  for (const auto &a : compile_args)
+    hash.update(a.c_str(), a.size() + 1);
+  for (const auto &h : headers)
+    hash.update(h.c_str(), h.size() + 1);
+  hash.update(is_cpp ? "c++" : "c", is_cpp ? 4 : 2);
+  string key = hash.hex();
+
+  fs::path pch = cache_dir_ / (key + ".pch");
+  fs::path deps = cache_dir_ / (key + ".d");
+  fs::path failed = cache_dir_ / (key + ".failed");
+  if (isFresh(pch, deps))
+    return pch;
+
+  // Headers which couldn't be precompiled are tried again once libraries
+  // were installed
+  error_code ec;
+  fs::path registry = getZCRootDir() / REGISTRY;
+  if (fs::exists(failed, ec) &&
+      fs::last_write_time(failed, ec) >= fs::last_write_time(registry, ec))
+    return {};
+
+  // 2. Build the PCH aside and rename it, as other runs may use it
+  fs::create_directories(cache_dir_, ec);
+  fs::path header = cache_dir_ / (key + (is_cpp ? ".hpp" : ".h"));
+  {
+    ofstream output(header);
+    output << "/* This file was automatically generated by ZC */\n\n";
+    for (const auto &h : headers)
+      output << "#include <" << h << ">\n";
+  }
+
+  fs::path pch_tmp = tempPath(pch), deps_tmp = tempPath(deps);
+  vector<string> args = compile_args;
+  args.insert(args.end(), {"-x", is_cpp ? "c++-header" : "c-header",
+                           header.string(), "-o", pch_tmp.string(), "-MD",
+                           "-MF", deps_tmp.string()});
+
+  // A header the compiler doesn't find only means there is no PCH
+  bool built = in_process ? Compiler::getInstance().run(args)
+                          : runCommand(args, true);
+  built = built && moveIntoPlace(pch_tmp, pch) &&
+          moveIntoPlace(deps_tmp, deps);
+  fs::remove(pch_tmp, ec);
+  fs::remove(deps_tmp, ec);
+  if (built && isFresh(pch, deps))
+  {
+    fs::remove(failed, ec);
+    return pch;
+  }
+  ofstream marker(failed);
+  return {};
+}
+
+bool PchCache::isFresh(const fs::path &pch, const fs::path &deps) const
+{
+  error_code ec;
+  auto pch_time = fs::last_write_time(pch, ec);
+  if (ec || !fs::exists(deps, ec))
+    return false;
+
+  vector<string> files = readDependencies(deps);
+  if (files.empty())
+    return false;
+  for (const auto &f : files)
+  {
+    auto time = fs::last_write_time(f, ec);
+    if (ec || time > pch_time)
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,216 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <objects/PerfCounters.hh>
+#include <objects/ZCError.hh>
+
+using namespace std;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+uint64_t cacheEvent(uint64_t cache, uint64_t op, uint64_t result)
+{
+  return cache | (op << 8) | (result << 16);
+}
+
+long perfEventOpen(struct perf_event_attr &attr, pid_t pid, int group_fd)
+{
+  return syscall(SYS_perf_event_open, &attr, pid, -1, group_fd,
+                 PERF_FLAG_FD_CLOEXEC);
+}
+
+string perfParanoid()
+{
+  ifstream input("/proc/sys/kernel/perf_event_paranoid");
+  string level;
+  getline(input, level);
+  return level;
+}
+
+string formatCount(double value)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.0f", value);
+  string digits = buffer;
+  // Thousands separators
+  for (int i = (int)digits.size() - 3; i > (digits[0] == '-' ? 1 : 0); i -= 3)
+    digits.insert(i, ",");
+  return digits;
+}
+
+string formatRatio(const char *format, double value)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), format, value);
+  return buffer;
+}
+
+} // namespace
+
+// ----------------------------------------------- PerfCounters class
+
+PerfCounters::~PerfCounters()
+{
+  for (auto &group : groups_)
+    for (auto &c : group)
+      if (c.fd_ >= 0)
+        close(c.fd_);
+}
+
+void PerfCounters::attach(pid_t pid)
+{
+  // 1. The hardware events, grouped by what their metrics compare
+  vector<vector<Counter>> hardware{
+      {{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+       {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+       {"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+       {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}},
+      {{"cache-references", PERF_TYPE_HARDWARE,
+        PERF_COUNT_HW_CACHE_REFERENCES},
+       {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+       {"L1-dcache-loads", PERF_TYPE_HW_CACHE,
+        cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                   PERF_COUNT_HW_CACHE_RESULT_ACCESS)},
+       {"L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+        cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                   PERF_COUNT_HW_CACHE_RESULT_MISS)}}};
+  for (auto &group : hardware)
+    if (openGroup(group, pid))
+    {
+      groups_.push_back(group);
+      hardware_ = true;
+    }
+
+  // 2. The software events, counted by the kernel whatever the hardware
+  vector<Counter> software{
+      {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+      {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+      {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+      {"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS}};
+  if (openGroup(software, pid))
+    groups_.push_back(software);
+
+  if (groups_.empty())
+    throw ZCError(ZC_INTERNAL_ERROR,
+                  "Performance counters are not available "
+                  "(kernel.perf_event_paranoid = " +
+                      perfParanoid() + ")");
+  if (!hardware_)
+    warning("Hardware counters are not available (container or VM?), only "
+            "software events are counted");
+}
+
+bool PerfCounters::openGroup(vector<Counter> &group, pid_t pid)
+{
+  int leader = -1;
+  for (auto it = group.begin(); it != group.end();)
+  {
+    struct perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = it->type_;
+    attr.config = it->config_;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.inherit = 1;
+    // The leader starts the whole group when the program is executed
+    attr.disabled = leader < 0;
+    attr.enable_on_exec = leader < 0;
+    attr.exclude_hv = 1;
+
+    it->fd_ = perfEventOpen(attr, pid, leader);
+    // Unprivileged users may only count the user space
+    if (it->fd_ < 0 && (errno == EACCES || errno == EPERM))
+    {
+      attr.exclude_kernel = 1;
+      it->fd_ = perfEventOpen(attr, pid, leader);
+    }
+
+    if (it->fd_ < 0)
+    {
+      if (leader < 0)
+        return false;
+      it = group.erase(it);
+      continue;
+    }
+    if (leader < 0)
+      leader = it->fd_;
+    ++it;
+  }
+  return true;
+}
+
+void PerfCounters::read()
+{
+  for (auto &group : groups_)
+    for (auto &c : group)
+    {
+      uint64_t data[3] = {0, 0, 0};
+      if (::read(c.fd_, data, sizeof(data)) != sizeof(data) || data[2] == 0)
+        continue;
+      // Multiplexed: the count is extrapolated to the whole run
+      c.measured_ = (double)data[2] / data[1];
+      c.value_ = data[0] / c.measured_;
+    }
+}
+
+Table PerfCounters::table() const
+{
+  vector<vector<string>> content{{"Event", "Count", "Counted"}};
+  for (const auto &group : groups_)
+    for (const auto &c : group)
+      content.push_back(
+          {c.name_,
+           c.name_ == "task-clock"
+               ? formatRatio("%.2f ms", c.value_ / 1e6)
+               : formatCount(c.value_),
+           c.measured_ > 0 ? formatRatio("%.1f %%", c.measured_ * 100)
+                           : "not counted"});
+  return Table(content.size(), 3, true, true, content);
+}
+
+Table PerfCounters::metrics() const
+{
+  vector<vector<string>> content{{"Metric", "Value"}};
+  auto add = [&](const string &name, double numerator, double denominator,
+                 double factor, const char *format)
+  {
+    if (numerator >= 0 && denominator > 0)
+      content.push_back(
+          {name, formatRatio(format, numerator / denominator * factor)});
+  };
+
+  double instructions = get("instructions");
+  add("Instructions per cycle", instructions, get("cycles"), 1, "%.2f");
+  add("Frequency", get("cycles"), get("task-clock"), 1, "%.2f GHz");
+  add("Branch miss rate", get("branch-misses"), get("branches"), 100,
+      "%.2f %%");
+  add("Branch MPKI", get("branch-misses"), instructions, 1000, "%.2f");
+  add("Cache miss rate", get("cache-misses"), get("cache-references"), 100,
+      "%.2f %%");
+  add("Cache MPKI", get("cache-misses"), instructions, 1000, "%.2f");
+  add("L1 data load miss rate", get("L1-dcache-load-misses"),
+      get("L1-dcache-loads"), 100, "%.2f %%");
+  add("L1 data MPKI", get("L1-dcache-load-misses"), instructions, 1000,
+      "%.2f");
+  return Table(content.size(), 2, true, true, content);
+}
+
+bool PerfCounters::hasHardware() const { return hardware_; }
+
+double PerfCounters::get(const string &name) const
+{
+  for (const auto &group : groups_)
+    for (const auto &c : group)
+      if (c.name_ == name)
+        return c.measured_ > 0 ? c.value_ : -1;
+  return -1;
+}
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
+
+#include <hash.hh>
+#include <nlohmann/json.hpp>
+#include <objects/Postman.hh>
+#include <objects/Settings.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Content-defined chunking boundaries (bytes)
+const size_t MIN_CHUNK = 8 * 1024;
+const uint64_t CHUNK_MASK = (1 << 15) - 1; // ~32 KiB on average
+
+const size_t MAX_WORKERS = 16;
+
+/**
+ * @brief Random values of the gear rolling hash, generated deterministically
+ * so that every ZC instance cuts files at the same boundaries
+ */
+struct GearTable
+{
+  uint64_t values[256];
+
+  GearTable()
+  {
+    uint64_t seed = 0x5a43'4348'554e'4b53; // "ZCCHUNKS"
+    for (auto &v : values)
+    {
+      // splitmix64
+      seed += 0x9e3779b97f4a7c15;
+      uint64_t z = seed;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+      v = z ^ (z >> 31);
+    }
+  }
+};
+
+/**
+ * @brief Split data into chunks whose boundaries depend on the content only,
+ * so an insertion in a file doesn't change the chunks after it
+ *
+ * @return The sizes of the chunks
+ */
+vector<size_t> cutChunks(const string &data)
+{
+  static const GearTable gear;
+  vector<size_t> sizes;
+  size_t start = 0;
+  while (start < data.size())
+  {
+    size_t end = min(start + MAX_CHUNK, data.size());
+    size_t i = min(start + MIN_CHUNK, end);
+    uint64_t h = 0;
+    for (; i < end; i++)
+    {
+      h = (h << 1) + gear.values[(unsigned char)data[i]];
+      if ((h & CHUNK_MASK) == 0)
+      {
+        i++;
+        break;
+      }
+    }
+    sizes.push_back(i - start);
+    start = i;
+  }
+  return sizes;
+}
+
+bool readAll(const fs::path &path, string &data)
+{
+  ifstream input(path, ios::binary);
+  if (!input.is_open())
+    return false;
+  data.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+  return true;
+}
+
+size_t workerCount(size_t jobs)
+{
+  size_t hw = max(1u, thread::hardware_concurrency());
+  // Transfers wait on I/O, so use more workers than cores
+  return max<size_t>(1, min({jobs, hw * 2, MAX_WORKERS}));
+}
+
+} // namespace
+
+// ----------------------------------------------- Postman class
+
+Postman::Postman() : server_(Settings::getInstance().getPackageServer()) {}
+
+Postman &Postman::getInstance()
+{
+  static Postman instance;
+  return instance;
+}
+
+void Postman::setServer(const string &server) { server_ = server; }
+
+fs::path Postman::chunkPath(const string &hash) const
+{
+  return chunks_path_ / hash.substr(0, 2) / hash;
+}
+
+bool Postman::uploadPackage(const Package &package, const vector<File> &headers,
+                            const vector<File> &binaries)
+{
+  unique_ptr<Transport> transport = Transport::open(server_);
+  const fs::path root = getZCRootDir();
+
+  // Binaries are referenced relatively to the ZC root directory, so that the
+  // package can be installed in any home directory
+  Package published = package;
+  for (auto &b : published.binaries_)
+    b = fs::path(b).lexically_relative(root).string();
+
+  json manifest;
+  manifest["package"] = published;
+  manifest["files"] = json::array();
+
+  size_t sent = 0, total = 0;
+  vector<File> files = headers;
+  files.insert(files.end(), binaries.begin(), binaries.end());
+  for (const auto &f : files)
+  {
+    string data;
+    if (!readAll(f.getPath_(), data))
+      throw ZCError(ZC_NOT_FOUND, "File not found: " + f.getPath_());
+
+    json chunks = json::array();
+    size_t offset = 0;
+    for (size_t size : cutChunks(data))
+    {
+      string chunk = data.substr(offset, size);
+      string hash = sha256(chunk);
+      offset += size;
+      chunks.push_back(hash);
+      total++;
+
+      // Chunks shared with other packages are already there
+      if (transport->hasChunk(hash))
+        continue;
+      if (!transport->putChunk(hash, chunk))
+        return false;
+      sent++;
+    }
+
+    manifest["files"].push_back(
+        {{"path", fs::path(f.getPath_()).lexically_relative(root).string()},
+         {"size", data.size()},
+         {"hash", sha256(data)},
+         {"mode", (unsigned)fs::status(f.getPath_()).permissions()},
+         {"chunks", chunks}});
+  }
+
+  info("Uploaded " + to_string(sent) + " new chunks out of " +
+       to_string(total));
+  return transport->putManifest(package.name_, manifest.dump());
+}
+
+bool Postman::downloadPackage(const string &target)
+{
+  return downloadPackages({target}).empty();
+}
+
+bool Postman::fetchChunk(const string &hash, Transport &transport) const
+{
+  fs::path path = chunkPath(hash);
+  if (fs::exists(path))
+    return true;
+  fs::create_directories(path.parent_path());
+
+  // Resume from what a previous transfer already wrote
+  fs::path part = path;
+  part += ".part";
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    size_t offset = fs::exists(part) ? fs::file_size(part) : 0;
+    string data;
+    if (!transport.getChunk(hash, offset, data))
+      return false;
+    {
+      ofstream output(part, ios::binary | ios::app);
+      output.write(data.data(), data.size());
+      if (!output.good())
+        return false;
+    }
+
+    string content;
+    if (readAll(part, content) && sha256(content) == hash)
+    {
+      fs::rename(part, path);
+      return true;
+    }
+    // Corrupted partial transfer: start over
+    fs::remove(part);
+  }
+  return false;
+}
+
+vector<string> Postman::downloadPackages(const vector<string> &targets)
+{
+  unique_ptr<Transport> transport = Transport::open(server_);
+  vector<string> failed;
+
+  // 1. Fetch the manifests and list the chunks which are not cached yet
+  vector<json> manifests;
+  set<string> all, missing;
+  for (const auto &target : targets)
+  {
+    string data;
+    if (!transport->getManifest(target, data))
+    {
+      warning("Package not found on the server: " + target);
+      failed.push_back(target);
+      continue;
+    }
+    json manifest;
+    try
+    {
+      manifest = json::parse(data);
+      // The name ends up in the paths of the staging and include
+      // directories, and the registry
+      string name = manifest.at("package").get<Package>().name_;
+      if (!Transport::isValidName(name) || name != target)
+        throw runtime_error("it is for the package \"" + name + "\"");
+      for (const auto &f : manifest.at("files"))
+        for (const auto &c : f.at("chunks"))
+        {
+          string hash = c.get<string>();
+          if (!isSha256(hash))
+            throw runtime_error("invalid chunk hash " + hash);
+          if (all.insert(hash).second && !fs::exists(chunkPath(hash)))
+            missing.insert(hash);
+        }
+    }
+    catch (const exception &e)
+    {
+      warning("Invalid manifest for " + target + ": " + e.what());
+      failed.push_back(target);
+      continue;
+    }
+    manifests.push_back(manifest);
+  }
+
+  // 2. Download the missing chunks in parallel, each worker with its own
+  // connection
+  vector<string> queue(missing.begin(), missing.end());
+  info("Downloading " + to_string(queue.size()) + " chunks (" +
+       to_string(all.size() - queue.size()) + " already cached)...");
+
+  atomic<size_t> next{0};
+  mutex errors_mutex;
+  vector<string> errors;
+  vector<thread> workers;
+  for (size_t w = 0; w < workerCount(queue.size()); w++)
+    workers.emplace_back(
+        [&]()
+        {
+          try
+          {
+            unique_ptr<Transport> t = Transport::open(server_);
+            for (size_t i = next++; i < queue.size(); i = next++)
+              if (!fetchChunk(queue[i], *t))
+              {
+                lock_guard<mutex> lock(errors_mutex);
+                errors.push_back(queue[i]);
+              }
+          }
+          catch (const exception &e)
+          {
+            lock_guard<mutex> lock(errors_mutex);
+            errors.push_back(e.what());
+          }
+        });
+  for (auto &w : workers)
+    w.join();
+  for (const auto &e : errors)
+    warning("Couldn't download chunk: " + e);
+
+  // 3. Assemble each package in a staging directory, verify it and move it
+  // into the registry
+  Registry &registry = Registry::getInstance();
+  for (const auto &manifest : manifests)
+  {
+    Package package = manifest.at("package").get<Package>();
+    fs::path staging =
+        staging_path_ / (package.name_ + "." + to_string(getpid()));
+    fs::remove_all(staging);
+    bool ok = true;
+    for (const auto &f : manifest.at("files"))
+    {
+      // Only write inside the include and lib directories
+      fs::path rel = fs::path(f.at("path").get<string>()).lexically_normal();
+      if (rel.is_absolute() || rel.empty() ||
+          (*rel.begin() != "include" && *rel.begin() != "lib"))
+      {
+        ok = false;
+        break;
+      }
+      fs::path dest = staging / rel;
+      fs::create_directories(dest.parent_path());
+
+      Sha256 h;
+      ofstream output(dest, ios::binary);
+      for (const auto &c : f.at("chunks"))
+      {
+        string chunk;
+        if (!readAll(chunkPath(c.get<string>()), chunk))
+        {
+          ok = false;
+          break;
+        }
+        h.update(chunk.data(), chunk.size());
+        output.write(chunk.data(), chunk.size());
+      }
+      output.close();
+      if (!ok || h.hex() != f.at("hash").get<string>())
+      {
+        ok = false;
+        break;
+      }
+      fs::permissions(dest, (fs::perms)(f.value("mode", 0644u) & 0777));
+    }
+    for (const auto &b : package.binaries_)
+      if (!Registry::isValidBinary(b) || !fs::exists(staging / b))
+        ok = false;
+
+    if (!ok)
+    {
+      warning("Package " + package.name_ + " is incomplete or corrupted.");
+      failed.push_back(package.name_);
+      fs::remove_all(staging);
+      continue;
+    }
+    registry.installPackage(package, staging);
+    fs::remove_all(staging);
+    success("Package installed: " + package.name_);
+  }
+  return failed;
+}
@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include <objects/Profile.hh>
+#include <objects/Symbolizer.hh>
+#include <objects/ZCError.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Size of the flame graph, in pixels
+const double GRAPH_WIDTH = 1200;
+const double FRAME_HEIGHT = 16;
+const double GLYPH_WIDTH = 7;
+
+/**
+ * @brief A node of the tree of the stacks, drawn as a box of the flame graph
+ */
+struct Frame
+{
+  string name_;
+  size_t count_ = 0;
+  vector<Frame> children_;
+
+  Frame &child(const string &name)
+  {
+    for (auto &c : children_)
+      if (c.name_ == name)
+        return c;
+    children_.push_back({name, 0, {}});
+    return children_.back();
+  }
+};
+
+vector<string> splitFrames(const string &stack)
+{
+  vector<string> frames;
+  stringstream ss(stack);
+  string frame;
+  while (getline(ss, frame, ';'))
+    frames.push_back(frame);
+  return frames;
+}
+
+/**
+ * @brief Get a function name, without the separators of the folded stacks
+ */
+string foldable(string name)
+{
+  replace(name.begin(), name.end(), ';', ':');
+  replace(name.begin(), name.end(), '\n', ' ');
+  return name;
+}
+
+string percent(size_t count, size_t total)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.1f %%",
+           total ? 100.0 * count / total : 0.0);
+  return buffer;
+}
+
+string escapeXml(const string &text)
+{
+  string escaped;
+  for (char c : text)
+    switch (c)
+    {
+    case '&':
+      escaped += "&amp;";
+      break;
+    case '<':
+      escaped += "&lt;";
+      break;
+    case '>':
+      escaped += "&gt;";
+      break;
+    case '"':
+      escaped += "&quot;";
+      break;
+    default:
+      escaped += c;
+    }
+  return escaped;
+}
+
+} // namespace
+
+// ----------------------------------------------- Profile class
+
+Profile Profile::fromSamples(const fs::path &samples)
+{
+  ifstream input(samples);
+  if (!input.is_open())
+    throw ZCError(ZC_NOT_FOUND, "No profile was written: the program may have "
+                                "crashed or exited with _exit");
+
+  // 1. The header and the executable mappings
+  string line;
+  getline(input, line);
+  if (line != "zcprof 1")
+    throw ZCError(ZC_PARSING_ERROR, "Unknown profile format: " + line);
+  Symbolizer symbolizer;
+  size_t dropped = 0;
+  while (getline(input, line) && line != "samples")
+  {
+    if (line.rfind("dropped ", 0) == 0)
+      dropped = stoull(line.substr(8));
+    symbolizer.addMapping(line);
+  }
+  if (dropped > 0)
+    warning(to_string(dropped) + " samples were dropped: the buffer of the "
+                                 "sampler was full");
+
+  // 2. The stacks, leaf first, become folded stacks. Return addresses are
+  // symbolized at the call, one byte before
+  Profile profile;
+  while (getline(input, line))
+  {
+    stringstream addresses(line);
+    vector<uintptr_t> stack;
+    string hex;
+    while (addresses >> hex)
+      stack.push_back(stoull(hex, nullptr, 16) - (stack.empty() ? 0 : 1));
+
+    string folded;
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+    {
+      const vector<string> &names = symbolizer.symbolize(*it);
+      // The inlined functions are called by the function they are in
+      for (auto name = names.rbegin(); name != names.rend(); ++name)
+        folded += (folded.empty() ? "" : ";") + foldable(*name);
+    }
+    if (!folded.empty())
+      profile.add(folded, 1);
+  }
+  return profile;
+}
+
+Profile Profile::load(const fs::path &file)
+{
+  ifstream input(file);
+  if (!input.is_open())
+    throw ZCError(ZC_NOT_FOUND, "File not found: " + file.string());
+  Profile profile;
+  string line;
+  while (getline(input, line))
+  {
+    size_t space = line.rfind(' ');
+    if (line.empty())
+      continue;
+    try
+    {
+      if (space == string::npos)
+        throw invalid_argument(line);
+      profile.add(line.substr(0, space), stoull(line.substr(space + 1)));
+    }
+    catch (const logic_error &)
+    {
+      throw ZCError(ZC_PARSING_ERROR, "Invalid folded stack in " +
+                                          file.string() + ": " + line);
+    }
+  }
+  return profile;
+}
+
+void Profile::save(const fs::path &file) const
+{
+  ofstream output(file);
+  if (!output.is_open())
+    throw ZCError(ZC_WRITING_ERROR,
+                  "The profile couldn't be written: " + file.string());
+  for (const auto &[stack, count] : stacks_)
+    output << stack << " " << count << "\n";
+}
+
+void Profile::saveFlameGraph(const fs::path &file, const string &title) const
+{
+  // 1. Merge the stacks into a tree
+  Frame root{"all", total_, {}};
+  size_t depth = 0;
+  for (const auto &[stack, count] : stacks_)
+  {
+    Frame *frame = &root;
+    vector<string> frames = splitFrames(stack);
+    for (const auto &name : frames)
+    {
+      frame = &frame->child(name);
+      frame->count_ += count;
+    }
+    depth = max(depth, frames.size());
+  }
+
+  ofstream output(file);
+  if (!output.is_open())
+    throw ZCError(ZC_WRITING_ERROR,
+                  "The flame graph couldn't be written: " + file.string());
+
+  // 2. Draw each frame above its caller, the root at the bottom
+  double height = (depth + 1) * FRAME_HEIGHT + 60;
+  double scale = (GRAPH_WIDTH - 20) / max<size_t>(total_, 1);
+  output << "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+         << "<svg version=\"1.1\" width=\"" << GRAPH_WIDTH << "\" height=\""
+         << height << "\" xmlns=\"http://www.w3.org/2000/svg\" "
+         << "font-family=\"monospace\" font-size=\"12\">\n"
+         << "<rect width=\"100%\" height=\"100%\" fill=\"#f8f8f8\"/>\n"
+         << "<text x=\"" << GRAPH_WIDTH / 2
+         << "\" y=\"24\" text-anchor=\"middle\" font-size=\"16\">"
+         << escapeXml(title) << " (" << total_ << " samples)</text>\n";
+
+  function<void(const Frame &, size_t, double)> draw =
+      [&](const Frame &frame, size_t level, double x)
+  {
+    double width = frame.count_ * scale;
+    if (width < 0.1)
+      return;
+    double y = height - 20 - (level + 1) * FRAME_HEIGHT;
+    size_t hash = std::hash<string>()(frame.name_);
+    output << "<g><title>" << escapeXml(frame.name_) << " (" << frame.count_
+           << " samples, " << percent(frame.count_, total_)
+           << ")</title><rect x=\"" << 10 + x << "\" y=\"" << y
+           << "\" width=\"" << width << "\" height=\"" << FRAME_HEIGHT - 1
+           << "\" rx=\"2\" fill=\"rgb(" << 205 + hash % 50 << ","
+           << (hash >> 8) % 230 << "," << (hash >> 16) % 55 << ")\"/>";
+    size_t fits = (width - 6) / GLYPH_WIDTH;
+    if (fits >= 3)
+    {
+      string label = frame.name_.size() <= fits
+                         ? frame.name_
+                         : frame.name_.substr(0, fits - 2) + "..";
+      output << "<text x=\"" << 13 + x << "\" y=\"" << y + FRAME_HEIGHT - 4
+             << "\">" << escapeXml(label) << "</text>";
+    }
+    output << "</g>\n";
+
+    for (const auto &child : frame.children_)
+    {
+      draw(child, level + 1, x);
+      x += child.count_ * scale;
+    }
+  };
+  draw(root, 0, 0);
+  output << "</svg>\n";
+}
+
+Table Profile::table(size_t n) const
+{
+  map<string, size_t> self, inclusive;
+  getFunctions(self, inclusive);
+  vector<pair<string, size_t>> functions(self.begin(), self.end());
+  sort(functions.begin(), functions.end(),
+       [](const auto &a, const auto &b) { return a.second > b.second; });
+  if (functions.size() > n)
+    functions.resize(n);
+
+  vector<vector<string>> content{{"Function", "Self", "Inclusive"}};
+  for (const auto &[name, count] : functions)
+    content.push_back({name,
+                       percent(count, total_) + " (" + to_string(count) + ")",
+                       percent(inclusive[name], total_) + " (" +
+                           to_string(inclusive[name]) + ")"});
+  Table table(content.size(), 3, true, true, content);
+  table.setMaxWidth(80);
+  return table;
+}
+
+Table Profile::diff(const Profile &baseline, const Profile &candidate,
+                    size_t n)
+{
+  map<string, size_t> base_self, cand_self, unused;
+  baseline.getFunctions(base_self, unused);
+  candidate.getFunctions(cand_self, unused);
+
+  // The shares of the samples are compared, the runs lasting differently
+  map<string, double> change;
+  for (const auto &[name, count] : base_self)
+    change[name] -= 100.0 * count / max<size_t>(baseline.total_, 1);
+  for (const auto &[name, count] : cand_self)
+    change[name] += 100.0 * count / max<size_t>(candidate.total_, 1);
+  vector<pair<string, double>> functions(change.begin(), change.end());
+  sort(functions.begin(), functions.end(), [](const auto &a, const auto &b)
+       { return fabs(a.second) > fabs(b.second); });
+  if (functions.size() > n)
+    functions.resize(n);
+
+  vector<vector<string>> content{
+      {"Function", "Baseline self", "Candidate self", "Change"}};
+  for (const auto &[name, delta] : functions)
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%+.1f pts", delta);
+    content.push_back({name, percent(base_self[name], baseline.total_),
+                       percent(cand_self[name], candidate.total_), buffer});
+  }
+  Table table(content.size(), 4, true, true, content);
+  table.setMaxWidth(80);
+  return table;
+}
+
+size_t Profile::getSamples() const { return total_; }
+
+void Profile::add(const string &stack, size_t count)
+{
+  stacks_[stack] += count;
+  total_ += count;
+}
+
+void Profile::getFunctions(map<string, size_t> &self,
+                           map<string, size_t> &inclusive) const
+{
+  for (const auto &[stack, count] : stacks_)
+  {
+    vector<string> frames = splitFrames(stack);
+    if (frames.empty())
+      continue;
+    self[frames.back()] += count;
+    // Recursive functions are counted once per stack
+    for (const auto &name : set<string>(frames.begin(), frames.end()))
+      inclusive[name] += count;
+  }
+}
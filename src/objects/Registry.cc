@@ -1,11 +1,30 @@
 #include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
 #include <sstream>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <hash.hh>
 #include <nlohmann/json.hpp>
+#include <objects/Compiler.hh>
 #include <objects/Registry.hh>
+#include <objects/SearchIndex.hh>
+#include <objects/Settings.hh>
 #include <objects/ZCError.hh>
 #include <zcio.hh>
 
@@ -13,6 +32,202 @@ using namespace std;
 namespace fs = std::filesystem;
 using json = nlohmann::json;
 
+namespace
+{
+/**
+ * @brief Get the optimization level (0 to 3) set by a list of flags, the
+ * last -O flag winning like it does for the compiler
+ */
+int optLevel(const vector<string> &flags)
+{
+  int level = 0;
+  for (const auto &f : flags)
+  {
+    if (f.rfind("-O", 0) != 0)
+      continue;
+    string l = f.substr(2);
+    if (l == "0" || l == "g")
+      level = 0;
+    else if (l.empty() || l == "1")
+      level = 1;
+    else if (l == "2" || l == "s" || l == "z")
+      level = 2;
+    else
+      level = 3; // -O3, -Ofast
+  }
+  return level;
+}
+
+/**
+ * @brief Get the rank of an x86-64 ISA level (0 if it is unknown)
+ */
+int isaRank(const string &level)
+{
+  if (level == "x86-64")
+    return 1;
+  if (level == "x86-64-v2")
+    return 2;
+  if (level == "x86-64-v3")
+    return 3;
+  if (level == "x86-64-v4")
+    return 4;
+  return 0;
+}
+
+/**
+ * @brief Get the -march flag of a list of flags (empty if there is none)
+ */
+string arch(const vector<string> &flags)
+{
+  string march;
+  for (const auto &f : flags)
+    if (f.rfind("-march=", 0) == 0)
+      march = f;
+  return march;
+}
+
+/**
+ * @brief Create a file with the content of a blob, sharing its storage: a
+ * hardlink, else a reflink, else a copy done by the kernel
+ */
+bool linkBlob(const fs::path &blob, const fs::path &dest)
+{
+  error_code ec;
+  fs::create_hard_link(blob, dest, ec);
+  if (!ec)
+    return true;
+#ifdef __linux__
+  int in = open(blob.c_str(), O_RDONLY | O_CLOEXEC);
+  int out = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444);
+  bool ok = in >= 0 && out >= 0;
+  if (ok && ioctl(out, FICLONE, in) != 0)
+  {
+    // copy_file_range still shares extents on the filesystems that can
+    struct stat st;
+    ok = fstat(in, &st) == 0;
+    for (off_t left = st.st_size; ok && left > 0;)
+    {
+      ssize_t n = copy_file_range(in, nullptr, out, nullptr, left, 0);
+      ok = n > 0;
+      left -= n;
+    }
+  }
+  if (in >= 0)
+    close(in);
+  if (out >= 0)
+    close(out);
+  return ok;
+#else
+  return fs::copy_file(blob, dest, ec) && !ec;
+#endif
+}
+
+/**
+ * @brief Create a directory only the user can access, for the files of an
+ * installation. Its name is unique, so concurrent installations don't share
+ * it, and nobody else can plant a file or a link in it
+ */
+fs::path makeWorkDir(const string &prefix)
+{
+  fs::path staging = getZCRootDir() / STAGING;
+  fs::create_directories(staging);
+  string pattern = (staging / (prefix + ".XXXXXX")).string();
+  if (!mkdtemp(pattern.data()))
+    throw ZCError(ZC_WRITING_ERROR,
+                  "Couldn't create a directory in " + staging.string());
+  return pattern;
+}
+
+/**
+ * @brief A private directory in the staging directory (see makeWorkDir),
+ * removed with its content when it goes out of scope
+ */
+class WorkDir
+{
+public:
+  explicit WorkDir(const string &prefix) : path_(makeWorkDir(prefix)) {}
+  ~WorkDir()
+  {
+    error_code ec;
+    fs::remove_all(path_, ec);
+  }
+
+  WorkDir(const WorkDir &) = delete;
+  WorkDir &operator=(const WorkDir &) = delete;
+
+  const fs::path &path() const { return path_; }
+
+private:
+  fs::path path_;
+};
+
+/**
+ * @brief Check whether a header can be included twice: it has #pragma once
+ * or its first directives are an include guard
+ */
+bool hasIncludeGuard(const fs::path &header)
+{
+  ifstream input(header);
+  string line, guard;
+  while (getline(input, line))
+  {
+    size_t pos = line.find_first_not_of(" \t");
+    if (pos == string::npos || line[pos] != '#')
+      continue;
+    stringstream directive(line.substr(pos + 1));
+    string name, macro;
+    directive >> name >> macro;
+    if (name == "pragma" && macro == "once")
+      return true;
+    if (guard.empty() && name == "ifndef")
+      guard = macro;
+    else
+      return !guard.empty() && name == "define" && macro == guard;
+  }
+  return false;
+}
+
+/**
+ * @brief Get the name of the Clang module of a package, which must be an
+ * identifier
+ */
+string moduleName(const string &pkg_name)
+{
+  string name = "zc_" + pkg_name;
+  for (auto &c : name)
+    if (!isalnum((unsigned char)c))
+      c = '_';
+  return name;
+}
+
+/**
+ * @brief Guess whether headers are C++ from their extensions
+ */
+bool hasCppHeaders(const vector<string> &headers)
+{
+  for (const auto &h : headers)
+  {
+    string ext = fs::path(h).extension().string();
+    if (ext == ".hpp" || ext == ".hh" || ext == ".hxx" || ext == ".h++")
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Identify a version of a file by its modification time and size
+ */
+string fileStamp(const fs::path &path)
+{
+  error_code ec;
+  auto time = fs::last_write_time(path, ec);
+  auto size = fs::file_size(path, ec);
+  if (ec)
+    return "";
+  return to_string(time.time_since_epoch().count()) + ":" + to_string(size);
+}
+} // namespace
+
 Registry::Registry() { load(); }
 
 Registry &Registry::getInstance()
@@ -31,6 +246,8 @@ void from_json(const json &j, StdPackage &p)
   j.at(1).get_to(p.headers_);  // Index 1: ["math.h"]
   j.at(2).get_to(p.binaries_); // Index 2: []
   j.at(3).get_to(p.flags_);    // Index 3: "-lm"
+  if (j.size() > 4)
+    j.at(4).get_to(p.cflags_); // Index 4: "-fopenmp"
 }
 
 void from_json(const json &j, Package &p)
@@ -45,6 +262,16 @@ void from_json(const json &j, Package &p)
   j.at(3).get_to(p.flags_);    // Index 3: "-lm"
   j.at(4).get_to(p.version_);  // Index 4: "0.0.0"
   j.at(5).get_to(p.author_);   // Index 5: "std"
+  if (j.size() > 6)
+    j.at(6).get_to(p.symbols_); // Index 6: ["sqrt", "cos"]
+  if (j.size() > 7)
+    j.at(7).get_to(p.variants_); // Index 7: ["debug", "release"]
+  if (j.size() > 8)
+    j.at(8).get_to(p.isa_); // Index 8: ["x86-64-v3", "x86-64-v4"]
+  if (j.size() > 9)
+    j.at(9).get_to(p.dependencies_); // Index 9: ["m", "mylib"]
+  if (j.size() > 10)
+    j.at(10).get_to(p.cflags_); // Index 10: "-pthread"
 }
 
 void to_json(json &j, const Package &p)
@@ -55,7 +282,23 @@ void to_json(json &j, const Package &p)
       p.binaries_, // Index 2
       p.flags_,    // Index 3
       p.version_,  // Index 4
-      p.author_    // Index 5
+      p.author_,   // Index 5
+      p.symbols_,  // Index 6
+      p.variants_, // Index 7
+      p.isa_,          // Index 8
+      p.dependencies_, // Index 9
+      p.cflags_        // Index 10
+  });
+}
+
+void to_json(json &j, const StdPackage &p)
+{
+  j = json::array({
+      p.name_,     // Index 0
+      p.headers_,  // Index 1
+      p.binaries_, // Index 2
+      p.flags_,    // Index 3
+      p.cflags_    // Index 4
   });
 }
 
@@ -69,6 +312,7 @@ void Registry::load()
                       registry_path_.string());
     return;
   }
+  registry_stamp_ = fileStamp(registry_path_);
   ifstream input(registry_path_);
   if (!input.is_open())
     throw ZCError(ZC_CONFIG_READING_ERROR,
@@ -88,6 +332,7 @@ void Registry::load()
     packages_ = json_registry.at("libraries").get<vector<Package>>();
   if (json_registry.contains("std_libraries"))
     std_packages_ = json_registry.at("std_libraries").get<vector<StdPackage>>();
+  readResolved();
 }
 
 void Registry::savePackage(Package &package, bool force,
@@ -103,22 +348,63 @@ void Registry::savePackage(Package &package, bool force,
     {
       throw ZCError(ZC_OPERATIONS_ABORTED, "Operations aborted.");
     }
+  if (fs::exists(package_dir))
+    releaseHeaders(package_dir);
   fs::create_directories(package_dir);
 
-  // 2. Install header files
-  vector<string> installed_headers;
+  // 2. Install header files, identical headers of several packages being
+  // stored once. They keep their path relative to the current directory, the
+  // ones outside of it only their name
   for (const auto &h : headers)
   {
-    fs::create_directories(package_dir);
-    fs::path dest = package_dir / h;
+    fs::path name =
+        fs::absolute(h).lexically_normal().lexically_relative(
+            fs::current_path());
+    if (name.empty() || *name.begin() == "..")
+      name = h.filename();
+    storeHeader(h, package_dir / name, false);
+    package.headers_.push_back(name.string());
+  }
 
-    fs::copy(h, dest, fs::copy_options::overwrite_existing);
-    package.headers_.push_back(h.string());
+  // 3. Collect the public interface of the library from its headers. The
+  // sources are then compiled with hidden visibility and only the declared
+  // symbols are exported, which keeps the dynamic symbol table small and lets
+  // internal calls bypass the PLT.
+  // Headers are parsed as C, so C++ libraries keep the default visibility.
+  vector<string> exports;
+  if (!is_cpp)
+    exports = collectExports(headers);
+
+  // The headers are included before each source to give the declared symbols
+  // the default visibility, which a header without include guard can't be
+  vector<string> cflags;
+  optional<WorkDir> work_dir;
+  fs::path export_map;
+  if (!exports.empty())
+  {
+    work_dir.emplace("exports");
+    export_map = work_dir->path() / (package.name_ + ".map");
+    if (!writeExportMap(export_map, exports))
+      throw ZCError(ZC_WRITING_ERROR,
+                    "The export list couldn't be written: " +
+                        export_map.string());
+    package.symbols_ = exports;
+
+    if (all_of(headers.begin(), headers.end(), hasIncludeGuard))
+    {
+      fs::path visibility_header =
+          work_dir->path() / (package.name_ + "_exports.h");
+      if (!writeVisibilityHeader(visibility_header, headers))
+        throw ZCError(ZC_WRITING_ERROR,
+                      "The visibility header couldn't be written: " +
+                          visibility_header.string());
+      cflags = {"-fvisibility=hidden", "-fno-semantic-interposition",
+                "-include", visibility_header.string()};
+    }
   }
 
-  // 3. Build library names (static + shared)
+  // 4. Build library names (static + shared)
   string lib_base = "lib" + package.name_;
-  fs::path static_path = lib_path_ / (lib_base + ".a");
 
 #if defined(_WIN32) || defined(_WIN64)
   string shared_ext = ".dll";
@@ -127,78 +413,631 @@ void Registry::savePackage(Package &package, bool force,
 #else
   string shared_ext = ".so";
 #endif
-  fs::path shared_path = lib_path_ / (lib_base + shared_ext);
 
-  // 4. Compile all source code into object files
-  vector<fs::path> created_objects;
-  compileObjects(sources, created_objects, is_cpp);
-  for (const auto &obj : created_objects)
-    objects.push_back(obj);
+  // Without any configured variant, the library is built once, unoptimized,
+  // directly in the lib directory
+  map<string, vector<string>> variants = Settings::getInstance().getLibVariants();
+  if (variants.empty())
+    variants[""] = {};
 
-  // 5. Compile all object files into libraries
-  if (!objects.empty())
+  for (const auto &[variant, variant_flags] : variants)
   {
-    createStaticLib(static_path.string(), objects);
-    createSharedLib(shared_path.string(), objects, is_cpp);
+    fs::path variant_dir = getLibDir(variant);
+    fs::create_directories(variant_dir);
+    fs::path static_path = variant_dir / (lib_base + ".a");
+    fs::path shared_path = variant_dir / (lib_base + shared_ext);
+
+    vector<string> flags = cflags;
+    flags.insert(flags.end(), variant_flags.begin(), variant_flags.end());
 
+    // 5. Compile all source code into object files
+    vector<fs::path> created_objects;
+    vector<fs::path> variant_objects = objects;
+    compileObjects(sources, created_objects, is_cpp, flags, package.isa_);
     for (const auto &obj : created_objects)
-      fs::remove(obj);
+      variant_objects.push_back(obj);
+
+    // 6. Compile all object files into libraries
+    if (!variant_objects.empty())
+    {
+      createStaticLib(static_path.string(), variant_objects);
+      createSharedLib(shared_path.string(), variant_objects, is_cpp,
+                      export_map);
+
+      for (const auto &obj : created_objects)
+        fs::remove(obj);
+    }
+
+    if (fs::exists(static_path))
+      package.binaries_.push_back(static_path);
+    if (fs::exists(shared_path))
+      package.binaries_.push_back(shared_path);
+    if ((fs::exists(static_path) || fs::exists(shared_path)) &&
+        !variant.empty())
+      package.variants_.push_back(variant);
   }
 
-  if (fs::exists(static_path))
-    package.binaries_.push_back(static_path);
-  if (fs::exists(shared_path))
-    package.binaries_.push_back(shared_path);
+  work_dir.reset();
 
-  // 6. Index the library in the config file
+  // 7. Index the library in the config file
   indexPackage(package);
+
+  // 8. Precompile its headers, now that they are installed
+  if (Settings::getInstance().getPrecompileLibs())
+    precompilePackage(package, is_cpp);
 }
 
-void Registry::indexPackage(const Package &package)
+void Registry::installPackage(Package &package, const fs::path &staging)
+{
+  // 1. Swap the whole include directory of the package
+  fs::path staged_headers = staging / "include" / package.name_;
+  fs::path package_dir = include_path_ / package.name_;
+  if (fs::exists(staged_headers))
+  {
+    // The staged headers are moved into the blob store and replaced by links
+    vector<fs::path> staged_files;
+    for (const auto &entry : fs::recursive_directory_iterator(staged_headers))
+      if (entry.is_regular_file())
+        staged_files.push_back(entry.path());
+    for (const auto &f : staged_files)
+      storeHeader(f, f, true);
+
+    fs::path old_headers = staging / "old_include";
+    fs::create_directories(include_path_);
+    if (fs::exists(package_dir))
+      fs::rename(package_dir, old_headers);
+    fs::rename(staged_headers, package_dir);
+    releaseHeaders(old_headers);
+  }
+
+  // 2. Move each binary into place
+  for (const auto &b : package.binaries_)
+    if (!isValidBinary(b))
+      throw ZCError(ZC_PARSING_ERROR, "Invalid binary " + b + " in package " +
+                                          package.name_);
+  for (auto &b : package.binaries_)
+  {
+    fs::path dest = getZCRootDir() / b;
+    fs::create_directories(dest.parent_path());
+    fs::rename(staging / b, dest);
+    b = dest.string();
+  }
+
+  // 3. Index the package, replacing the previous version
+  packages_.erase(remove_if(packages_.begin(), packages_.end(),
+                            [&](const Package &p)
+                            { return p.name_ == package.name_; }),
+                  packages_.end());
+  indexPackage(package);
+
+  // 4. Precompile its headers, now that they are installed
+  if (Settings::getInstance().getPrecompileLibs())
+    precompilePackage(package, hasCppHeaders(package.headers_));
+}
+
+bool Registry::isValidBinary(const string &binary)
+{
+  fs::path path(binary);
+  return !path.empty() && path.is_relative() &&
+         path.lexically_normal() == path && *path.begin() == "lib" &&
+         distance(path.begin(), path.end()) > 1 && path.has_filename();
+}
+
+void Registry::storeHeader(const fs::path &source, const fs::path &dest,
+                           bool move) const
+{
+  string hash = sha256File(source);
+  if (hash.empty())
+    throw ZCError(ZC_NOT_FOUND, "File not found: " + source.string());
+
+  fs::path blob = blobs_path_ / hash.substr(0, 2) / hash;
+  if (!fs::exists(blob))
+  {
+    fs::create_directories(blob.parent_path());
+    fs::path tmp = tempPath(blob);
+    if (move)
+      fs::rename(source, tmp);
+    else
+      fs::copy_file(source, tmp, fs::copy_options::overwrite_existing);
+    // A blob is shared by every package holding the same header, so it must
+    // not be edited in place
+    fs::permissions(tmp, fs::perms::owner_read | fs::perms::group_read |
+                             fs::perms::others_read);
+    fs::rename(tmp, blob);
+  }
+
+  fs::create_directories(dest.parent_path());
+  fs::remove(dest);
+  if (!linkBlob(blob, dest))
+    throw ZCError(ZC_WRITING_ERROR,
+                  "The header couldn't be installed: " + dest.string());
+}
+
+void Registry::releaseHeaders(const fs::path &dir) const
+{
+  // Only hardlinked headers hold a reference on their blob
+  set<fs::path> blobs;
+  if (fs::exists(dir))
+    for (const auto &entry : fs::recursive_directory_iterator(dir))
+      if (entry.is_regular_file() && entry.hard_link_count() > 1)
+      {
+        string hash = sha256File(entry.path());
+        fs::path blob = blobs_path_ / hash.substr(0, 2) / hash;
+        if (!hash.empty() && fs::exists(blob) &&
+            fs::equivalent(blob, entry.path()))
+          blobs.insert(blob);
+      }
+  fs::remove_all(dir);
+
+  for (const auto &blob : blobs)
+    if (fs::hard_link_count(blob) == 1)
+      fs::remove(blob);
+}
+
+fs::path Registry::getModuleMap(const string &pkg_name) const
+{
+  return modules_path_ / "maps" / (pkg_name + ".modulemap");
+}
+
+void Registry::precompilePackage(const Package &package, bool is_cpp) const
+{
+  Settings &settings = Settings::getInstance();
+  fs::path module_map = getModuleMap(package.name_);
+  error_code ec;
+  fs::remove(module_map, ec);
+
+  // Only clang builds and imports Clang modules
+  bool in_process = settings.getInProcessCompile();
+  string compiler =
+      is_cpp ? settings.getCppCompiler() : settings.getCCompiler();
+  if (package.headers_.empty() ||
+      (!in_process &&
+       fs::path(compiler).filename().string().find("clang") == string::npos))
+    return;
+
+  // 1. A single module holding every header of the package. The map lives
+  // outside of the include directory, whose files are links to shared blobs
+  fs::create_directories(module_map.parent_path());
+  WorkDir work_dir("module");
+  fs::path source =
+      work_dir.path() / (package.name_ + "_module" + (is_cpp ? ".cpp" : ".c"));
+  {
+    ofstream map_file(module_map);
+    ofstream source_file(source);
+    if (!map_file.is_open() || !source_file.is_open())
+      throw ZCError(ZC_WRITING_ERROR,
+                    "The module map couldn't be written: " +
+                        module_map.string());
+    map_file << "module " << moduleName(package.name_) << " {\n";
+    for (const auto &h : package.headers_)
+    {
+      map_file << "  header \"" << (include_path_ / package.name_ / h).string()
+               << "\"\n";
+      source_file << "#include <" << (fs::path(package.name_) / h).string()
+                  << ">\n";
+    }
+    map_file << "  export *\n}\n";
+  }
+
+  // 2. Build the module into the cache, with the arguments zc run uses. Clang
+  // files it under a hash of the compiler and of the options, so the module
+  // is found again as long as they don't change
+  vector<string> args{compiler,
+                      "-std=" + (is_cpp ? settings.getCppStd()
+                                        : settings.getCStd())};
+  for (const auto &f : settings.getFlags())
+    args.push_back(f);
+  args.push_back("-I" + include_path_.string());
+  for (const auto &f : split(package.cflags_, ' '))
+    if (!f.empty())
+      args.push_back(f);
+  args.insert(args.end(),
+              {"-fsyntax-only", "-fmodules", "-fno-implicit-module-maps",
+               "-fmodules-cache-path=" + (modules_path_ / "pcm").string(),
+               "-fmodule-map-file=" + module_map.string(), source.string()});
+
+  bool built = in_process ? Compiler::getInstance().run(args)
+                          : runCommand(args, true);
+
+  if (!built)
+  {
+    fs::remove(module_map, ec);
+    warning("The headers of " + package.name_ +
+            " couldn't be precompiled, they will be parsed by each program");
+  }
+}
+
+size_t Registry::collectGarbage(uintmax_t &freed) const
+{
+  size_t count = 0;
+  freed = 0;
+  if (!fs::exists(blobs_path_))
+    return 0;
+
+  // Blobs linked by no include directory have a single link left. Headers
+  // installed as reflinks or copies don't depend on their blob.
+  vector<fs::path> unused;
+  for (const auto &entry : fs::recursive_directory_iterator(blobs_path_))
+    if (entry.is_regular_file() && entry.hard_link_count() == 1)
+      unused.push_back(entry.path());
+  for (const auto &blob : unused)
+  {
+    freed += fs::file_size(blob);
+    fs::remove(blob);
+    count++;
+  }
+  return count;
+}
+
+void Registry::write() const
 {
-  packages_.push_back(package);
   json root;
+  root["std_libraries"] = std_packages_;
   root["libraries"] = packages_;
-  ofstream output(registry_path_);
-  if (!output.is_open())
+
+  // Other runs and the daemon never read half a file
+  if (!writeAtomically(registry_path_, root.dump(4)))
     throw ZCError(ZC_CONFIG_WRITING_ERROR,
                   "The registry couldn't be written: " +
                       registry_path_.string());
-  output << root.dump(4);
-  output.close();
+  registry_stamp_ = fileStamp(registry_path_);
 }
 
-Table Registry::packagesTable() const
+void Registry::readResolved() const
 {
-  vector<vector<string>> str_pkgs{{"Package name", "Author", "Version",
-                                   "Compiling flags", "Headers", "Binaries"}};
+  resolved_.clear();
+  ifstream input(resolved_path_);
+  if (!input.is_open())
+    return;
+  try
+  {
+    json root = json::parse(input);
+    if (!registry_stamp_.empty() &&
+        root.at("registry").get<string>() == registry_stamp_)
+      root.at("flags").get_to(resolved_);
+  }
+  catch (const json::exception &)
+  {
+    resolved_.clear();
+  }
+}
 
-  for (const auto &p : packages_)
-    str_pkgs.push_back({p.name_, p.author_, p.version_, p.flags_,
-                        join(p.headers_, ", "), join(p.binaries_, ", ")});
+void Registry::writeResolved() const
+{
+  // It is only a cache, so errors are ignored
+  if (!registry_stamp_.empty())
+    writeAtomically(resolved_path_,
+                    json{{"registry", registry_stamp_}, {"flags", resolved_}}
+                        .dump());
+}
 
-  return Table(packages_.size() + 1, N_ATTR_PACKAGE, false, true, str_pkgs);
+void Registry::indexPackage(const Package &package)
+{
+  packages_.push_back(package);
+  resolved_.clear();
+  write();
+  SearchIndex::getInstance().addPackage(package);
 }
 
-Table Registry::stdPackagesTable() const
+vector<string> Registry::collectExports(const vector<fs::path> &headers) const
 {
-  vector<vector<string>> str_pkgs{
-      {"Package name", "Compiling flags", "Headers", "Binaries"}};
+  vector<string> symbols;
+  for (const auto &h : headers)
+  {
+    unique_ptr<Declarations> decls;
+    try
+    {
+      decls = File(h.string()).parse();
+    }
+    catch (const ZCError &)
+    {
+      // Without the full interface, hiding symbols could break the library
+      warning("Couldn't parse " + h.string() +
+              ", every symbol of the library will be exported.");
+      return {};
+    }
+    auto it = decls->find("symbols");
+    if (it != decls->end())
+      symbols.insert(symbols.end(), it->second.begin(), it->second.end());
+  }
+  sort(symbols.begin(), symbols.end());
+  symbols.erase(unique(symbols.begin(), symbols.end()), symbols.end());
+  return symbols;
+}
 
-  for (const auto &p : std_packages_)
-    str_pkgs.push_back(
-        {p.name_, p.flags_, join(p.headers_, ", "), join(p.binaries_, ", ")});
+bool Registry::writeExportMap(const fs::path &path,
+                              const vector<string> &symbols) const
+{
+  ofstream output(path);
+  if (!output.is_open())
+    return false;
+#ifdef __APPLE__
+  for (const auto &s : symbols)
+    output << '_' << s << '\n';
+#else
+  output << "{\n  global:\n";
+  for (const auto &s : symbols)
+    output << "    " << s << ";\n";
+  output << "  local:\n    *;\n};\n";
+#endif
+  return output.good();
+}
 
-  return Table(std_packages_.size() + 1, N_ATTR_STD_PACKAGE, false, true,
-               str_pkgs);
+bool Registry::writeVisibilityHeader(const fs::path &path,
+                                     const vector<fs::path> &headers) const
+{
+  ofstream output(path);
+  if (!output.is_open())
+    return false;
+  output << "#pragma GCC visibility push(default)\n";
+  for (const auto &h : headers)
+    output << "#include " << fs::absolute(h) << '\n';
+  output << "#pragma GCC visibility pop\n";
+  return output.good();
+}
+
+Table Registry::packagesTable() const
+{
+  static const vector<string_view> headers{
+      "Package name", "Author",     "Version",          "Compiling flags",
+      "Linking flags", "Headers",   "Binaries",         "Variants",
+      "ISA levels",   "Exported symbols", "Dependencies"};
+
+  // Rows are read from the registry while the table is drawn
+  return Table(
+      packages_.size() + 1, N_ATTR_PACKAGE, false, true,
+      [this](size_t row, vector<string_view> &cells, deque<string> &storage)
+      {
+        if (row == 0)
+        {
+          cells = headers;
+          return true;
+        }
+        if (row > packages_.size())
+          return false;
+        const Package &p = packages_[row - 1];
+        auto computed = [&](string cell) -> string_view
+        { return storage.emplace_back(std::move(cell)); };
+        cells = {p.name_,
+                 p.author_,
+                 p.version_,
+                 p.cflags_,
+                 p.flags_,
+                 computed(join(p.headers_, ", ")),
+                 computed(join(p.binaries_, ", ")),
+                 computed(join(p.variants_, ", ")),
+                 computed(join(p.isa_, ", ")),
+                 p.symbols_.empty() ? "all"
+                                    : computed(to_string(p.symbols_.size())),
+                 computed(join(p.dependencies_, ", "))};
+        return true;
+      });
+}
+
+Table Registry::stdPackagesTable() const
+{
+  static const vector<string_view> headers{
+      "Package name", "Compiling flags", "Linking flags", "Headers",
+      "Binaries"};
+
+  return Table(
+      std_packages_.size() + 1, N_ATTR_STD_PACKAGE, false, true,
+      [this](size_t row, vector<string_view> &cells, deque<string> &storage)
+      {
+        if (row == 0)
+        {
+          cells = headers;
+          return true;
+        }
+        if (row > std_packages_.size())
+          return false;
+        const StdPackage &p = std_packages_[row - 1];
+        cells = {p.name_, p.cflags_, p.flags_,
+                 storage.emplace_back(join(p.headers_, ", ")),
+                 storage.emplace_back(join(p.binaries_, ", "))};
+        return true;
+      });
 }
 
 fs::path Registry::getIncludeDir() const { return include_path_; }
 
 fs::path Registry::getLibDir() const { return lib_path_; }
 
+fs::path Registry::getLibDir(const string &variant) const
+{
+  return variant.empty() ? lib_path_ : lib_path_ / variant;
+}
+
+string Registry::getVariant(const vector<string> &flags) const
+{
+  // The architecture must match first (a -march=native library can't be
+  // linked into a portable build), then the closest optimization level wins
+  const int level = optLevel(flags);
+  const string march = arch(flags);
+  string best;
+  int best_score = INT_MIN;
+  for (const auto &[name, variant_flags] :
+       Settings::getInstance().getLibVariants())
+  {
+    int score = (arch(variant_flags) == march ? 10 : 0) -
+                abs(optLevel(variant_flags) - level);
+    if (score > best_score)
+    {
+      best = name;
+      best_score = score;
+    }
+  }
+  return best;
+}
+
+vector<string> Registry::getModuleFlags() const
+{
+  if (!Settings::getInstance().getPrecompileLibs())
+    return {};
+
+  vector<string> maps;
+  for (const auto &p : packages_)
+  {
+    fs::path module_map = getModuleMap(p.name_);
+    if (fs::exists(module_map))
+      maps.push_back("-fmodule-map-file=" + module_map.string());
+  }
+  if (maps.empty())
+    return {};
+
+  // Only the maps of the packages are read: the system headers stay textual
+  vector<string> flags{"-fmodules", "-fno-implicit-module-maps",
+                       "-fmodules-cache-path=" +
+                           (modules_path_ / "pcm").string()};
+  flags.insert(flags.end(), maps.begin(), maps.end());
+  return flags;
+}
+
 std::vector<Package> Registry::getPackages() const { return packages_; }
 
+void Registry::getFlags(const vector<string> &names, vector<string> &cflags,
+                        vector<string> &ldflags) const
+{
+  vector<string> roots = names;
+  sort(roots.begin(), roots.end());
+  roots.erase(unique(roots.begin(), roots.end()), roots.end());
+  string key = join(roots, ",");
+  auto cached = resolved_.find(key);
+  if (cached != resolved_.end())
+  {
+    cflags = cached->second[0];
+    ldflags = cached->second[1];
+    return;
+  }
+
+  cflags.clear();
+  ldflags.clear();
+  for (const auto &name : getDependencies(roots))
+  {
+    string package_cflags, package_ldflags;
+    auto p = find_if(packages_.begin(), packages_.end(),
+                     [&](const Package &pkg) { return pkg.name_ == name; });
+    if (p != packages_.end())
+    {
+      package_cflags = p->cflags_;
+      package_ldflags = p->flags_;
+    }
+    else
+      for (const auto &s : std_packages_)
+        if (s.name_ == name)
+        {
+          package_cflags = s.cflags_;
+          package_ldflags = s.flags_;
+        }
+
+    mergeFlags(cflags, split(package_cflags, ' '), false);
+    // A linking flag needed twice is kept at its last position, after
+    // everything that needs it
+    mergeFlags(ldflags, split(package_ldflags, ' '), true);
+  }
+
+  resolved_[key] = {cflags, ldflags};
+  writeResolved();
+}
+
+vector<string> Registry::importPkgConfig(const vector<string> &modules)
+{
+  // The directories searched by default hold the headers of many modules
+  set<fs::path> system_dirs{"/usr/include", "/usr/local/include"};
+  string search;
+  if (captureOutput("cc -x c -E -v /dev/null 2>&1 >/dev/null", search))
+    for (const auto &line : split(search, '\n'))
+      if (line.size() > 1 && line[0] == ' ' && line[1] == '/')
+        system_dirs.insert(fs::path(line.substr(1)).lexically_normal());
+
+  vector<string> failed;
+  for (const auto &module : modules)
+  {
+    StdPackage package;
+    package.name_ = module;
+    string query = "pkg-config " + escape_shell_arg(module);
+    if (!captureOutput(query + " --cflags 2>/dev/null", package.cflags_) ||
+        !captureOutput(query + " --libs 2>/dev/null", package.flags_))
+    {
+      failed.push_back(module);
+      continue;
+    }
+    for (auto *flags : {&package.cflags_, &package.flags_})
+    {
+      replace(flags->begin(), flags->end(), '\n', ' ');
+      vector<string> tokens;
+      for (const auto &t : split(*flags, ' '))
+        if (!t.empty())
+          tokens.push_back(t);
+      *flags = join(tokens, " ");
+    }
+
+    // The headers of a module with its own include directory are listed, so
+    // that including them enables the module. Modules installed in a system
+    // include directory are only recognized by their name, as <name/...> or
+    // <name.h>.
+    for (const auto &f : split(package.cflags_, ' '))
+    {
+      fs::path dir = f.rfind("-I", 0) == 0 ? f.substr(2) : "";
+      if (dir.empty() || system_dirs.count(dir.lexically_normal()) ||
+          !fs::is_directory(dir))
+        continue;
+      for (const auto &entry : fs::directory_iterator(dir))
+      {
+        string ext = entry.path().extension().string();
+        if (entry.is_regular_file() &&
+            (ext == ".h" || ext == ".hh" || ext == ".hpp"))
+          package.headers_.push_back(entry.path().filename().string());
+      }
+    }
+    sort(package.headers_.begin(), package.headers_.end());
+
+    std_packages_.erase(remove_if(std_packages_.begin(), std_packages_.end(),
+                                  [&](const StdPackage &p)
+                                  { return p.name_ == module; }),
+                        std_packages_.end());
+    std_packages_.push_back(package);
+  }
+  resolved_.clear();
+  write();
+  return failed;
+}
+
+vector<string> Registry::getDependencies(const vector<string> &names) const
+{
+  // Depth first post-order lists the dependencies first
+  map<string, int> state;
+  vector<string> order;
+  for (const auto &n : names)
+    visitDependencies(n, state, order);
+  reverse(order.begin(), order.end());
+  return order;
+}
+
+void Registry::visitDependencies(const string &name, map<string, int> &state,
+                                 vector<string> &order) const
+{
+  int &s = state[name];
+  if (s == 2)
+    return;
+  if (s == 1)
+    throw ZCError(ZC_CONFIG_CONTENT_ERROR,
+                  "Circular dependency on the package " + name);
+  s = 1;
+
+  auto it = find_if(packages_.begin(), packages_.end(),
+                    [&](const Package &p) { return p.name_ == name; });
+  if (it != packages_.end())
+    for (const auto &d : it->dependencies_)
+      visitDependencies(d, state, order);
+  else if (none_of(std_packages_.begin(), std_packages_.end(),
+                   [&](const StdPackage &p) { return p.name_ == name; }))
+    throw ZCError(ZC_PACKAGE_NOT_FOUND, "The package was not found: " + name);
+
+  state[name] = 2;
+  order.push_back(name);
+}
+
 std::vector<StdPackage> Registry::getStdPackages() const
 {
   return std_packages_;
@@ -206,23 +1045,201 @@ std::vector<StdPackage> Registry::getStdPackages() const
 
 void Registry::compileObjects(const std::vector<std::filesystem::path> &sources,
                               std::vector<std::filesystem::path> &objects,
-                              bool is_cpp) const
+                              bool is_cpp, const vector<string> &flags,
+                              const vector<string> &isa_levels) const
 {
+  if (!isa_levels.empty())
+  {
+    compileIsaObjects(sources, objects, is_cpp, flags, isa_levels);
+    return;
+  }
+
   // Compile each file separately
   for (const auto &s : sources)
   {
     fs::path obj = s;
-    stringstream cmd;
-    cmd << (is_cpp ? "g++" : "gcc") << " -c -fPIC " << s.string() << " -o "
-        << obj.replace_extension(".o").string();
-    if (system(cmd.str().c_str()) != 0)
-      throw ZCError(ZC_COMPILATION_ERROR, "An error occured while compiling " +
-                                              s.string() + " to " +
-                                              obj.string());
+    obj.replace_extension(".o");
+    compileObject(s, obj, is_cpp, flags);
     objects.push_back(obj);
   }
 }
 
+void Registry::compileObject(const fs::path &source, const fs::path &object,
+                             bool is_cpp, const vector<string> &flags) const
+{
+  bool compiled;
+  if (Settings::getInstance().getInProcessCompile())
+  {
+    // Every source of the library shares the files already read
+    vector<string> args{is_cpp ? "clang++" : "clang", "-c", "-fPIC"};
+    args.insert(args.end(), flags.begin(), flags.end());
+    args.insert(args.end(), {source.string(), "-o", object.string()});
+    compiled = Compiler::getInstance().run(args);
+  }
+  else
+  {
+    stringstream cmd;
+    cmd << (is_cpp ? "g++" : "gcc") << " -c -fPIC ";
+    for (const auto &f : flags)
+      cmd << escape_shell_arg(f) << " ";
+    cmd << escape_shell_arg(source.string()) << " -o "
+        << escape_shell_arg(object.string());
+    compiled = system(cmd.str().c_str()) == 0;
+  }
+  if (!compiled)
+    throw ZCError(ZC_COMPILATION_ERROR, "An error occured while compiling " +
+                                            source.string() + " to " +
+                                            object.string());
+}
+
+void Registry::compileIsaObjects(const vector<fs::path> &sources,
+                                 vector<fs::path> &objects, bool is_cpp,
+                                 const vector<string> &flags,
+                                 const vector<string> &isa_levels) const
+{
+#if !defined(__x86_64__)
+  throw ZCError(ZC_BAD_COMMAND,
+                "ISA dispatching is only supported on x86-64 systems");
+#endif
+  if (sources.empty())
+    return;
+
+  // 1. The generic build always comes first: it is the fallback of every
+  // resolver and it owns the global variables
+  vector<string> levels{"x86-64"};
+  for (const auto &l : isa_levels)
+  {
+    if (isaRank(l) == 0)
+      throw ZCError(ZC_BAD_COMMAND, "Unknown ISA level: " + l);
+    if (find(levels.begin(), levels.end(), l) == levels.end())
+      levels.push_back(l);
+  }
+
+  // The architecture is chosen by the ISA levels only
+  vector<string> base_flags;
+  for (const auto &f : flags)
+    if (f.rfind("-march=", 0) != 0)
+      base_flags.push_back(f);
+
+  // 2. Compile every source once per level and suffix its global symbols with
+  // the level, so that the copies can live in the same library. Calls inside
+  // a copy are renamed too and stay within the same level.
+  map<string, vector<pair<int, string>>> dispatched;
+  WorkDir work_dir("dispatch");
+  for (size_t i = 0; i < levels.size(); i++)
+  {
+    string suffix = "__zc_" + levels[i];
+    replace(suffix.begin(), suffix.end(), '-', '_');
+
+    vector<string> level_flags = base_flags;
+    level_flags.push_back("-march=" + levels[i]);
+
+    for (const auto &s : sources)
+    {
+      fs::path obj = s;
+      obj.replace_extension("." + levels[i] + ".o");
+      compileObject(s, obj, is_cpp, level_flags);
+      objects.push_back(obj);
+
+      string symbols;
+      if (!captureOutput("nm --defined-only -g -P " +
+                             escape_shell_arg(obj.string()),
+                         symbols))
+        throw ZCError(ZC_COMPILATION_ERROR,
+                      "Couldn't list the symbols of " + obj.string());
+
+      fs::path renames = work_dir.path() / (obj.filename().string() + ".syms");
+      ofstream renames_file(renames);
+      stringstream cmd;
+      cmd << "objcopy --redefine-syms=" << escape_shell_arg(renames.string());
+      for (const auto &line : split(symbols, '\n'))
+      {
+        vector<string> fields = split(line, ' ');
+        if (fields.size() < 2 || fields[1].size() != 1)
+          continue;
+        const string &name = fields[0];
+        char type = fields[1][0];
+        // Weak functions (inline functions, templates) may be defined by the
+        // program too, so they are not dispatched: the generic copy keeps
+        // their names, the other copies only call their own
+        if (type == 'T' || (type == 'W' && i > 0))
+          renames_file << name << ' ' << name << suffix << '\n';
+        if (type == 'T')
+          dispatched[name].push_back({isaRank(levels[i]), name + suffix});
+
+        // Duplicated global variables are merged into the generic ones
+        if (i > 0 && string("BDGRSC").find(type) != string::npos)
+          cmd << " --weaken-symbol=" << escape_shell_arg(name);
+      }
+      renames_file.close();
+      cmd << " " << escape_shell_arg(obj.string());
+      int res = system(cmd.str().c_str());
+      fs::remove(renames);
+      if (res != 0)
+        throw ZCError(ZC_COMPILATION_ERROR,
+                      "Couldn't rename the symbols of " + obj.string());
+    }
+  }
+
+  // 3. Write the ifunc resolvers, which pick the implementation of the
+  // highest level supported by the CPU when the library is loaded
+  fs::path dispatcher =
+      work_dir.path() / ("zc_dispatch_" + sources.front().stem().string() + ".c");
+  ofstream output(dispatcher);
+  if (!output.is_open())
+    throw ZCError(ZC_WRITING_ERROR,
+                  "Couldn't write the dispatcher: " + dispatcher.string());
+
+  output << "/* This file was automatically generated by ZC */\n\n"
+         << "static int zc_isa_level(void)\n{\n"
+         << "  __builtin_cpu_init();\n"
+         << "  if (__builtin_cpu_supports(\"avx512f\") &&\n"
+         << "      __builtin_cpu_supports(\"avx512bw\") &&\n"
+         << "      __builtin_cpu_supports(\"avx512cd\") &&\n"
+         << "      __builtin_cpu_supports(\"avx512dq\") &&\n"
+         << "      __builtin_cpu_supports(\"avx512vl\"))\n"
+         << "    return 4;\n"
+         << "  if (__builtin_cpu_supports(\"avx2\") &&\n"
+         << "      __builtin_cpu_supports(\"bmi\") &&\n"
+         << "      __builtin_cpu_supports(\"bmi2\") &&\n"
+         << "      __builtin_cpu_supports(\"fma\"))\n"
+         << "    return 3;\n"
+         << "  if (__builtin_cpu_supports(\"popcnt\") &&\n"
+         << "      __builtin_cpu_supports(\"sse4.2\") &&\n"
+         << "      __builtin_cpu_supports(\"ssse3\"))\n"
+         << "    return 2;\n"
+         << "  return 1;\n}\n\n";
+
+  int n = 0;
+  for (auto &[name, impls] : dispatched)
+  {
+    sort(impls.begin(), impls.end(), greater<>());
+    for (size_t i = 0; i < impls.size(); i++)
+      output << "extern void zc_impl_" << n << "_" << i << "(void) __asm__(\""
+             << impls[i].second << "\");\n";
+    output << "static void *zc_resolve_" << n << "(void)\n{\n"
+           << "  int level = zc_isa_level();\n";
+    for (size_t i = 0; i < impls.size(); i++)
+      output << "  if (level >= " << impls[i].first << ")\n"
+             << "    return (void *)zc_impl_" << n << "_" << i << ";\n";
+    output << "  return (void *)zc_impl_" << n << "_" << impls.size() - 1
+           << ";\n}\n"
+           << "void zc_func_" << n << "(void) __asm__(\"" << name
+           << "\") __attribute__((ifunc(\"zc_resolve_" << n << "\")));\n\n";
+    n++;
+  }
+  output.close();
+
+  fs::path dispatcher_obj = sources.front();
+  dispatcher_obj.replace_extension(".dispatch.o");
+  vector<string> dispatcher_flags;
+  for (const auto &f : base_flags)
+    if (f.rfind("-O", 0) == 0)
+      dispatcher_flags.push_back(f);
+  compileObject(dispatcher, dispatcher_obj, false, dispatcher_flags);
+  objects.push_back(dispatcher_obj);
+}
+
 bool Registry::createStaticLib(
     const std::string &libPath,
     const std::vector<std::filesystem::path> &objects) const
@@ -237,7 +1254,7 @@ bool Registry::createStaticLib(
 
 bool Registry::createSharedLib(const std::string &libPath,
                                const std::vector<fs::path> &objects,
-                               bool is_cpp) const
+                               bool is_cpp, const fs::path &export_map) const
 {
   stringstream cmd;
   cmd << (is_cpp ? "g++" : "gcc");
@@ -249,6 +1266,16 @@ bool Registry::createSharedLib(const std::string &libPath,
   for (const auto &o : objects)
     cmd << o << " ";
 
+  if (!export_map.empty())
+  {
+#ifdef __APPLE__
+    cmd << "-Wl,-exported_symbols_list," << export_map << " ";
+#else
+    cmd << "-Wl,--version-script=" << export_map
+        << " -Wl,-Bsymbolic-functions ";
+#endif
+  }
+
   cmd << "-o " << libPath;
   debug("Build command for shared library: " + cmd.str());
   return system(cmd.str().c_str()) == 0;
@@ -268,6 +1295,7 @@ vector<string> Registry::unindexPackage(const std::string &pkg_name)
 
     // 3. Delete package
     packages_.erase(it);
+    resolved_.clear();
   }
   else
   {
@@ -275,17 +1303,8 @@ vector<string> Registry::unindexPackage(const std::string &pkg_name)
                   "The package was not found: " + pkg_name);
   }
 
-  nlohmann::json root;
-  root["libraries"] = packages_;
-
-  std::ofstream output(registry_path_);
-  if (!output.is_open())
-    throw ZCError(ZC_CONFIG_WRITING_ERROR,
-                  "The registry couldn't be written: " +
-                      registry_path_.string());
-
-  output << root.dump(4);
-  output.close();
+  write();
+  SearchIndex::getInstance().removePackage(pkg_name);
 
   return binaries;
 }
@@ -294,8 +1313,12 @@ bool Registry::removePackage(const std::string &pkg_name)
 {
   vector<string> binaries = unindexPackage(pkg_name);
 
+  // The module built from the headers is left to the pruning of clang
+  error_code ec;
+  fs::remove(getModuleMap(pkg_name), ec);
+
   if (fs::exists(include_path_ / pkg_name))
-    fs::remove_all(include_path_ / pkg_name);
+    releaseHeaders(include_path_ / pkg_name);
   else
     return false;
   for (const auto &b : binaries)
@@ -308,6 +1331,16 @@ bool Registry::removePackage(const std::string &pkg_name)
   return true;
 }
 
+const Package &Registry::getPackage(const std::string &pkg_name) const
+{
+  auto it = find_if(packages_.begin(), packages_.end(),
+                    [&](const Package &p) { return p.name_ == pkg_name; });
+  if (it == packages_.end())
+    throw ZCError(ZC_PACKAGE_NOT_FOUND,
+                  "The package was not found: " + pkg_name);
+  return *it;
+}
+
 bool Registry::pkgExists(const std::string &pkg_name) const
 {
   auto it = find_if(packages_.begin(), packages_.end(),
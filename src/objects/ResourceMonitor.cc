@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <objects/ResourceMonitor.hh>
+#include <objects/ZCError.hh>
+
+using namespace std;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Samples kept before halving them
+const size_t MAX_SAMPLES = 1024;
+
+// Size of the memory chart
+const size_t CHART_WIDTH = 60;
+const size_t CHART_HEIGHT = 8;
+
+double seconds(const struct timeval &tv)
+{
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+string formatTime(double seconds)
+{
+  char buffer[32];
+  if (seconds < 1)
+    snprintf(buffer, sizeof(buffer), "%.2f ms", seconds * 1e3);
+  else
+    snprintf(buffer, sizeof(buffer), "%.3f s", seconds);
+  return buffer;
+}
+
+string formatSize(long kib)
+{
+  char buffer[32];
+  if (kib < 1024)
+    snprintf(buffer, sizeof(buffer), "%ld KiB", kib);
+  else if (kib < 1024 * 1024)
+    snprintf(buffer, sizeof(buffer), "%.1f MiB", kib / 1024.0);
+  else
+    snprintf(buffer, sizeof(buffer), "%.2f GiB", kib / (1024.0 * 1024));
+  return buffer;
+}
+
+} // namespace
+
+// ----------------------------------------------- ResourceMonitor class
+
+ResourceMonitor::ResourceMonitor(int interval_ms) : interval_ms_(interval_ms) {}
+
+int ResourceMonitor::wait(pid_t pid)
+{
+  // Polling the process wakes up as soon as it exits, without waiting for
+  // the end of the interval
+  int pidfd = syscall(SYS_pidfd_open, pid, 0);
+  auto start = chrono::steady_clock::now();
+  int status = 0;
+  while (true)
+  {
+    pid_t res = wait4(pid, &status, WNOHANG, &usage_);
+    double time =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (res == pid)
+    {
+      wall_ = time;
+      break;
+    }
+    if (res < 0 && errno != EINTR)
+    {
+      if (pidfd >= 0)
+        close(pidfd);
+      throw ZCError(ZC_INTERNAL_ERROR, string("Couldn't wait for the program: ") +
+                                           strerror(errno));
+    }
+
+    sample(pid, time);
+    if (pidfd >= 0)
+    {
+      struct pollfd pfd{pidfd, POLLIN, 0};
+      poll(&pfd, 1, interval_ms_);
+    }
+    else
+      usleep(interval_ms_ * 1000);
+  }
+  if (pidfd >= 0)
+    close(pidfd);
+  return status;
+}
+
+void ResourceMonitor::sample(pid_t pid, double time)
+{
+  ifstream status("/proc/" + to_string(pid) + "/status");
+  string line;
+  while (getline(status, line))
+    if (line.rfind("VmRSS:", 0) == 0)
+    {
+      samples_.push_back({time, stol(line.substr(6))});
+      break;
+    }
+
+  // Long runs keep the peaks of pairs of samples, taken half as often
+  if (samples_.size() < MAX_SAMPLES)
+    return;
+  for (size_t i = 0; i < samples_.size() / 2; i++)
+    samples_[i] = {samples_[2 * i].first,
+                   max(samples_[2 * i].second, samples_[2 * i + 1].second)};
+  samples_.resize(samples_.size() / 2);
+  interval_ms_ *= 2;
+}
+
+Table ResourceMonitor::table() const
+{
+  double user = seconds(usage_.ru_utime), sys = seconds(usage_.ru_stime);
+  char cpu[32];
+  snprintf(cpu, sizeof(cpu), "%.0f %%",
+           wall_ > 0 ? (user + sys) / wall_ * 100 : 0.0);
+
+  vector<vector<string>> content{
+      {"Resource", "Usage"},
+      {"Wall-clock time", formatTime(wall_)},
+      {"User CPU time", formatTime(user)},
+      {"System CPU time", formatTime(sys)},
+      {"CPU usage", cpu},
+      {"Peak resident memory", formatSize(usage_.ru_maxrss)},
+      {"Major page faults", to_string(usage_.ru_majflt)},
+      {"Minor page faults", to_string(usage_.ru_minflt)},
+      {"Voluntary context switches", to_string(usage_.ru_nvcsw)},
+      {"Involuntary context switches", to_string(usage_.ru_nivcsw)},
+      {"Block reads", to_string(usage_.ru_inblock)},
+      {"Block writes", to_string(usage_.ru_oublock)}};
+  return Table(content.size(), 2, true, true, content);
+}
+
+void ResourceMonitor::drawTimeline() const
+{
+  if (samples_.size() < 2)
+    return;
+
+  // 1. Each column shows the peak of the samples it covers
+  size_t width = min(CHART_WIDTH, samples_.size());
+  vector<long> columns(width, 0);
+  for (size_t i = 0; i < samples_.size(); i++)
+  {
+    size_t c = i * width / samples_.size();
+    columns[c] = max(columns[c], samples_[i].second);
+  }
+  long peak = *max_element(columns.begin(), columns.end());
+  if (peak <= 0)
+    return;
+
+  // 2. Each row is split in eighths with the block characters
+  static const char *blocks[] = {" ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+  string top = formatSize(peak);
+  size_t margin = max<size_t>(top.size(), 1) + 1;
+  cout << "Resident memory over time:" << endl;
+  for (size_t row = CHART_HEIGHT; row-- > 0;)
+  {
+    string label = row == CHART_HEIGHT - 1 ? top : row == 0 ? "0" : "";
+    cout << string(margin - label.size() - 1, ' ') << label << " │";
+    for (long value : columns)
+    {
+      long eighths = value * CHART_HEIGHT * 8 / peak - row * 8;
+      cout << blocks[clamp<long>(eighths, 0, 8)];
+    }
+    cout << endl;
+  }
+
+  string end = formatTime(samples_.back().first);
+  cout << string(margin, ' ') << "└";
+  for (size_t c = 0; c < width; c++)
+    cout << "─";
+  cout << endl
+       << string(margin + 1, ' ') << "0"
+       << string(width > end.size() ? width - end.size() - 1 : 1, ' ') << end
+       << endl;
+}
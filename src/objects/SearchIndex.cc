@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+#include <nlohmann/json.hpp>
+#include <objects/File.hh>
+#include <objects/SearchIndex.hh>
+#include <objects/ZCError.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Importance of each field of a package
+const double NAME_WEIGHT = 10;
+const double HEADER_WEIGHT = 3;
+const double FUNCTION_WEIGHT = 4;
+const double AUTHOR_WEIGHT = 2;
+
+// Part of the weight given to words inside a text and to inexact matches
+const double WORD_FACTOR = 0.5;
+const double PREFIX_FACTOR = 0.6;
+const double FUZZY_FACTOR = 0.3;
+
+string lower(const string &s)
+{
+  string l = s;
+  transform(l.begin(), l.end(), l.begin(),
+            [](unsigned char c) { return tolower(c); });
+  return l;
+}
+
+/**
+ * @brief Split a text into lowercase words ("mylib_init" gives "mylib" and
+ * "init")
+ */
+vector<string> words(const string &text)
+{
+  vector<string> result;
+  string word;
+  for (char c : text + ' ')
+  {
+    if (isalnum((unsigned char)c))
+      word += tolower((unsigned char)c);
+    else
+    {
+      if (word.size() > 1)
+        result.push_back(word);
+      word.clear();
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Get the name of a function from its declaration
+ */
+string functionName(const string &declaration)
+{
+  size_t end = declaration.find('(');
+  if (end == string::npos)
+    return "";
+  while (end > 0 && isspace((unsigned char)declaration[end - 1]))
+    end--;
+  size_t start = end;
+  while (start > 0 && (isalnum((unsigned char)declaration[start - 1]) ||
+                       declaration[start - 1] == '_'))
+    start--;
+  return declaration.substr(start, end - start);
+}
+
+/**
+ * @brief Levenshtein distance between two words, giving up beyond a maximum
+ *
+ * @return The distance, or max + 1 if it is greater than max
+ */
+size_t editDistance(const string &a, const string &b, size_t max)
+{
+  if ((a.size() > b.size() ? a.size() - b.size() : b.size() - a.size()) > max)
+    return max + 1;
+  vector<size_t> prev(b.size() + 1), cur(b.size() + 1);
+  for (size_t j = 0; j <= b.size(); j++)
+    prev[j] = j;
+  for (size_t i = 1; i <= a.size(); i++)
+  {
+    cur[0] = i;
+    size_t row_min = cur[0];
+    for (size_t j = 1; j <= b.size(); j++)
+    {
+      cur[j] = min({prev[j] + 1, cur[j - 1] + 1,
+                    prev[j - 1] + (a[i - 1] != b[j - 1])});
+      row_min = min(row_min, cur[j]);
+    }
+    if (row_min > max)
+      return max + 1;
+    swap(prev, cur);
+  }
+  return prev[b.size()];
+}
+
+} // namespace
+
+// ----------------------------------------------- SearchIndex class
+
+SearchIndex::SearchIndex() { load(); }
+
+SearchIndex &SearchIndex::getInstance()
+{
+  static SearchIndex instance;
+  return instance;
+}
+
+void SearchIndex::load()
+{
+  terms_.clear();
+  ifstream input(index_path_);
+  if (input.is_open())
+  {
+    try
+    {
+      json index = json::parse(input);
+      for (const auto &[term, postings] : index.at("terms").items())
+        for (const auto &[pkg_name, p] : postings.items())
+          terms_[term][pkg_name] = {p.at(0).get<double>(),
+                                    p.at(1).get<string>()};
+      return;
+    }
+    catch (const json::exception &)
+    {
+      // The index can always be built again from the registry
+      terms_.clear();
+    }
+  }
+  rebuild(Registry::getInstance().getPackages());
+}
+
+void SearchIndex::write() const
+{
+  json postings = json::object();
+  for (const auto &[term, packages] : terms_)
+    for (const auto &[pkg_name, p] : packages)
+      postings[term][pkg_name] = {p.weight_, p.text_};
+
+  // Other runs and the daemon never read half a file
+  if (!writeAtomically(index_path_, json{{"terms", postings}}.dump()))
+    throw ZCError(ZC_WRITING_ERROR, "The search index couldn't be written: " +
+                                        index_path_.string());
+}
+
+void SearchIndex::indexText(const string &text, const string &pkg_name,
+                            const string &label, double weight)
+{
+  if (text.empty())
+    return;
+  auto add = [&](const string &term, double w)
+  {
+    Posting &p = terms_[term][pkg_name];
+    if (w > p.weight_)
+      p = {w, label};
+  };
+  add(lower(text), weight);
+  for (const auto &w : words(text))
+    add(w, weight * WORD_FACTOR);
+}
+
+void SearchIndex::indexPackage(const Package &package)
+{
+  indexText(package.name_, package.name_, "name " + package.name_,
+            NAME_WEIGHT);
+  indexText(package.author_, package.name_, "author " + package.author_,
+            AUTHOR_WEIGHT);
+
+  fs::path include_dir = Registry::getInstance().getIncludeDir();
+  for (const auto &h : package.headers_)
+  {
+    // Headers are found both by their path and as they are included
+    fs::path header = fs::path(package.name_) / h;
+    const string label = "header " + header.string();
+    indexText(header.string(), package.name_, label, HEADER_WEIGHT);
+    indexText(h, package.name_, label, HEADER_WEIGHT);
+
+    unique_ptr<Declarations> decls;
+    try
+    {
+      decls = File((include_dir / header).string()).parse();
+    }
+    catch (const ZCError &)
+    {
+      // The header is still found by its path
+      continue;
+    }
+    auto functions = decls->find("functions");
+    if (functions != decls->end())
+      for (const auto &f : functions->second)
+      {
+        string name = functionName(f);
+        indexText(name, package.name_, "function " + name, FUNCTION_WEIGHT);
+      }
+  }
+}
+
+void SearchIndex::unindexPackage(const string &pkg_name)
+{
+  for (auto it = terms_.begin(); it != terms_.end();)
+  {
+    it->second.erase(pkg_name);
+    it = it->second.empty() ? terms_.erase(it) : next(it);
+  }
+}
+
+void SearchIndex::addPackage(const Package &package)
+{
+  unindexPackage(package.name_);
+  indexPackage(package);
+  write();
+}
+
+void SearchIndex::removePackage(const string &pkg_name)
+{
+  unindexPackage(pkg_name);
+  write();
+}
+
+void SearchIndex::rebuild(const vector<Package> &packages)
+{
+  terms_.clear();
+  for (const auto &p : packages)
+    indexPackage(p);
+  write();
+}
+
+vector<SearchResult> SearchIndex::search(const string &query,
+                                         size_t limit) const
+{
+  // Query words are matched whole, so "m.h" or "mylib_init" can be looked for
+  vector<string> query_terms;
+  istringstream stream(lower(query));
+  for (string w; stream >> w;)
+    query_terms.push_back(w);
+
+  // Every term of the query must match: the score of a package is the sum of
+  // its best match for each term
+  map<string, SearchResult> results;
+  for (size_t i = 0; i < query_terms.size(); i++)
+  {
+    const string &q = query_terms[i];
+    map<string, pair<double, string>> best;
+    auto match = [&](const map<string, Posting> &postings, double factor)
+    {
+      for (const auto &[pkg_name, p] : postings)
+      {
+        auto &b = best[pkg_name];
+        if (p.weight_ * factor > b.first)
+          b = {p.weight_ * factor, p.text_};
+      }
+    };
+
+    // 1. Exact and prefix matches are contiguous in the sorted terms
+    for (auto it = terms_.lower_bound(q);
+         it != terms_.end() && it->first.compare(0, q.size(), q) == 0; it++)
+      match(it->second, it->first == q
+                            ? 1.0
+                            : PREFIX_FACTOR * q.size() / it->first.size());
+
+    // 2. Typos, only for words long enough to tell them apart
+    if (q.size() >= 4)
+    {
+      size_t max_distance = q.size() >= 8 ? 2 : 1;
+      for (const auto &[term, postings] : terms_)
+      {
+        size_t d = editDistance(q, term, max_distance);
+        if (d > 0 && d <= max_distance)
+          match(postings, FUZZY_FACTOR / d);
+      }
+    }
+
+    // 3. Keep the packages which matched all the previous terms too
+    map<string, SearchResult> next_results;
+    for (const auto &[pkg_name, b] : best)
+    {
+      if (i > 0 && !results.count(pkg_name))
+        continue;
+      SearchResult r = i > 0 ? results[pkg_name] : SearchResult{pkg_name, 0, {}};
+      r.score_ += b.first;
+      if (find(r.matches_.begin(), r.matches_.end(), b.second) ==
+          r.matches_.end())
+        r.matches_.push_back(b.second);
+      next_results[pkg_name] = r;
+    }
+    results = std::move(next_results);
+  }
+
+  vector<SearchResult> sorted;
+  for (auto &[pkg_name, r] : results)
+    sorted.push_back(std::move(r));
+  sort(sorted.begin(), sorted.end(),
+       [](const SearchResult &a, const SearchResult &b)
+       {
+         return a.score_ != b.score_ ? a.score_ > b.score_
+                                     : a.package_ < b.package_;
+       });
+  if (limit > 0 && sorted.size() > limit)
+    sorted.resize(limit);
+  return sorted;
+}
@@ -50,6 +50,10 @@ void Settings::load()
 
   flags_ = json_conf.value<vector<string>>("flags",
                                            vector<string>{"-Wall", "-Wextra"});
+  in_process_compile_ = json_conf.value<bool>("in_process_compile", false);
+  precompile_libs_ = json_conf.value<bool>("precompile_libs", false);
+  lib_variants_ = json_conf.value("lib_variants", lib_variants_);
+  package_server_ = json_conf.value("package_server", package_server_);
 
   // User settings
   editor_ = json_conf.value("editor", "nvim");
@@ -68,3 +72,13 @@ const std::string &Settings::getEditor() const { return editor_; }
 bool Settings::getClearBeforeRun() const { return clear_before_run_; }
 bool Settings::getAutoKeep() const { return auto_keep_; }
 bool Settings::getEditOnInit() const { return edit_on_init_; }
+const map<string, vector<string>> &Settings::getLibVariants() const
+{
+  return lib_variants_;
+}
+const std::string &Settings::getPackageServer() const
+{
+  return package_server_;
+}
+bool Settings::getInProcessCompile() const { return in_process_compile_; }
+bool Settings::getPrecompileLibs() const { return precompile_libs_; }
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <llvm/BinaryFormat/ELF.h>
+#include <llvm/DebugInfo/Symbolize/Symbolize.h>
+
+#include <objects/Symbolizer.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+/**
+ * @brief Read the ELF headers of a mapped file (of the host's class and byte
+ * order): whether it is an executable which isn't position independent, and
+ * the difference between the virtual addresses and the file offsets of the
+ * loadable segment mapped at an offset
+ */
+void readElf(const string &path, uintptr_t offset, bool &absolute,
+             intptr_t &bias)
+{
+  ifstream file(path, ios::binary);
+  llvm::ELF::Elf64_Ehdr header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      memcmp(header.e_ident, llvm::ELF::ElfMagic, 4) != 0 ||
+      header.e_ident[llvm::ELF::EI_CLASS] != llvm::ELF::ELFCLASS64 ||
+      header.e_phentsize != sizeof(llvm::ELF::Elf64_Phdr))
+    return;
+  absolute = header.e_type == llvm::ELF::ET_EXEC;
+
+  // The mapping starts at the page holding the start of the segment
+  file.seekg(header.e_phoff);
+  for (size_t i = 0; i < header.e_phnum; i++)
+  {
+    llvm::ELF::Elf64_Phdr segment;
+    if (!file.read(reinterpret_cast<char *>(&segment), sizeof(segment)))
+      return;
+    uint64_t align = segment.p_align ? segment.p_align : 1;
+    if (segment.p_type == llvm::ELF::PT_LOAD &&
+        (segment.p_offset & ~(align - 1)) <= offset &&
+        offset < segment.p_offset + segment.p_filesz)
+    {
+      bias = segment.p_vaddr - segment.p_offset;
+      return;
+    }
+  }
+}
+
+} // namespace
+
+// ----------------------------------------------- Symbolizer class
+
+Symbolizer::Symbolizer()
+{
+  llvm::symbolize::LLVMSymbolizer::Options options;
+  options.Demangle = true;
+  symbolizer_ = make_unique<llvm::symbolize::LLVMSymbolizer>(options);
+}
+
+Symbolizer::~Symbolizer() = default;
+
+void Symbolizer::addMapping(const string &line)
+{
+  Mapping map;
+  char perms[5] = {0};
+  int path_start = 0;
+  if (sscanf(line.c_str(), "%zx-%zx %4s %zx %*s %*s %n", &map.start_,
+             &map.end_, perms, &map.offset_, &path_start) < 4 ||
+      perms[2] != 'x')
+    return;
+  if (path_start > 0)
+    map.path_ = line.substr(path_start);
+  if (!map.path_.empty() && map.path_[0] == '/')
+    readElf(map.path_, map.offset_, map.absolute_, map.bias_);
+  sorted_ = sorted_ && (maps_.empty() || maps_.back().start_ < map.start_);
+  maps_.push_back(map);
+}
+
+const vector<string> &Symbolizer::symbolize(uintptr_t address)
+{
+  auto known = names_.find(address);
+  if (known != names_.end())
+    return known->second;
+  vector<string> &names = names_[address];
+
+  if (!sorted_)
+  {
+    sort(maps_.begin(), maps_.end(), [](const Mapping &a, const Mapping &b)
+         { return a.start_ < b.start_; });
+    sorted_ = true;
+  }
+  auto it = upper_bound(maps_.begin(), maps_.end(), address,
+                        [](uintptr_t a, const Mapping &m)
+                        { return a < m.start_; });
+  if (it == maps_.begin() || address >= prev(it)->end_)
+  {
+    names.push_back("[unknown]");
+    return names;
+  }
+  const Mapping &map = *prev(it);
+  if (map.path_.empty() || map.path_[0] == '[')
+  {
+    names.push_back(map.path_.empty() ? "[anonymous]" : map.path_);
+    return names;
+  }
+
+  // The symbolizer takes the virtual addresses of the file, which only match
+  // the file offsets when the linker lays the segments out so (e.g. not lld)
+  uintptr_t offset =
+      map.absolute_ ? address : address - map.start_ + map.offset_ + map.bias_;
+  auto info = symbolizer_->symbolizeInlinedCode(
+      map.path_, {offset, llvm::object::SectionedAddress::UndefSection});
+  if (info)
+    for (uint32_t i = 0; i < info->getNumberOfFrames(); i++)
+    {
+      string name = info->getFrame(i).FunctionName;
+      if (name != llvm::DILineInfo::BadString)
+        names.push_back(name);
+    }
+  else
+    llvm::consumeError(info.takeError());
+
+  if (names.empty())
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "+0x%zx", (size_t)offset);
+    names.push_back(fs::path(map.path_).filename().string() + buffer);
+  }
+  return names;
+}
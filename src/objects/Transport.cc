@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <hash.hh>
+#include <helpers.hh>
+#include <objects/Transport.hh>
+#include <objects/ZCError.hh>
+#include <zcio.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+const size_t MAX_LINE = 4096;
+
+/**
+ * @brief Buffered reads and full writes on a socket
+ */
+struct Connection
+{
+  explicit Connection(int fd) : fd(fd) {}
+
+  int fd;
+  string buffer;
+
+  bool fill()
+  {
+    char chunk[1 << 16];
+    ssize_t n;
+    do
+      n = ::read(fd, chunk, sizeof(chunk));
+    while (n < 0 && errno == EINTR);
+    if (n <= 0)
+      return false;
+    buffer.append(chunk, n);
+    return true;
+  }
+
+  bool readLine(string &line)
+  {
+    size_t pos;
+    // Requests and replies are short lines
+    while ((pos = buffer.find('\n')) == string::npos)
+      if (buffer.size() > MAX_LINE || !fill())
+        return false;
+    line = buffer.substr(0, pos);
+    buffer.erase(0, pos + 1);
+    return true;
+  }
+
+  bool readExact(size_t size, string &data)
+  {
+    while (buffer.size() < size)
+      if (!fill())
+        return false;
+    data = buffer.substr(0, size);
+    buffer.erase(0, size);
+    return true;
+  }
+
+  bool writeAll(const string &data)
+  {
+    size_t written = 0;
+    while (written < data.size())
+    {
+      // A peer which went away is an error, not a SIGPIPE killing us
+      ssize_t n = send(fd, data.data() + written, data.size() - written,
+                       MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      written += n;
+    }
+    return true;
+  }
+};
+
+bool readFile(const fs::path &path, size_t offset, string &data)
+{
+  ifstream input(path, ios::binary);
+  if (!input.is_open())
+    return false;
+  input.seekg(0, ios::end);
+  size_t size = input.tellg();
+  if (offset > size)
+    return false;
+  data.resize(size - offset);
+  input.seekg(offset);
+  input.read(data.data(), data.size());
+  return input.good() || input.eof();
+}
+
+/**
+ * @brief Answer a single request of a client on a local store
+ */
+bool handleRequest(Connection &c, LocalTransport &store, const string &line)
+{
+  istringstream request(line);
+  string verb, arg;
+  size_t number = 0;
+  request >> verb >> arg >> number;
+
+  string payload, response;
+  bool ok = false;
+  if (verb == "HAS")
+    ok = store.hasChunk(arg);
+  else if (verb == "GET")
+    ok = store.getChunk(arg, number, response);
+  else if (verb == "MANIFEST")
+    ok = store.getManifest(arg, response);
+  else if (verb == "PUT" || verb == "PUBLISH")
+  {
+    // The payload is read whole, so its size is bounded. It can't be skipped
+    // either, so the connection is closed
+    if (number > (verb == "PUT" ? MAX_CHUNK : MAX_MANIFEST))
+    {
+      c.writeAll("ERR " + verb + " " + arg + " too large\n");
+      return false;
+    }
+    if (!c.readExact(number, payload))
+      return false;
+    ok = verb == "PUT" ? store.putChunk(arg, payload)
+                       : store.putManifest(arg, payload);
+  }
+  else
+    return c.writeAll("ERR bad request\n");
+
+  if (!ok)
+    return c.writeAll("ERR " + verb + " " + arg + " failed\n");
+  return c.writeAll("OK " + to_string(response.size()) + "\n") &&
+         c.writeAll(response);
+}
+
+} // namespace
+
+// ----------------------------------------------- Transport
+
+unique_ptr<Transport> Transport::open(const string &server)
+{
+  if (server.rfind(SOCKET_PREFIX, 0) == 0)
+    return make_unique<SocketTransport>(
+        server.substr(string(SOCKET_PREFIX).size()));
+  return make_unique<LocalTransport>(server);
+}
+
+bool Transport::isValidName(const string &name)
+{
+  return !name.empty() && name[0] != '.' &&
+         name.find('/') == string::npos && name.find('\n') == string::npos;
+}
+
+// ----------------------------------------------- LocalTransport
+
+LocalTransport::LocalTransport(const fs::path &root) : root_(root)
+{
+  fs::create_directories(root_ / "chunks");
+  fs::create_directories(root_ / "packages");
+}
+
+fs::path LocalTransport::chunkPath(const string &hash) const
+{
+  return root_ / "chunks" / hash.substr(0, 2) / hash;
+}
+
+bool LocalTransport::hasChunk(const string &hash)
+{
+  return isSha256(hash) && fs::exists(chunkPath(hash));
+}
+
+bool LocalTransport::getChunk(const string &hash, size_t offset, string &data)
+{
+  return isSha256(hash) && readFile(chunkPath(hash), offset, data);
+}
+
+bool LocalTransport::putChunk(const string &hash, const string &data)
+{
+  // Never store a chunk under a wrong address
+  if (!isSha256(hash) || sha256(data) != hash)
+    return false;
+  if (fs::exists(chunkPath(hash)))
+    return true;
+  return writeAtomically(chunkPath(hash), data);
+}
+
+bool LocalTransport::getManifest(const string &name, string &data)
+{
+  return isValidName(name) &&
+         readFile(root_ / "packages" / (name + ".json"), 0, data);
+}
+
+bool LocalTransport::putManifest(const string &name, const string &data)
+{
+  return isValidName(name) &&
+         writeAtomically(root_ / "packages" / (name + ".json"), data);
+}
+
+// ----------------------------------------------- SocketTransport
+
+SocketTransport::SocketTransport(const fs::path &socket_path)
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.string().size() >= sizeof(addr.sun_path))
+    throw ZCError(ZC_BAD_COMMAND,
+                  "Socket path too long: " + socket_path.string());
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 || connect(fd_, (sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    if (fd_ >= 0)
+      close(fd_);
+    throw ZCError(ZC_NOT_FOUND, "Couldn't connect to the package server: " +
+                                    socket_path.string());
+  }
+}
+
+SocketTransport::~SocketTransport()
+{
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool SocketTransport::request(const string &request, const string &payload,
+                              string &response)
+{
+  Connection c{fd_};
+  string line;
+  if (!c.writeAll(request + "\n" + payload) || !c.readLine(line))
+    throw ZCError(ZC_INTERNAL_ERROR, "The package server closed the "
+                                     "connection");
+  if (line.rfind("OK", 0) != 0)
+    return false;
+
+  // OK <size>, the size of a chunk or of a manifest
+  size_t size = 0;
+  bool valid = line.size() > 3 && line.size() <= 12 && line[2] == ' ' &&
+               all_of(line.begin() + 3, line.end(),
+                      [](char ch) { return isdigit((unsigned char)ch); });
+  if (valid)
+    size = stoul(line.substr(3));
+  if (!valid || size > max(MAX_CHUNK, MAX_MANIFEST))
+    throw ZCError(ZC_PARSING_ERROR,
+                  "Invalid reply of the package server: " + line);
+  if (!c.readExact(size, response))
+    throw ZCError(ZC_INTERNAL_ERROR, "The package server closed the "
+                                     "connection");
+  return true;
+}
+
+bool SocketTransport::hasChunk(const string &hash)
+{
+  string response;
+  return request("HAS " + hash, "", response);
+}
+
+bool SocketTransport::getChunk(const string &hash, size_t offset, string &data)
+{
+  return request("GET " + hash + " " + to_string(offset), "", data);
+}
+
+bool SocketTransport::putChunk(const string &hash, const string &data)
+{
+  string response;
+  return request("PUT " + hash + " " + to_string(data.size()), data,
+                 response);
+}
+
+bool SocketTransport::getManifest(const string &name, string &data)
+{
+  return request("MANIFEST " + name, "", data);
+}
+
+bool SocketTransport::putManifest(const string &name, const string &data)
+{
+  string response;
+  return request("PUBLISH " + name + " " + to_string(data.size()), data,
+                 response);
+}
+
+void SocketTransport::serve(const fs::path &store,
+                            const fs::path &socket_path)
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.string().size() >= sizeof(addr.sun_path))
+    throw ZCError(ZC_BAD_COMMAND,
+                  "Socket path too long: " + socket_path.string());
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  fs::remove(socket_path);
+  if (server < 0 || bind(server, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(server, SOMAXCONN) != 0)
+    throw ZCError(ZC_INTERNAL_ERROR,
+                  "Couldn't listen on " + socket_path.string() + ": " +
+                      strerror(errno));
+
+  LocalTransport local(store);
+  info("Serving " + store.string() + " on " + socket_path.string());
+  while (true)
+  {
+    int client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0)
+      continue;
+    // The local store is thread-safe: chunks and manifests are written
+    // atomically
+    thread(
+        [client, &local]()
+        {
+          Connection c{client};
+          string line;
+          while (c.readLine(line) && handleRequest(c, local, line))
+            ;
+          close(client);
+        })
+        .detach();
+  }
+}
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <objects/Watcher.hh>
+#include <objects/ZCError.hh>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// ----------------------------------------------- Helpers
+
+namespace
+{
+
+// Files written, or moved in or out of a directory
+const uint32_t FILE_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+const uint32_t TREE_EVENTS = FILE_EVENTS | IN_DELETE | IN_MOVED_FROM;
+
+fs::path normalize(const fs::path &file)
+{
+  return fs::absolute(file).lexically_normal();
+}
+
+} // namespace
+
+// ----------------------------------------------- Watcher class
+
+Watcher::Watcher() : fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+  if (fd_ < 0)
+    throw ZCError(ZC_INTERNAL_ERROR,
+                  string("Couldn't watch the files: ") + strerror(errno));
+}
+
+Watcher::~Watcher() { close(fd_); }
+
+void Watcher::watch(const vector<fs::path> &files)
+{
+  files_.clear();
+  set<fs::path> dirs;
+  for (const auto &f : files)
+  {
+    fs::path file = normalize(f);
+    files_.insert(file);
+    dirs.insert(file.parent_path());
+  }
+
+  // Stop watching the directories no file is in anymore. The directories of
+  // the trees are already watched for every event
+  for (auto it = dirs.begin(); it != dirs.end();)
+    it = inTree(*it) ? dirs.erase(it) : next(it);
+  for (auto it = dirs_.begin(); it != dirs_.end();)
+    if (!dirs.count(it->second) && !inTree(it->second))
+    {
+      inotify_rm_watch(fd_, it->first);
+      it = dirs_.erase(it);
+    }
+    else
+    {
+      dirs.erase(it->second);
+      ++it;
+    }
+
+  for (const auto &dir : dirs)
+  {
+    int wd = inotify_add_watch(fd_, dir.c_str(), FILE_EVENTS);
+    if (wd >= 0)
+      dirs_[wd] = dir;
+  }
+}
+
+void Watcher::watchTree(const fs::path &root)
+{
+  fs::path dir = normalize(root);
+  trees_.push_back(dir);
+  addTree(dir);
+}
+
+void Watcher::addTree(const fs::path &dir)
+{
+  error_code ec;
+  if (!fs::is_directory(dir, ec))
+    return;
+  int wd = inotify_add_watch(fd_, dir.c_str(), TREE_EVENTS);
+  if (wd >= 0)
+    dirs_[wd] = dir;
+  for (const auto &entry : fs::directory_iterator(dir, ec))
+    if (entry.is_directory(ec))
+      addTree(entry.path());
+}
+
+bool Watcher::inTree(const fs::path &dir) const
+{
+  return any_of(trees_.begin(), trees_.end(),
+                [&](const fs::path &root)
+                {
+                  auto [r, d] = mismatch(root.begin(), root.end(), dir.begin(),
+                                         dir.end());
+                  return r == root.end();
+                });
+}
+
+vector<fs::path> Watcher::wait(int timeout_ms, int debounce_ms)
+{
+  set<fs::path> changed;
+  struct pollfd pfd{fd_, POLLIN, 0};
+  int timeout = timeout_ms;
+  while (true)
+  {
+    int n = poll(&pfd, 1, timeout);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        return {};
+      throw ZCError(ZC_INTERNAL_ERROR,
+                    string("Couldn't watch the files: ") + strerror(errno));
+    }
+    // Nothing changed for the whole timeout, or the burst is over
+    if (n == 0)
+      break;
+    readEvents(changed);
+    if (!changed.empty())
+      timeout = debounce_ms;
+  }
+  return vector<fs::path>(changed.begin(), changed.end());
+}
+
+void Watcher::readEvents(set<fs::path> &changed)
+{
+  alignas(struct inotify_event) char buffer[16384];
+  while (true)
+  {
+    ssize_t n = read(fd_, buffer, sizeof(buffer));
+    if (n <= 0)
+      return;
+    for (char *p = buffer; p < buffer + n;)
+    {
+      auto *event = reinterpret_cast<struct inotify_event *>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      auto dir = dirs_.find(event->wd);
+      if (dir == dirs_.end())
+        continue;
+      // The directory was deleted
+      if (event->mask & IN_IGNORED)
+      {
+        dirs_.erase(dir);
+        continue;
+      }
+      if (event->len == 0)
+        continue;
+      fs::path file = dir->second / event->name;
+      bool in_tree = inTree(dir->second);
+      if (in_tree && (event->mask & IN_ISDIR) &&
+          (event->mask & (IN_CREATE | IN_MOVED_TO)))
+        addTree(file);
+      if (in_tree || files_.count(file))
+        changed.insert(file);
+    }
+  }
+}
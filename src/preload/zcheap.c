@@ -0,0 +1,674 @@
+/*
+ * Heap profiler preloaded by zc run --heap.
+ *
+ * malloc, free and their relatives, and operator new and delete, are
+ * interposed and aggregate each allocation and release as it happens: by call
+ * site, size class and lifetime. The blocks still allocated are kept in a
+ * table sharded by address, so that the threads seldom wait for each other,
+ * and whose size follows the live heap rather than the number of
+ * allocations. The totals, the call stacks of the sites and the memory
+ * mappings of the program are written to $ZC_HEAP_OUTPUT/profile when it
+ * exits, for ZC to symbolize them.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Allocator of the C library, which the hooks forward to
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+#define STACK_DEPTH 8
+#define STACK_SLOTS (1u << 16)
+#define MAX_PROBES 64
+
+// As HEAP_SIZE_CLASSES in HeapProfile.hh
+#define SIZE_CLASSES 18
+#define LIFETIME_CLASSES 64
+
+#define SHARDS 64
+#define MIN_BLOCKS 1024
+// Marks a released slot of a shard, blocks being aligned
+#define TOMBSTONE 1
+
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+struct Stack
+{
+  uint64_t hash;
+  uintptr_t frames[STACK_DEPTH];
+};
+
+/**
+ * The allocations of a call stack, the unknown stacks having the identifier 0
+ */
+struct Site
+{
+  uint64_t allocations;
+  uint64_t bytes;
+  uint64_t frees;
+  uint64_t freed_bytes;
+  uint64_t lifetimes;
+};
+
+struct Block
+{
+  uint64_t address;
+  uint64_t time;
+  uint64_t size;
+  uint64_t site;
+};
+
+/**
+ * Open addressing table of the live blocks whose address hashes to it
+ */
+struct Shard
+{
+  int lock;
+  size_t capacity;
+  // Live blocks and tombstones
+  size_t used;
+  size_t live;
+  struct Block *blocks;
+} __attribute__((aligned(64)));
+
+static int enabled;
+static pid_t owner;
+static char output[4096];
+static uint64_t start_time;
+
+static struct Stack *stacks;
+static struct Site *sites;
+static struct Shard shards[SHARDS];
+
+/**
+ * The totals of a thread, only written by it. The counters of an exited
+ * thread are taken over by the next thread started, and all of them are
+ * summed when the program exits
+ */
+struct Counters
+{
+  struct Counters *next;
+  struct Counters *next_free;
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t bytes;
+  uint64_t largest;
+  uint64_t class_allocations[SIZE_CLASSES];
+  uint64_t class_bytes[SIZE_CLASSES];
+  uint64_t lifetimes[LIFETIME_CLASSES];
+};
+
+// Every counters, and the ones of exited threads
+static struct Counters *counters;
+static struct Counters *free_counters;
+static int free_lock;
+// Counters of the threads allocating after their exit was handled
+static struct Counters late_counters;
+static pthread_key_t thread_exit;
+
+static uint64_t live_bytes, peak_bytes, peak_time;
+
+static TLS int in_hook;
+static TLS int thread_state;
+static TLS struct Counters *thread_counters;
+static TLS uintptr_t stack_top;
+
+static uint64_t now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void add(uint64_t *counter, uint64_t value)
+{
+  __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add to a counter of the calling thread, which only needs to be read whole
+ */
+static void addOwn(uint64_t *counter, uint64_t value)
+{
+  if (thread_counters == &late_counters)
+    add(counter, value);
+  else
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value,
+                     __ATOMIC_RELAXED);
+}
+
+/**
+ * Raise a counter to a value, returning whether it was lower
+ */
+static int raiseTo(uint64_t *counter, uint64_t value)
+{
+  uint64_t current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+  while (value > current)
+    if (__atomic_compare_exchange_n(counter, &current, value, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return 1;
+  return 0;
+}
+
+static size_t sizeClass(uint64_t size)
+{
+  if (size <= 16)
+    return 0;
+  // Rounded up to a power of two: 17 to 32 bytes are the class 1
+  size_t log = 64 - __builtin_clzll(size - 1);
+  return log - 4 < SIZE_CLASSES - 1 ? log - 4 : SIZE_CLASSES - 1;
+}
+
+static void lock(int *l)
+{
+  while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(l, __ATOMIC_RELAXED))
+      ;
+}
+
+static void unlock(int *l) { __atomic_store_n(l, 0, __ATOMIC_RELEASE); }
+
+static void onThreadExit(void *c)
+{
+  lock(&free_lock);
+  ((struct Counters *)c)->next_free = free_counters;
+  free_counters = c;
+  unlock(&free_lock);
+  thread_counters = &late_counters;
+  thread_state = 2;
+}
+
+/**
+ * Take the counters of an exited thread, or create new ones
+ */
+static struct Counters *takeCounters(void)
+{
+  lock(&free_lock);
+  struct Counters *c = free_counters;
+  if (c)
+    free_counters = c->next_free;
+  unlock(&free_lock);
+  if (c)
+    return c;
+
+  c = mmap(NULL, sizeof(struct Counters), PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (c == MAP_FAILED)
+    return NULL;
+  c->next = __atomic_load_n(&counters, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&counters, &c->next, c, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return c;
+}
+
+/**
+ * Set the calling thread up the first time it allocates: its counters and
+ * the bounds of its stack
+ */
+static void initThread(void)
+{
+  thread_state = 1;
+  thread_counters = takeCounters();
+  if (!thread_counters || pthread_setspecific(thread_exit, thread_counters))
+  {
+    if (thread_counters)
+      onThreadExit(thread_counters);
+    thread_counters = &late_counters;
+  }
+
+  // The stack is only walked within the bounds of the thread's stack
+  pthread_attr_t attr;
+  void *low;
+  size_t size;
+  if (pthread_getattr_np(pthread_self(), &attr) == 0)
+  {
+    if (pthread_attr_getstack(&attr, &low, &size) == 0)
+      stack_top = (uintptr_t)low + size;
+    pthread_attr_destroy(&attr);
+  }
+}
+
+/**
+ * Get the identifier of the call stack of a hook, 0 if it couldn't be kept
+ */
+static uint32_t stackId(uintptr_t fp)
+{
+  uintptr_t frames[STACK_DEPTH] = {0};
+  uintptr_t low = fp;
+  uint64_t hash = 1469598103934665603u;
+  for (size_t d = 0; d < STACK_DEPTH; d++)
+  {
+    if (!fp || fp % sizeof(uintptr_t) || fp < low ||
+        fp + 2 * sizeof(uintptr_t) > stack_top)
+      break;
+    frames[d] = ((uintptr_t *)fp)[1];
+    hash = (hash ^ frames[d]) * 1099511628211u;
+    uintptr_t next = ((uintptr_t *)fp)[0];
+    if (next <= fp)
+      break;
+    fp = next;
+  }
+  if (!frames[0])
+    return 0;
+  hash |= 1;
+
+  // Open addressing: an empty slot is claimed by setting its hash
+  for (uint32_t probe = 0; probe < MAX_PROBES; probe++)
+  {
+    uint32_t slot = (uint32_t)(hash + probe) % STACK_SLOTS;
+    uint64_t expected = 0;
+    if (__atomic_load_n(&stacks[slot].hash, __ATOMIC_ACQUIRE) == hash)
+      return slot + 1;
+    if (__atomic_compare_exchange_n(&stacks[slot].hash, &expected, hash, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      memcpy(stacks[slot].frames, frames, sizeof(frames));
+      return slot + 1;
+    }
+    if (expected == hash)
+      return slot + 1;
+  }
+  return 0;
+}
+
+// ----------------------------------------------- Live blocks
+
+static uint64_t hashAddress(uint64_t address)
+{
+  return (address >> 4) * 0x9e3779b97f4a7c15u;
+}
+
+static struct Shard *lockShard(uint64_t address)
+{
+  struct Shard *shard = &shards[hashAddress(address) >> 58];
+  lock(&shard->lock);
+  return shard;
+}
+
+/**
+ * Find the slot of a block in a shard, or the free slot it would take
+ */
+static struct Block *findBlock(struct Shard *shard, uint64_t address)
+{
+  struct Block *free_slot = NULL;
+  size_t mask = shard->capacity - 1;
+  for (size_t i = hashAddress(address) & mask;; i = (i + 1) & mask)
+  {
+    struct Block *b = &shard->blocks[i];
+    if (b->address == address)
+      return b;
+    if (b->address == TOMBSTONE && !free_slot)
+      free_slot = b;
+    if (b->address == 0)
+      return free_slot ? free_slot : b;
+  }
+}
+
+/**
+ * Rebuild a shard without its tombstones, with room for as many blocks again
+ */
+static int resizeShard(struct Shard *shard)
+{
+  size_t capacity = MIN_BLOCKS;
+  while (capacity < 4 * shard->live)
+    capacity *= 2;
+  struct Block *blocks = mmap(NULL, capacity * sizeof(struct Block),
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (blocks == MAP_FAILED)
+    return 0;
+
+  struct Block *old = shard->blocks;
+  size_t old_capacity = shard->capacity;
+  shard->blocks = blocks;
+  shard->capacity = capacity;
+  shard->used = shard->live;
+  for (size_t i = 0; i < old_capacity; i++)
+    if (old[i].address > TOMBSTONE)
+      *findBlock(shard, old[i].address) = old[i];
+  if (old)
+    munmap(old, old_capacity * sizeof(struct Block));
+  return 1;
+}
+
+/**
+ * Account for the release of a block
+ */
+static void release(const struct Block *b, uint64_t time)
+{
+  struct Site *site = &sites[b->site];
+  uint64_t lifetime = time - b->time;
+  add(&site->frees, 1);
+  add(&site->freed_bytes, b->size);
+  add(&site->lifetimes, lifetime);
+  struct Counters *c = thread_counters;
+  addOwn(&c->lifetimes[lifetime ? 63 - __builtin_clzll(lifetime) : 0], 1);
+  addOwn(&c->frees, 1);
+  __atomic_sub_fetch(&live_bytes, b->size, __ATOMIC_RELAXED);
+}
+
+static void onAlloc(void *address, size_t size, uintptr_t fp)
+{
+  if (!enabled || in_hook || !address)
+    return;
+  in_hook = 1;
+  if (!thread_state)
+    initThread();
+  uint64_t time = now();
+  uint32_t site = stackId(fp);
+
+  // A block already live was released without the hooks (e.g. by the C
+  // library itself)
+  struct Block replaced = {0, 0, 0, 0};
+  struct Shard *shard = lockShard((uintptr_t)address);
+  int tracked = 1;
+  if (2 * (shard->used + 1) > shard->capacity)
+    tracked = resizeShard(shard);
+  if (tracked)
+  {
+    struct Block *b = findBlock(shard, (uintptr_t)address);
+    if (b->address == (uintptr_t)address)
+      replaced = *b;
+    else
+    {
+      if (b->address == 0)
+        shard->used++;
+      shard->live++;
+    }
+    *b = (struct Block){(uintptr_t)address, time, size, site};
+  }
+  unlock(&shard->lock);
+  if (!tracked)
+  {
+    in_hook = 0;
+    return;
+  }
+  if (replaced.address)
+    release(&replaced, time);
+
+  add(&sites[site].allocations, 1);
+  add(&sites[site].bytes, size);
+  struct Counters *c = thread_counters;
+  addOwn(&c->allocations, 1);
+  addOwn(&c->bytes, size);
+  if (size > c->largest)
+    raiseTo(&c->largest, size);
+  addOwn(&c->class_allocations[sizeClass(size)], 1);
+  addOwn(&c->class_bytes[sizeClass(size)], size);
+  if (raiseTo(&peak_bytes,
+            __atomic_add_fetch(&live_bytes, size, __ATOMIC_RELAXED)))
+    __atomic_store_n(&peak_time, time - start_time, __ATOMIC_RELAXED);
+  in_hook = 0;
+}
+
+static void onFree(void *address)
+{
+  if (!enabled || in_hook || !address)
+    return;
+  in_hook = 1;
+  if (!thread_state)
+    initThread();
+  // Blocks allocated before the hooks started aren't known
+  struct Block released = {0, 0, 0, 0};
+  struct Shard *shard = lockShard((uintptr_t)address);
+  if (shard->capacity)
+  {
+    struct Block *b = findBlock(shard, (uintptr_t)address);
+    if (b->address == (uintptr_t)address)
+    {
+      released = *b;
+      b->address = TOMBSTONE;
+      shard->live--;
+    }
+  }
+  unlock(&shard->lock);
+  if (released.address)
+    release(&released, now());
+  in_hook = 0;
+}
+
+#define CALLER ((uintptr_t)__builtin_frame_address(0))
+
+// ----------------------------------------------- C allocator
+
+void *malloc(size_t size)
+{
+  void *p = __libc_malloc(size);
+  onAlloc(p, size, CALLER);
+  return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+  void *p = __libc_calloc(n, size);
+  onAlloc(p, n * size, CALLER);
+  return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  // Released first, as another thread may get the block once it is. A failed
+  // realloc leaves it allocated: its release is then ignored, as unknown
+  onFree(ptr);
+  void *p = __libc_realloc(ptr, size);
+  onAlloc(p, size, CALLER);
+  return p;
+}
+
+void free(void *ptr)
+{
+  onFree(ptr);
+  __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+  void *p = __libc_memalign(alignment, size);
+  onAlloc(p, size, CALLER);
+  return p;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+  void *p = __libc_memalign(alignment, size);
+  onAlloc(p, size, CALLER);
+  return p;
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+  if (alignment % sizeof(void *) || (alignment & (alignment - 1)))
+    return EINVAL;
+  void *p = __libc_memalign(alignment, size);
+  if (!p)
+    return ENOMEM;
+  onAlloc(p, size, CALLER);
+  *ptr = p;
+  return 0;
+}
+
+// ----------------------------------------------- C++ allocator
+
+/**
+ * Get the operator of the C++ library, which handles the failures (new
+ * handler, std::bad_alloc)
+ */
+static void *nextOperator(const char *name)
+{
+  in_hook = 1;
+  void *op = dlsym(RTLD_NEXT, name);
+  in_hook = 0;
+  return op;
+}
+
+// operator new(size_t)
+void *_Znwm(size_t size)
+{
+  void *p = __libc_malloc(size);
+  if (!p)
+    return ((void *(*)(size_t))nextOperator("_Znwm"))(size);
+  onAlloc(p, size, CALLER);
+  return p;
+}
+
+// operator new[](size_t)
+void *_Znam(size_t size)
+{
+  void *p = __libc_malloc(size);
+  if (!p)
+    return ((void *(*)(size_t))nextOperator("_Znam"))(size);
+  onAlloc(p, size, CALLER);
+  return p;
+}
+
+// operator delete(void *)
+void _ZdlPv(void *ptr)
+{
+  onFree(ptr);
+  __libc_free(ptr);
+}
+
+// operator delete[](void *)
+void _ZdaPv(void *ptr)
+{
+  onFree(ptr);
+  __libc_free(ptr);
+}
+
+// operator delete(void *, size_t)
+void _ZdlPvm(void *ptr, size_t size)
+{
+  (void)size;
+  onFree(ptr);
+  __libc_free(ptr);
+}
+
+// operator delete[](void *, size_t)
+void _ZdaPvm(void *ptr, size_t size)
+{
+  (void)size;
+  onFree(ptr);
+  __libc_free(ptr);
+}
+
+// ----------------------------------------------- Start and exit
+
+static void onFork(void)
+{
+  // Forked children don't write the profile of their parent
+  enabled = 0;
+}
+
+__attribute__((constructor)) static void start(void)
+{
+  const char *path = getenv("ZC_HEAP_OUTPUT");
+  if (!path || strlen(path) >= sizeof(output))
+    return;
+  strcpy(output, path);
+  // The programs this one executes aren't profiled
+  unsetenv("ZC_HEAP_OUTPUT");
+
+  stacks = mmap(NULL, STACK_SLOTS * sizeof(struct Stack),
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  sites = mmap(NULL, (STACK_SLOTS + 1) * sizeof(struct Site),
+               PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (stacks == MAP_FAILED || sites == MAP_FAILED ||
+      pthread_key_create(&thread_exit, onThreadExit) != 0)
+    return;
+  pthread_atfork(NULL, NULL, onFork);
+  owner = getpid();
+  start_time = now();
+  enabled = 1;
+}
+
+__attribute__((destructor)) static void stop(void)
+{
+  if (!enabled || getpid() != owner)
+    return;
+  in_hook = 1;
+  enabled = 0;
+
+  char path[sizeof(output) + 8];
+  snprintf(path, sizeof(path), "%s/profile", output);
+  FILE *out = fopen(path, "w");
+  if (!out)
+    return;
+  fputs("zcheap 2\nmaps\n", out);
+
+  // 1. The mappings, to find the file and offset of each address
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (maps)
+  {
+    char line[4096 + 256];
+    while (fgets(line, sizeof(line), maps))
+      fputs(line, out);
+    fclose(maps);
+  }
+
+  // 2. The totals, size classes and lifetimes of every thread
+  struct Counters total;
+  memcpy(&total, &late_counters, sizeof(total));
+  for (struct Counters *c = __atomic_load_n(&counters, __ATOMIC_ACQUIRE); c;
+       c = c->next)
+  {
+    total.allocations += c->allocations;
+    total.frees += c->frees;
+    total.bytes += c->bytes;
+    if (c->largest > total.largest)
+      total.largest = c->largest;
+    for (size_t i = 0; i < SIZE_CLASSES; i++)
+    {
+      total.class_allocations[i] += c->class_allocations[i];
+      total.class_bytes[i] += c->class_bytes[i];
+    }
+    for (size_t i = 0; i < LIFETIME_CLASSES; i++)
+      total.lifetimes[i] += c->lifetimes[i];
+  }
+  fprintf(out, "totals %llu %llu %llu %llu %llu %llu %llu\n",
+          (unsigned long long)total.allocations,
+          (unsigned long long)total.frees, (unsigned long long)total.bytes,
+          (unsigned long long)total.largest, (unsigned long long)peak_bytes,
+          (unsigned long long)peak_time,
+          (unsigned long long)(now() - start_time));
+  fputs("classes", out);
+  for (size_t i = 0; i < SIZE_CLASSES; i++)
+    fprintf(out, " %llu %llu", (unsigned long long)total.class_allocations[i],
+            (unsigned long long)total.class_bytes[i]);
+  fputs("\nlifetimes", out);
+  for (size_t i = 0; i < LIFETIME_CLASSES; i++)
+    fprintf(out, " %llu", (unsigned long long)total.lifetimes[i]);
+
+  // 3. The sites, by identifier, with their stack, the call site first
+  fputs("\nsites\n", out);
+  for (uint32_t id = 0; id <= STACK_SLOTS; id++)
+  {
+    const struct Site *site = &sites[id];
+    if (!site->allocations)
+      continue;
+    fprintf(out, "%u %llu %llu %llu %llu %llu", id,
+            (unsigned long long)site->allocations,
+            (unsigned long long)site->bytes, (unsigned long long)site->frees,
+            (unsigned long long)site->freed_bytes,
+            (unsigned long long)site->lifetimes);
+    for (size_t d = 0; id && d < STACK_DEPTH && stacks[id - 1].frames[d]; d++)
+      fprintf(out, " %zx", (size_t)stacks[id - 1].frames[d]);
+    fputc('\n', out);
+  }
+  fclose(out);
+}
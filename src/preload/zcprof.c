@@ -0,0 +1,181 @@
+/*
+ * Sampling profiler preloaded by zc run --profile.
+ *
+ * The program is interrupted by SIGPROF at a fixed rate of CPU time, and the
+ * stack of the interrupted thread is walked through its frame pointers. The
+ * stacks are appended to a buffer shared by all the threads without locks,
+ * and written to $ZC_PROF_OUTPUT with the memory mappings of the program when
+ * it exits, for ZC to symbolize them.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// Addresses kept, 64 MiB at most (the pages are only used when written)
+#define BUFFER_WORDS (8u << 20)
+#define MAX_DEPTH 128
+#define DEFAULT_HZ 999
+
+static uintptr_t *buffer;
+static size_t used;
+static size_t dropped;
+static long hz;
+static pid_t owner = -1;
+static char output[4096];
+
+// Written to, to check that an address can be read without faulting
+static int probe[2] = {-1, -1};
+
+/**
+ * Check that two words can be read at an address: writing them to a pipe
+ * fails with EFAULT otherwise. What is written is read back at once, so that
+ * the pipe never fills
+ */
+static int readable(uintptr_t addr)
+{
+  char drain[2 * sizeof(uintptr_t)];
+  if (write(probe[1], (const void *)addr, sizeof(drain)) != sizeof(drain))
+    return 0;
+  while (read(probe[0], drain, sizeof(drain)) < 0 && errno == EINTR)
+    ;
+  return 1;
+}
+
+static void onSample(int sig, siginfo_t *info, void *context)
+{
+  (void)sig;
+  (void)info;
+  int saved_errno = errno;
+  ucontext_t *uc = (ucontext_t *)context;
+  uintptr_t pc = 0, fp = 0;
+#if defined(__x86_64__)
+  pc = uc->uc_mcontext.gregs[REG_RIP];
+  fp = uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+  pc = uc->uc_mcontext.pc;
+  fp = uc->uc_mcontext.regs[29];
+#else
+  (void)uc;
+#endif
+
+  // 1. Leaf first: each frame holds the frame of its caller, then the return
+  // address. The callers are higher on the stack
+  uintptr_t stack[MAX_DEPTH];
+  size_t depth = 0;
+  if (pc)
+    stack[depth++] = pc;
+  while (fp && depth < MAX_DEPTH && fp % sizeof(uintptr_t) == 0 &&
+         readable(fp))
+  {
+    uintptr_t next = ((uintptr_t *)fp)[0], ret = ((uintptr_t *)fp)[1];
+    if (!ret)
+      break;
+    stack[depth++] = ret;
+    if (next <= fp || next - fp > (1u << 24))
+      break;
+    fp = next;
+  }
+
+  // 2. Reserve room for the depth and the addresses
+  if (depth > 0)
+  {
+    size_t start = __atomic_fetch_add(&used, depth + 1, __ATOMIC_RELAXED);
+    if (start + depth + 1 <= BUFFER_WORDS)
+    {
+      memcpy(&buffer[start + 1], stack, depth * sizeof(uintptr_t));
+      __atomic_store_n(&buffer[start], depth, __ATOMIC_RELEASE);
+    }
+    else
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+  }
+  errno = saved_errno;
+}
+
+__attribute__((constructor)) static void start(void)
+{
+  const char *path = getenv("ZC_PROF_OUTPUT");
+  if (!path || strlen(path) >= sizeof(output))
+    return;
+  strcpy(output, path);
+  const char *rate = getenv("ZC_PROF_HZ");
+  hz = rate ? atol(rate) : DEFAULT_HZ;
+  if (hz <= 0)
+    hz = DEFAULT_HZ;
+  // The programs this one executes aren't profiled
+  unsetenv("ZC_PROF_OUTPUT");
+
+  buffer = mmap(NULL, BUFFER_WORDS * sizeof(uintptr_t), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (buffer == MAP_FAILED || pipe2(probe, O_NONBLOCK | O_CLOEXEC) < 0)
+  {
+    buffer = NULL;
+    return;
+  }
+  owner = getpid();
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = onSample;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+
+  // CPU time of the whole process: the threads using the CPU are sampled
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / hz;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+__attribute__((destructor)) static void stop(void)
+{
+  // Forked children exit without the samples of their parent
+  if (!buffer || getpid() != owner)
+    return;
+  struct itimerval off;
+  memset(&off, 0, sizeof(off));
+  setitimer(ITIMER_PROF, &off, NULL);
+  signal(SIGPROF, SIG_IGN);
+
+  FILE *out = fopen(output, "w");
+  if (!out)
+    return;
+  size_t end = used < BUFFER_WORDS ? used : BUFFER_WORDS;
+  fprintf(out, "zcprof 1\nhz %ld\ndropped %zu\nmaps\n", hz, dropped);
+
+  // 1. The mappings, to find the file and offset of each address
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (maps)
+  {
+    char line[4096 + 256];
+    while (fgets(line, sizeof(line), maps))
+      fputs(line, out);
+    fclose(maps);
+  }
+
+  // 2. The stacks, one per line, leaf first. A stack a thread hadn't finished
+  // writing ends the samples
+  fputs("samples\n", out);
+  for (size_t i = 0; i < end;)
+  {
+    size_t depth = __atomic_load_n(&buffer[i], __ATOMIC_ACQUIRE);
+    if (depth == 0 || depth > MAX_DEPTH || i + depth + 1 > end)
+      break;
+    for (size_t d = 0; d < depth; d++)
+      fprintf(out, d ? " %zx" : "%zx", (size_t)buffer[i + 1 + d]);
+    fputc('\n', out);
+    i += depth + 1;
+  }
+  fclose(out);
+}
@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
 #include <iostream>
+#include <memory>
 
 #include <zcio.hh>
 
@@ -53,23 +57,70 @@ bool ask(const string &question)
 
 namespace
 {
-void padding(int length)
+/**
+ * @brief Decode the UTF-8 character at pos and move pos after it (invalid
+ * bytes are read as single characters)
+ */
+char32_t decodeUtf8(string_view s, size_t &pos)
+{
+  unsigned char c = s[pos++];
+  int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+  char32_t cp = extra ? c & (0x3F >> extra) : c;
+  for (; extra > 0 && pos < s.size() && (s[pos] & 0xC0) == 0x80; extra--)
+    cp = (cp << 6) | (s[pos++] & 0x3F);
+  return cp;
+}
+
+/**
+ * @brief Get the number of terminal columns taken by a character
+ */
+int charWidth(char32_t cp)
+{
+  // Combining marks and zero width characters
+  if ((cp >= 0x0300 && cp <= 0x036F) || (cp >= 0x200B && cp <= 0x200F) ||
+      (cp >= 0xFE00 && cp <= 0xFE0F) || (cp >= 0x20D0 && cp <= 0x20FF))
+    return 0;
+  // East Asian wide and fullwidth characters, emojis
+  if ((cp >= 0x1100 && cp <= 0x115F) || (cp >= 0x2E80 && cp <= 0xA4CF) ||
+      (cp >= 0xAC00 && cp <= 0xD7A3) || (cp >= 0xF900 && cp <= 0xFAFF) ||
+      (cp >= 0xFE30 && cp <= 0xFE4F) || (cp >= 0xFF00 && cp <= 0xFF60) ||
+      (cp >= 0xFFE0 && cp <= 0xFFE6) || (cp >= 0x1F300 && cp <= 0x1FAFF) ||
+      (cp >= 0x20000 && cp <= 0x3FFFD))
+    return 2;
+  return 1;
+}
+
+/**
+ * @brief Get the number of terminal columns taken by a UTF-8 string
+ */
+int displayWidth(string_view s)
+{
+  int width = 0;
+  for (size_t pos = 0; pos < s.size();)
+    width += charWidth(decodeUtf8(s, pos));
+  return width;
+}
+
+void repeat(string &line, int length, const string &s)
 {
   for (int i = 0; i < length; i++)
-  {
-    printf(" ");
-  }
+    line += s;
 }
 } // namespace
 
 Table::Table(int n_rows, int n_cols, bool hasRowHeaders, bool hasColHeaders,
              const std::vector<std::vector<std::string>> &content)
-    : n_rows_(n_rows), n_cols_(n_cols), hasRowHeaders_(hasRowHeaders),
-      hasColHeaders_(hasColHeaders), current_line_(0), content_(content)
+    : Table(n_rows, n_cols, hasRowHeaders, hasColHeaders, RowSource())
+{
+  setContent(content);
+}
+
+Table::Table(int n_rows, int n_cols, bool hasRowHeaders, bool hasColHeaders,
+             RowSource source)
+    : n_cols_(n_cols), n_rows_(n_rows), source_(std::move(source)),
+      hasRowHeaders_(hasRowHeaders), hasColHeaders_(hasColHeaders)
 {
-  // Allocate internal vectors' size before using them
   max_widths_.resize(n_cols, 0);
-  sizes_.resize(n_rows, std::vector<int>(n_cols, 0));
 }
 
 Table::~Table() {}
@@ -88,7 +139,55 @@ void Table::setThickness(bool rowThickness, bool colThickness,
 
 void Table::setContent(std::vector<std::vector<std::string>> content)
 {
-  content_ = content;
+  // The source owns the rows, so that it stays valid in copies of the table
+  auto rows =
+      make_shared<const vector<vector<string>>>(std::move(content));
+  source_ = [rows](size_t row, vector<string_view> &cells, deque<string> &)
+  {
+    if (row >= rows->size())
+      return false;
+    cells.assign((*rows)[row].begin(), (*rows)[row].end());
+    return true;
+  };
+}
+
+void Table::setRange(size_t offset, size_t count)
+{
+  offset_ = offset;
+  count_ = count;
+}
+
+void Table::setMaxWidth(size_t width) { max_width_ = width; }
+
+bool Table::readRow(size_t row)
+{
+  cells_.clear();
+  storage_.clear();
+  if ((int)row >= n_rows_ || !source_ || !source_(row, cells_, storage_))
+    return false;
+  cells_.resize(n_cols_);
+
+  if (max_width_ == 0)
+    return true;
+  for (auto &cell : cells_)
+  {
+    if (displayWidth(cell) <= (int)max_width_)
+      continue;
+    // Cut on a character boundary and mark the cut with an ellipsis
+    size_t pos = 0, end = 0;
+    int width = 0;
+    while (pos < cell.size())
+    {
+      int w = charWidth(decodeUtf8(cell, pos));
+      if (width + w > (int)max_width_ - 1)
+        break;
+      width += w;
+      end = pos;
+    }
+    storage_.push_back(string(cell.substr(0, end)) + "\u2026");
+    cell = storage_.back();
+  }
+  return true;
 }
 
 /**
@@ -96,22 +195,22 @@ void Table::setContent(std::vector<std::vector<std::string>> content)
  */
 void Table::getWidths()
 {
-  for (int j = 0; j < n_cols_; j++)
+  fill(max_widths_.begin(), max_widths_.end(), 0);
+  auto measure = [this]()
   {
-    int max_col = 0;
-    for (int i = 0; i < n_rows_; i++)
-    {
-      // Check if the line does exist in content_
-      if (i < (int)content_.size() && j < (int)content_[i].size())
-      {
-        int length = content_[i][j].size();
-        sizes_[i][j] = length;
-        if (length > max_col)
-          max_col = length;
-      }
-    }
-    max_widths_[j] = max_col + 2;
-  }
+    for (int j = 0; j < n_cols_; j++)
+      max_widths_[j] = max(max_widths_[j], displayWidth(cells_[j]));
+  };
+
+  size_t first = hasColHeaders_ ? 1 : 0;
+  if (hasColHeaders_ && readRow(0))
+    measure();
+  for (size_t i = first + offset_;
+       (count_ == 0 || i < first + offset_ + count_) && readRow(i); i++)
+    measure();
+
+  for (auto &w : max_widths_)
+    w += 2;
 }
 
 void Table::getChars()
@@ -232,105 +331,46 @@ void Table::getChars()
   }
 }
 
-static void drawLine(int length, string line)
+void Table::writeLine()
 {
-  for (int i = 0; i < length; i++)
-    cout << line;
+  line_ += '\n';
+  cout.write(line_.data(), line_.size());
+  line_.clear();
 }
 
-void Table::topLine()
+void Table::horizontalLine(const string &left, const string &fill,
+                           const string &sepCross, const string &cross,
+                           const string &right)
 {
-  cout << chars_.topLeftCorner_;
-  drawLine(max_widths_[0], chars_.borderRow_);
-
+  line_ += left;
+  repeat(line_, max_widths_[0], fill);
   for (int i = 1; i < n_cols_; i++)
   {
     // 1. Separator first
-    if (hasRowHeaders_ && i == 1)
-      cout << chars_.topSepT_;
-    else
-      cout << chars_.topT_;
-
-    // 2. Then the horizontal line for this row
-    drawLine(max_widths_[i], chars_.borderRow_);
-  }
-  cout << chars_.topRightCorner_ << '\n';
-}
-
-void Table::bottomLine()
-{
-  cout << chars_.bottomLeftCorner_;
-  drawLine(max_widths_[0], chars_.borderRow_);
-
-  for (int i = 1; i < n_cols_; i++)
-  {
-    if (hasRowHeaders_ && i == 1)
-      cout << chars_.bottomSepT_;
-    else
-      cout << chars_.bottomT_;
-
-    drawLine(max_widths_[i], chars_.borderRow_);
-  }
-  cout << chars_.bottomRightCorner_ << '\n';
-}
-
-void Table::columnHeaderSeparator()
-{
-  cout << chars_.leftSepT_;
-  drawLine(max_widths_[0], chars_.sepRow_);
-
-  for (int i = 1; i < n_cols_; i++)
-  {
-    if (hasRowHeaders_ && i == 1)
-      cout << chars_.sepSepCross_;
-    else
-      cout << chars_.sepCross_;
-
-    drawLine(max_widths_[i], chars_.sepRow_);
-  }
-  cout << chars_.rightSepT_ << '\n';
-}
-
-void Table::separator()
-{
-  cout << chars_.leftT_;
-  drawLine(max_widths_[0], chars_.row_);
-
-  for (int i = 1; i < n_cols_; i++)
-  {
-    if (hasRowHeaders_ && i == 1)
-      cout << chars_.sepCross_;
-    else
-      cout << chars_.cross_;
-
-    drawLine(max_widths_[i], chars_.row_);
+    line_ += (hasRowHeaders_ && i == 1) ? sepCross : cross;
+    // 2. Then the horizontal line for this column
+    repeat(line_, max_widths_[i], fill);
   }
-  cout << chars_.rightT_ << '\n';
+  line_ += right;
+  writeLine();
 }
 
 void Table::middleLine()
 {
   // Left border
-  cout << chars_.borderCol_;
-
-  // First column
-  padding(max_widths_[0] - sizes_[current_line_][0] - 1);
-  cout << (content_[current_line_][0].empty() ? "" : content_[current_line_][0])
-       << " ";
-
-  // Autres colonnes
-  for (int i = 1; i < n_cols_; i++)
+  line_ += chars_.borderCol_;
+  for (int i = 0; i < n_cols_; i++)
   {
-    cout << chars_.col_; // Internal vertical separator
-    padding(max_widths_[i] - sizes_[current_line_][i] - 1);
-    cout << (content_[current_line_][i].empty() ? ""
-                                                : content_[current_line_][i])
-         << " ";
+    // Internal vertical separator
+    if (i > 0)
+      line_ += chars_.col_;
+    line_.append(max_widths_[i] - displayWidth(cells_[i]) - 1, ' ');
+    line_ += cells_[i];
+    line_ += ' ';
   }
-
-  current_line_++;
   // Right border
-  cout << chars_.borderCol_ << '\n';
+  line_ += chars_.borderCol_;
+  writeLine();
 }
 
 int Table::getSize() const { return n_rows_; }
@@ -340,28 +380,32 @@ void Table::draw()
   getWidths();
   getChars();
 
-  topLine();
+  horizontalLine(chars_.topLeftCorner_, chars_.borderRow_, chars_.topSepT_,
+                 chars_.topT_, chars_.topRightCorner_);
 
+  size_t first = 0;
   if (hasColHeaders_)
   {
-    middleLine();
-    columnHeaderSeparator();
+    if (readRow(0))
+      middleLine();
+    horizontalLine(chars_.leftSepT_, chars_.sepRow_, chars_.sepSepCross_,
+                   chars_.sepCross_, chars_.rightSepT_);
+    first = 1;
   }
 
   // S'il reste des lignes à dessiner
-  if (current_line_ < n_rows_)
+  size_t end = count_ == 0 ? SIZE_MAX : first + offset_ + count_;
+  for (size_t i = first + offset_; i < end && readRow(i); i++)
   {
+    if (i > first + offset_)
+      horizontalLine(chars_.leftT_, chars_.row_, chars_.sepCross_,
+                     chars_.cross_, chars_.rightT_);
     middleLine();
-    while (current_line_ < n_rows_)
-    {
-      separator();
-      middleLine();
-    }
   }
 
-  bottomLine();
-  // In case the table is being displayed again
-  current_line_ = 0;
+  horizontalLine(chars_.bottomLeftCorner_, chars_.borderRow_,
+                 chars_.bottomSepT_, chars_.bottomT_, chars_.bottomRightCorner_);
+  cout.flush();
 }
 
 const char UPPER[26][FONT_HEIGHT][FONT_WIDTH] = {